@@ -0,0 +1,546 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks of the hot paths
+ *
+ * Usage: maskuni_bench [-r REPEATS] [FILTER...]
+ * Each benchmark whose name contains one of the filters is run REPEATS times (default: 3)
+ * and the best run is reported. The inputs are built in memory or in temporary files
+ * so that the results only depend on the build and on the machine.
+ */
+
+#include "config.h"
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "Mask.h"
+#include "MaskGenerator.h"
+#include "Generate.h"
+#include "GenerateUtf8.h"
+#include "ReadCharsets.h"
+#include "ReadMasks.h"
+#include "ReadBruteforce.h"
+#include "utf_conv.h"
+#include "Maskuni.h"
+
+using namespace Maskuni;
+
+// entry point of maskuni, see main.cpp
+int real_main(int argc, char **argv);
+
+namespace {
+
+/**
+ * @brief Amount of work done by a single run of a benchmark
+ */
+struct Work {
+    uint64_t m_items;   /*!< number of items (words, masks, characters) */
+    uint64_t m_bytes;   /*!< number of bytes produced or consumed */
+};
+
+/**
+ * @brief A named benchmark
+ */
+struct Benchmark {
+    std::string m_name;                 /*!< name, used by the filters */
+    const char *m_unit;                 /*!< name of the items */
+    std::function<Work()> m_run;        /*!< a single run */
+};
+
+/* defeats the dead code elimination */
+volatile uint64_t sink;
+
+double seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Temporary file removed at exit
+ */
+class TempFile
+{
+    std::string m_path;
+
+public:
+    explicit TempFile(const std::string &content) : m_path()
+    {
+        const char *dir = getenv("TMPDIR");
+        std::string tmpl = std::string(dir ? dir : "/tmp") + "/maskuni_bench_XXXXXX";
+        std::vector<char> path(tmpl.begin(), tmpl.end());
+        path.push_back(0);
+        int fd = mkstemp(path.data());
+        if (fd < 0) {
+            fprintf(stderr, "Error: can't create a temporary file: %m\n");
+            exit(1);
+        }
+        if (write(fd, content.data(), content.size()) != (ssize_t) content.size()) {
+            fprintf(stderr, "Error: can't write a temporary file: %m\n");
+            exit(1);
+        }
+        close(fd);
+        m_path = path.data();
+    }
+    ~TempFile()
+    {
+        unlink(m_path.c_str());
+    }
+    const char *path() const
+    {
+        return m_path.c_str();
+    }
+};
+
+template<typename T>
+CharsetMap<T> defaultCharsets();
+
+template<>
+CharsetMap<char> defaultCharsets<char>()
+{
+    CharsetMap<char> charsets;
+    initDefaultCharsetsAscii(charsets);
+    for (const auto &p : charsets) {
+        expandCharsetAscii(charsets, p.first);
+    }
+    return charsets;
+}
+
+template<>
+CharsetMap<uint32_t> defaultCharsets<uint32_t>()
+{
+    CharsetMap<uint32_t> charsets;
+    initDefaultCharsetsUnicode(charsets);
+    for (const auto &p : charsets) {
+        expandCharsetUnicode(charsets, p.first);
+    }
+    return charsets;
+}
+
+/**
+ * @brief Build a mask of \a width positions of the same charset
+ */
+template<typename T>
+Mask<T> uniformMask(size_t width, size_t charset_len, T first)
+{
+    std::vector<T> charset(charset_len);
+    for (size_t i = 0; i < charset_len; i++) {
+        charset[i] = first + (T) i;
+    }
+    Mask<T> mask;
+    for (size_t i = 0; i < width; i++) {
+        mask.push_charset_right(charset.data(), charset.size());
+    }
+    return mask;
+}
+
+/**
+ * @brief Number of bytes of all the words of a mask, without the delimiters
+ */
+uint64_t wordsBytes(const Mask<char> &mask)
+{
+    return mask.getLen() * mask.getWidth();
+}
+
+uint64_t wordsBytes(const Mask<uint32_t> &mask)
+{
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < mask.getWidth(); i++) {
+        const Charset<uint32_t> &charset = mask.getCharset(i);
+        uint64_t enc = 0;
+        char tmp[4];
+        for (uint64_t c = 0; c < charset.getLen(); c++) {
+            enc += UTF::impl::CpToUtf8::write(charset.data()[c], tmp);
+        }
+        // each character of the charset appears len / charset_len times
+        bytes += mask.getLen() / charset.getLen() * enc;
+    }
+    return bytes;
+}
+
+MaskGenerator<char> *readGenerator(const char *spec, bool bruteforce, const CharsetMap<char> &charsets)
+{
+    return bruteforce ? readBruteforceAscii(spec, charsets) : readMaskListAscii(spec, charsets);
+}
+
+MaskGenerator<uint32_t> *readGenerator(const char *spec, bool bruteforce, const CharsetMap<uint32_t> &charsets)
+{
+    return bruteforce ? readBruteforceUtf8(spec, charsets) : readMaskListUtf8(spec, charsets);
+}
+
+/**
+ * @brief Count the words and the bytes generated by maskuni for a mask list or a bruteforce file
+ */
+template<typename T>
+Work outputSize(const std::string &spec, bool bruteforce, int delim_width)
+{
+    CharsetMap<T> charsets = defaultCharsets<T>();
+    std::unique_ptr<MaskGenerator<T>> gen(readGenerator(spec.c_str(), bruteforce, charsets));
+    if (!gen) {
+        fprintf(stderr, "Error: can't read '%s'\n", spec.c_str());
+        exit(1);
+    }
+    Work w = {0, 0};
+    Mask<T> mask;
+    while ((*gen)(mask)) {
+        w.m_items += mask.getLen();
+        w.m_bytes += mask.getLen() * delim_width + wordsBytes(mask);
+    }
+    return w;
+}
+
+/**
+ * @brief Run maskuni with the output sent to /dev/null
+ */
+void runMaskuni(std::vector<std::string> args)
+{
+    args.insert(args.begin(), "maskuni");
+    args.insert(args.begin() + 1, "--output=/dev/null");
+    std::vector<char *> argv;
+    for (auto &a : args) {
+        argv.push_back(&a[0]);
+    }
+    argv.push_back(NULL);
+    optind = 1;
+    if (real_main((int) args.size(), argv.data()) != 0) {
+        fprintf(stderr, "Error: maskuni failed\n");
+        exit(1);
+    }
+}
+
+std::string readMasksContent(unsigned int n_lines)
+{
+    // a mix of plain masks, inline charsets and escapes
+    static const char *lines[] = {
+        "?l?l?l?d?d",
+        "?u?l?l?l?l?d?d?s",
+        "abc,?1?1?1?d",
+        "?d?l,?u?s,?1?2?1?2?1",
+        "ABCDEF?d,xyz\\,,?1?2?l?l?d",
+        "P@ssw0rd?d?d",
+        "?h?h?h?h?h?h?h?h",
+        "!@#,?1?l?u?d",
+    };
+    std::string content;
+    for (unsigned int i = 0; i < n_lines; i++) {
+        content += lines[i % (sizeof(lines) / sizeof(lines[0]))];
+        content += '\n';
+    }
+    return content;
+}
+
+std::vector<Benchmark> makeBenchmarks()
+{
+    std::vector<Benchmark> benchmarks;
+
+    // Mask<T>::getNext over widths and charset sizes
+    for (size_t width : {4, 8, 12, 16}) {
+        for (size_t cs : {2, 10, 26, 95}) {
+            if (width * std::log2((double) cs) >= 63) {
+                // the mask can't be counted
+                continue;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "mask_getnext<char> w=%zu cs=%zu", width, cs);
+            benchmarks.push_back({name, "words", [width, cs]() {
+                const uint64_t n = 1 << 25;
+                Mask<char> mask = uniformMask<char>(width, cs, ' ');
+                std::vector<char> w(width);
+                mask.setPosition(0);
+                mask.getCurrent(w.data());
+                uint64_t check = 0;
+                for (uint64_t i = 0; i < n; i++) {
+                    mask.getNext(w.data());
+                    check += (unsigned char) w[width - 1];
+                }
+                sink = check;
+                return Work{n, n * width};
+            }});
+        }
+    }
+    for (size_t width : {4, 8, 12}) {
+        char name[64];
+        snprintf(name, sizeof(name), "mask_getnext<uint32_t> w=%zu cs=26", width);
+        benchmarks.push_back({name, "words", [width]() {
+            const uint64_t n = 1 << 25;
+            Mask<uint32_t> mask = uniformMask<uint32_t>(width, 26, 'a');
+            std::vector<uint32_t> w(width);
+            mask.setPosition(0);
+            mask.getCurrent(w.data());
+            uint64_t check = 0;
+            for (uint64_t i = 0; i < n; i++) {
+                mask.getNext(w.data());
+                check += w[width - 1];
+            }
+            sink = check;
+            return Work{n, n * width * sizeof(uint32_t)};
+        }});
+    }
+
+    // generation kernels into a memory buffer
+    for (size_t width : {4, 8, 12}) {
+        char name[64];
+        snprintf(name, sizeof(name), "generate_words<char> w=%zu cs=26", width);
+        benchmarks.push_back({name, "words", [width]() {
+            const uint64_t n = 1 << 27;
+            Mask<char> mask = uniformMask<char>(width, 26, 'a');
+            std::vector<char> buffer(1 << 20), word(width + 1);
+            OutputBuffer<char> out = {buffer.data(), buffer.data(), buffer.data() + buffer.size()};
+            uint64_t check = 0;
+            auto flush = [&check](OutputBuffer<char> &o) {
+                check += o.m_p[-2];
+                o.m_p = o.m_begin;
+            };
+            generateWords(mask, 0, n, '\n', 1, word.data(), out, flush);
+            sink = check;
+            return Work{n, n * (width + 1)};
+        }});
+    }
+    {
+        benchmarks.push_back({"generate_words_utf8 w=8 cs=26", "words", []() {
+            const uint64_t n = 1 << 27;
+            Mask<uint32_t> mask = uniformMask<uint32_t>(8, 26, 0xE0);
+            std::vector<char> buffer(1 << 20);
+            std::vector<uint32_t> word(9);
+            OutputBuffer<char> out = {buffer.data(), buffer.data(), buffer.data() + buffer.size()};
+            uint64_t check = 0;
+            auto flush = [&check](OutputBuffer<char> &o) {
+                check += o.m_p[-2];
+                o.m_p = o.m_begin;
+            };
+            Utf8Encoder encoder;
+            generateWordsUtf8(mask, 0, n, '\n', 1, word.data(), out, flush, encoder);
+            sink = check;
+            // 2 bytes per character
+            return Work{n, n * (2 * 8 + 1)};
+        }});
+    }
+
+    // words pulled from the library
+    for (bool stride : {true, false}) {
+        benchmarks.push_back({stride ? "word_batcher<char> fixed-stride" : "word_batcher<char> offsets", "words", [stride]() {
+            CharsetMapAscii charsets;
+            initCharsets(charsets);
+            WordBatcher<char> batcher(readMaskList("?l?l?l?l?l?l", charsets));
+            std::vector<char> buffer(1 << 16);
+            std::vector<size_t> offsets(buffer.size() + 1);
+            Work w = {0, 0};
+            size_t n, width;
+            uint64_t check = 0;
+            while ((n = stride ? batcher.fillBatch(buffer.data(), buffer.size(), width)
+                               : batcher.fillBatch(buffer.data(), buffer.size(), offsets.data(), buffer.size())) != 0) {
+                w.m_items += n;
+                check += (unsigned char) buffer[0];
+            }
+            sink = check;
+            w.m_bytes = w.m_items * 6;
+            return w;
+        }});
+    }
+
+    // the whole program to a null sink
+    std::shared_ptr<TempFile> bf(new TempFile("5\n0 5 ?l\n0 2 ?d\n0 1 ?u\n"));
+    // many small masks, to measure the cost of switching masks
+    std::string masks_content;
+    for (unsigned int i = 0; i < 50; i++) {
+        masks_content += "?d?d?d?d\n?l?l?l?l\n?u?d?d?d?d\nabc,?1?1?1?d?d\n";
+    }
+    std::shared_ptr<TempFile> masks(new TempFile(masks_content));
+    std::shared_ptr<TempFile> masks_2b(new TempFile("àâçéèêëîïôûù,?1?1?1?1?1?1?1\n"));
+    struct Run {
+        const char *m_name;
+        std::vector<std::string> m_args;
+        bool m_unicode;
+        bool m_bruteforce;
+    };
+    std::vector<Run> runs = {
+        {"work<char> ?l^6", {"?l?l?l?l?l?l"}, false, false},
+        {"work<char> ?l^6 --simd", {"--simd", "?l?l?l?l?l?l"}, false, false},
+        {"work<char> ?l^6 -t 4", {"-t", "4", "?l?l?l?l?l?l"}, false, false},
+        {"work<char> masklist", {masks->path()}, false, false},
+        {"work<char> bruteforce", {"-B", bf->path()}, false, true},
+        {"work<uint32_t> ?l^6", {"-u", "?l?l?l?l?l?l"}, true, false},
+        {"work<uint32_t> 2-byte chars", {"-u", masks_2b->path()}, true, false},
+        {"work<uint32_t> bruteforce", {"-u", "-B", bf->path()}, true, true},
+    };
+    for (const Run &r : runs) {
+        benchmarks.push_back({r.m_name, "words", [r, bf, masks, masks_2b]() {
+            runMaskuni(r.m_args);
+            const std::string &spec = r.m_args.back();
+            return r.m_unicode ? outputSize<uint32_t>(spec, r.m_bruteforce, 1) : outputSize<char>(spec, r.m_bruteforce, 1);
+        }});
+    }
+
+    // parsing of a large mask file
+    std::shared_ptr<TempFile> big_masks(new TempFile(readMasksContent(400000)));
+    for (bool unicode : {false, true}) {
+        benchmarks.push_back({unicode ? "read_masks<uint32_t>" : "read_masks<char>", "masks", [unicode, big_masks]() {
+            Work w = {0, 0};
+            uint64_t size;
+            size_t width;
+            if (unicode) {
+                CharsetMap<uint32_t> charsets = defaultCharsets<uint32_t>();
+                std::unique_ptr<MaskGenerator<uint32_t>> gen(readMaskListUtf8(big_masks->path(), charsets));
+                while ((*gen)(size, width)) {
+                    w.m_items++;
+                }
+            }
+            else {
+                CharsetMap<char> charsets = defaultCharsets<char>();
+                std::unique_ptr<MaskGenerator<char>> gen(readMaskListAscii(big_masks->path(), charsets));
+                while ((*gen)(size, width)) {
+                    w.m_items++;
+                }
+            }
+            FILE *f = fopen(big_masks->path(), "r");
+            fseek(f, 0, SEEK_END);
+            w.m_bytes = ftell(f);
+            fclose(f);
+            return w;
+        }});
+    }
+
+    // enumeration of the bruteforce masks
+    std::shared_ptr<TempFile> big_bf(new TempFile("9\n0 9 ?l\n0 3 ?u\n0 3 ?d\n0 2 ?s\n0 2 abc\n"));
+    benchmarks.push_back({"bruteforce_masks<char>", "masks", [big_bf]() {
+        CharsetMap<char> charsets = defaultCharsets<char>();
+        std::unique_ptr<MaskGenerator<char>> gen(readBruteforceAscii(big_bf->path(), charsets));
+        Mask<char> mask;
+        Work w = {0, 0};
+        const uint64_t n = 1 << 22;
+        while (w.m_items < n && (*gen)(mask)) {
+            w.m_items++;
+            w.m_bytes += mask.getWidth();
+        }
+        return w;
+    }});
+    benchmarks.push_back({"bruteforce_seek<char>", "seeks", [big_bf]() {
+        CharsetMap<char> charsets = defaultCharsets<char>();
+        std::unique_ptr<MaskGenerator<char>> gen(readBruteforceAscii(big_bf->path(), charsets));
+        uint64_t len = 0;
+        size_t width = 0;
+        gen->countWords(len, width);
+        Work w = {0, 0};
+        const uint64_t n = 1 << 16;
+        uint64_t check = 0;
+        Mask<char> mask;
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t offset;
+            gen->seekWord(len / n * i, offset);
+            (*gen)(mask);
+            check += offset;
+        }
+        sink = check;
+        w.m_items = n;
+        return w;
+    }});
+
+    // UTF-8 conversions
+    std::shared_ptr<std::vector<uint32_t>> cps(new std::vector<uint32_t>(1 << 24));
+    for (size_t i = 0; i < cps->size(); i++) {
+        static const uint32_t samples[] = {'a', 'Z', '7', 0xE9, 0x3B1, 0x20AC, 0x4E2D, 0x1F600};
+        (*cps)[i] = samples[(i * 7 + i / 3) % 8];
+    }
+    std::shared_ptr<std::vector<char>> utf8(new std::vector<char>());
+    {
+        char *o = NULL;
+        size_t o_size = 0, consumed = 0, written = 0;
+        UTF::encode_utf8(cps->data(), cps->size(), &o, &o_size, &consumed, &written);
+        utf8->assign(o, o + written);
+        free(o);
+    }
+    benchmarks.push_back({"utf8_encode", "chars", [cps]() {
+        char *o = NULL;
+        size_t o_size = 0, consumed = 0, written = 0;
+        UTF::encode_utf8(cps->data(), cps->size(), &o, &o_size, &consumed, &written);
+        sink = (unsigned char) o[written - 1];
+        free(o);
+        return Work{cps->size(), written};
+    }});
+    benchmarks.push_back({"utf8_decode", "chars", [utf8]() {
+        uint32_t *o = NULL;
+        size_t o_size = 0, consumed = 0, written = 0;
+        UTF::decode_utf8(utf8->data(), utf8->size(), &o, &o_size, &consumed, &written);
+        sink = o[written - 1];
+        free(o);
+        return Work{written, utf8->size()};
+    }});
+
+    return benchmarks;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int repeats = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:h")) >= 0) {
+        switch (opt) {
+            case 'r':
+                if (sscanf(optarg, "%u", &repeats) != 1 || repeats == 0) {
+                    fprintf(stderr, "Error: wrong number of repeats (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                printf("Usage: maskuni_bench [-r REPEATS] [FILTER...]\n");
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    std::vector<std::string> filters(argv + optind, argv + argc);
+
+    std::vector<Benchmark> benchmarks = makeBenchmarks();
+    printf("%-40s %14s %12s %10s\n", "benchmark", "items/s", "MB/s", "time (s)");
+    for (const Benchmark &b : benchmarks) {
+        bool selected = filters.empty();
+        for (const auto &f : filters) {
+            selected |= b.m_name.find(f) != std::string::npos;
+        }
+        if (!selected) {
+            continue;
+        }
+        double best = 0;
+        Work work = {0, 0};
+        for (unsigned int r = 0; r < repeats; r++) {
+            double t = seconds();
+            Work w = b.m_run();
+            t = seconds() - t;
+            if (r == 0 || t < best) {
+                best = t;
+                work = w;
+            }
+        }
+        char rate[32];
+        snprintf(rate, sizeof(rate), "%.2f M%s", work.m_items / best / 1e6, b.m_unit);
+        printf("%-40s %14s %12.1f %10.3f\n", b.m_name.c_str(), rate, work.m_bytes / best / 1e6, best);
+        fflush(stdout);
+    }
+    return 0;
+}
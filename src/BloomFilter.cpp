@@ -0,0 +1,150 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include "BloomFilter.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef HAVE_GETLINE
+# include "getline.h"
+#endif
+
+namespace Maskuni {
+
+constexpr unsigned int BloomFilter::bitsPerWord;
+constexpr unsigned int BloomFilter::hashesCount;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+uint64_t BloomFilter::hash(const void *data, size_t len)
+{
+    // 8 bytes at a time, murmur3 style mixing
+    const unsigned char *p = (const unsigned char *) data;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    while (len >= 8) {
+        uint64_t k;
+        memcpy(&k, p, 8);
+        k *= 0x87c37b91114253d5ULL;
+        k = rotl64(k, 31);
+        k *= 0x4cf5ad432745937fULL;
+        h ^= k;
+        h = rotl64(h, 27) * 5 + 0x52dce729;
+        p += 8;
+        len -= 8;
+    }
+    uint64_t k = 0;
+    for (size_t i = 0; i < len; i++) {
+        k |= (uint64_t) p[i] << (8 * i);
+    }
+    k *= 0x87c37b91114253d5ULL;
+    k = rotl64(k, 31);
+    k *= 0x4cf5ad432745937fULL;
+    h ^= k;
+    return fmix64(h);
+}
+
+BloomFilter::BloomFilter(uint64_t n_words) : m_bits(), m_mask(0)
+{
+    uint64_t n_bits = 64;
+    while (n_bits / bitsPerWord < n_words && n_bits < (1ULL << 62)) {
+        n_bits <<= 1;
+    }
+    m_bits.resize(n_bits / 64);
+    m_mask = n_bits - 1;
+}
+
+void BloomFilter::add(const void *word, size_t len)
+{
+    const uint64_t h = hash(word, len);
+    const uint64_t h2 = rotl64(h, 32) | 1;
+    uint64_t g = h;
+    for (unsigned int i = 0; i < hashesCount; i++) {
+        const uint64_t bit = g & m_mask;
+        m_bits[bit >> 6] |= 1ULL << (bit & 63);
+        g += h2;
+    }
+}
+
+bool BloomFilter::contains(const void *word, size_t len) const
+{
+    const uint64_t h = hash(word, len);
+    const uint64_t h2 = rotl64(h, 32) | 1;
+    uint64_t g = h;
+    for (unsigned int i = 0; i < hashesCount; i++) {
+        const uint64_t bit = g & m_mask;
+        if (!(m_bits[bit >> 6] & (1ULL << (bit & 63)))) {
+            return false;
+        }
+        g += h2;
+    }
+    return true;
+}
+
+BloomFilter *BloomFilter::readWords(const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: can't open the words file '%s': %m\n", filename);
+        return NULL;
+    }
+    // count the words first to size the filter
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t r;
+    uint64_t n_words = 0;
+    while (getline(&line, &line_size, f) >= 0) {
+        n_words++;
+    }
+    BloomFilter *filter = new BloomFilter(n_words);
+    rewind(f);
+    while ((r = getline(&line, &line_size, f)) >= 0) {
+        if (r >= 1 && line[r - 1] == '\n') {
+            r--;
+        }
+        if (r >= 1 && line[r - 1] == '\r') {
+            r--;
+        }
+        filter->add(line, r);
+    }
+    const bool ok = !ferror(f);
+    free(line);
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Error while reading the words file '%s'\n", filename);
+        delete filter;
+        return NULL;
+    }
+    return filter;
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+namespace Maskuni {
+
+/**
+ * @brief Bloom filter of words
+ *
+ * The words are sequences of bytes. Each word sets \a hashesCount bits derived
+ * from a single 64 bits hash (double hashing). The size of the filter is a power of two.
+ */
+class BloomFilter
+{
+    std::vector<uint64_t> m_bits;   /*!< bits of the filter */
+    uint64_t m_mask;                /*!< number of bits - 1 */
+
+    static uint64_t hash(const void *data, size_t len);
+
+public:
+    static constexpr unsigned int bitsPerWord = 16;    /*!< about 0.05% of false positives */
+    static constexpr unsigned int hashesCount = 11;
+
+    /**
+     * @brief Create an empty filter
+     *
+     * @param n_words expected number of words
+     */
+    explicit BloomFilter(uint64_t n_words);
+
+    /**
+     * @brief Add a word
+     *
+     * @param word bytes of the word
+     * @param len number of bytes
+     */
+    void add(const void *word, size_t len);
+
+    /**
+     * @brief Test if a word may have been added
+     *
+     * @param word bytes of the word
+     * @param len number of bytes
+     * @return false if the word was never added, true if it was probably added
+     */
+    bool contains(const void *word, size_t len) const;
+
+    /**
+     * @brief Create a filter from a list of words
+     *
+     * @param filename file of words, one per line
+     * @return the filter or NULL if the file can't be read
+     */
+    static BloomFilter *readWords(const char *filename);
+};
+
+}
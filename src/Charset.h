@@ -65,6 +65,26 @@ public:
         std::copy_n(set, set_len, m_set.get());
     }
 
+    /**
+     * @brief Construct a new charset over an existing buffer
+     * 
+     * The characters are not copied, several charsets may share the same buffer
+     * (with aliasing shared_ptr pointing inside a larger buffer)
+     * 
+     * @param set characters
+     * @param set_len number of characters in \a set
+     */
+    Charset(const std::shared_ptr<T> &set, uint64_t set_len) :
+        m_set(set)
+        , m_set_end(set.get() + set_len)
+        , m_p(set.get())
+    {
+        if (set_len == 0) {
+            fprintf(stderr, "Error: trying to define an empty charset\n");
+            abort();
+        }
+    }
+
     Charset(const Charset &o) :
         m_set(o.m_set)
         , m_set_end(o.m_set_end)
@@ -105,6 +125,26 @@ public:
         m_p = m_set.get() + o;
     }
 
+    /**
+     * @brief Get the current position in the charset
+     * 
+     * @return position between 0 and getLen() - 1
+     */
+    inline __attribute__((always_inline)) uint64_t getPosition() const
+    {
+        return m_p - m_set.get();
+    }
+
+    /**
+     * @brief Get the characters of the charset
+     * 
+     * @return pointer to getLen() characters
+     */
+    inline __attribute__((always_inline)) const T *data() const
+    {
+        return m_set.get();
+    }
+
     /**
      * @brief Copy the character at the current position
      * 
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+
+#include "Charset.h"
+
+namespace Maskuni {
+
+/**
+ * @brief An intern pool of charsets keyed by their content
+ *
+ * The charsets returned for the same content share a single buffer, whichever mask
+ * they belong to. A lookup of an already known content doesn't allocate.
+ *
+ * The pool only holds a reference on the buffers: the charsets stay valid if the pool
+ * is cleared or destroyed. The pool is cleared when it reaches \a max_entries
+ * so that a long list of distinct inline charsets doesn't grow it forever.
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ */
+template<typename T>
+class CharsetPool
+{
+    /**
+     * @brief A content, either pointing into a pooled buffer or into the looked up characters
+     */
+    struct Key {
+        const T *m_set;     /*!< characters */
+        size_t m_len;       /*!< number of characters */
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const
+        {
+            // FNV-1a
+            uint64_t h = 14695981039346656037ULL;
+            for (size_t i = 0; i < k.m_len; i++) {
+                h ^= (uint64_t) k.m_set[i];
+                h *= 1099511628211ULL;
+            }
+            return (size_t) h;
+        }
+    };
+
+    struct KeyEqual {
+        bool operator()(const Key &a, const Key &b) const
+        {
+            return a.m_len == b.m_len && std::equal(a.m_set, a.m_set + a.m_len, b.m_set);
+        }
+    };
+
+    std::unordered_map<Key, Charset<T>, KeyHash, KeyEqual> m_pool; /*!< pooled charsets */
+    size_t m_max_entries;   /*!< the pool is cleared when reaching this size */
+
+public:
+    /**
+     * @brief Create an empty pool
+     *
+     * @param max_entries maximum number of pooled charsets
+     */
+    explicit CharsetPool(size_t max_entries = 4096) : m_pool(), m_max_entries(std::max<size_t>(1, max_entries)) {}
+
+    /**
+     * @brief Get a charset with the given content
+     *
+     * @param set characters, copied if the content is not in the pool yet
+     * @param set_len number of characters, must not be 0
+     * @return a charset at position 0 sharing the pooled buffer
+     */
+    Charset<T> get(const T *set, size_t set_len)
+    {
+        auto it = m_pool.find(Key{set, set_len});
+        if (it != m_pool.end()) {
+            return it->second;
+        }
+        if (m_pool.size() >= m_max_entries) {
+            m_pool.clear();
+        }
+        Charset<T> charset(set, set_len);
+        m_pool.emplace(Key{charset.data(), set_len}, charset);
+        return charset;
+    }
+
+    /**
+     * @brief Get the number of pooled charsets
+     *
+     * @return number of distinct contents in the pool
+     */
+    size_t size() const
+    {
+        return m_pool.size();
+    }
+};
+
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include "Checkpoint.h"
+#include "Stats.h"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Maskuni {
+
+static const char checkpoint_magic[] = "maskuni checkpoint 1";
+
+constexpr uint64_t Checkpoint::hashInit;
+
+Checkpoint::Checkpoint(const std::string &filename, unsigned int interval) :
+    m_filename(filename), m_interval(interval ? (uint64_t) interval * 1000000000ULL : UINT64_MAX), m_last(Stats::now())
+{
+}
+
+bool Checkpoint::isDue() const
+{
+    return Stats::now() - m_last >= m_interval;
+}
+
+/**
+ * @brief Write an optional value
+ *
+ * @param f file
+ * @param key name of the value
+ * @param value value, '-' is written for UINT64_MAX
+ */
+static void writeValue(FILE *f, const char *key, uint64_t value)
+{
+    if (value == UINT64_MAX) {
+        fprintf(f, "%s=-\n", key);
+    }
+    else {
+        fprintf(f, "%s=%" PRIu64 "\n", key, value);
+    }
+}
+
+bool Checkpoint::save(const CheckpointState &state)
+{
+    m_last = Stats::now();
+    std::string tmp = m_filename + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (f == NULL) {
+        fprintf(stderr, "Error: can't open the checkpoint file '%s': %m\n", tmp.c_str());
+        return false;
+    }
+    fprintf(f, "%s\n", checkpoint_magic);
+    fprintf(f, "hash=%016" PRIx64 "\n", state.m_hash);
+    writeValue(f, "next", state.m_next);
+    writeValue(f, "end", state.m_end);
+    writeValue(f, "mask", state.m_mask);
+    writeValue(f, "offset", state.m_offset);
+    writeValue(f, "bytes", state.m_bytes);
+    if (ferror(f) | (fflush(f) != 0) | (fsync(fileno(f)) != 0) | fclose(f)) {
+        fprintf(stderr, "Error: can't write the checkpoint file '%s'\n", tmp.c_str());
+        return false;
+    }
+    if (rename(tmp.c_str(), m_filename.c_str()) != 0) {
+        fprintf(stderr, "Error: can't replace the checkpoint file '%s': %m\n", m_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Checkpoint::load(const char *filename, CheckpointState &state, bool &exists)
+{
+    exists = true;
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        if (errno == ENOENT) {
+            exists = false;
+            return true;
+        }
+        fprintf(stderr, "Error: can't open the checkpoint file '%s': %m\n", filename);
+        return false;
+    }
+    // every value must be present once
+    uint64_t *values[] = {&state.m_next, &state.m_end, &state.m_mask, &state.m_offset, &state.m_bytes};
+    const char *keys[] = {"next", "end", "mask", "offset", "bytes"};
+    const unsigned int n_values = sizeof(keys) / sizeof(keys[0]);
+    unsigned int found = 0;
+    bool hash_found = false;
+    bool ok = true;
+    char line[128];
+    if (fgets(line, sizeof(line), f) == NULL || strncmp(line, checkpoint_magic, strlen(checkpoint_magic)) != 0) {
+        ok = false;
+    }
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        char *eq = strchr(line, '=');
+        if (eq == NULL) {
+            ok = false;
+            break;
+        }
+        *eq = 0;
+        const char *value = eq + 1;
+        if (strcmp(line, "hash") == 0) {
+            ok = sscanf(value, "%" SCNx64, &state.m_hash) == 1 && !hash_found;
+            hash_found = true;
+            continue;
+        }
+        unsigned int k = 0;
+        while (k < n_values && strcmp(line, keys[k]) != 0) {
+            k++;
+        }
+        if (k == n_values || (found & (1u << k))) {
+            ok = false;
+            break;
+        }
+        found |= 1u << k;
+        if (value[0] == '-') {
+            *values[k] = UINT64_MAX;
+        }
+        else {
+            ok = sscanf(value, "%" SCNu64, values[k]) == 1;
+        }
+    }
+    fclose(f);
+    if (!ok || !hash_found || found != (1u << n_values) - 1 || state.m_next == UINT64_MAX || state.m_bytes == UINT64_MAX
+        || (state.m_end != UINT64_MAX && state.m_next > state.m_end)) {
+        fprintf(stderr, "Error: '%s' is not a valid checkpoint file\n", filename);
+        return false;
+    }
+    return true;
+}
+
+void Checkpoint::hashBytes(uint64_t &hash, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+bool Checkpoint::hashFile(uint64_t &hash, const char *filename)
+{
+#if defined(__WINDOWS__) || defined(__CYGWIN__)
+    int fd = open(filename, O_RDONLY | O_BINARY);
+#else
+    int fd = open(filename, O_RDONLY);
+#endif
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    char buffer[1 << 16];
+    ssize_t r;
+    while ((r = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0) {
+            close(fd);
+            return false;
+        }
+        hashBytes(hash, buffer, r);
+    }
+    close(fd);
+    return true;
+}
+
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+
+namespace Maskuni {
+
+/**
+ * @brief Progress of a run saved into a checkpoint
+ *
+ * The unknown values are set to UINT64_MAX
+ */
+struct CheckpointState {
+    uint64_t m_hash;    /*!< hash of the inputs of the run */
+    uint64_t m_next;    /*!< global position of the next word to generate */
+    uint64_t m_end;     /*!< global position after the last word, unknown when sizing while generating */
+    uint64_t m_mask;    /*!< index of the mask holding the next word, only known when sizing while generating */
+    uint64_t m_offset;  /*!< position of the next word in its mask */
+    uint64_t m_bytes;   /*!< number of bytes written before the next word */
+};
+
+/**
+ * @brief Periodic checkpoints of a run
+ *
+ * The checkpoint is a small text file, replaced atomically (written aside then renamed)
+ * so that a run killed while saving leaves the previous checkpoint.
+ */
+class Checkpoint
+{
+    std::string m_filename;     /*!< checkpoint file */
+    uint64_t m_interval;        /*!< nanoseconds between two checkpoints */
+    uint64_t m_last;            /*!< time of the last checkpoint */
+
+public:
+    /**
+     * @brief Create the checkpoints of a run
+     *
+     * @param filename checkpoint file
+     * @param interval seconds between two checkpoints, 0 to only save the end of the run
+     */
+    Checkpoint(const std::string &filename, unsigned int interval);
+
+    /**
+     * @brief Test if a checkpoint should be saved
+     *
+     * @return true if the interval has elapsed since the last checkpoint
+     */
+    bool isDue() const;
+
+    /**
+     * @brief Save a checkpoint and restart the interval
+     *
+     * @param state progress, the output must be flushed up to state.m_bytes
+     * @return false if the file could not be written
+     */
+    bool save(const CheckpointState &state);
+
+    /**
+     * @brief Read a checkpoint
+     *
+     * @param filename checkpoint file
+     * @param state set to the saved progress
+     * @param exists set to false if the file doesn't exist
+     * @return false if the file exists but can't be read or is not a checkpoint
+     */
+    static bool load(const char *filename, CheckpointState &state, bool &exists);
+
+    /**
+     * @brief Add some data to a hash (FNV-1a)
+     *
+     * @param hash hash to update, start with \a hashInit
+     * @param data data
+     * @param len number of bytes
+     */
+    static void hashBytes(uint64_t &hash, const void *data, size_t len);
+
+    /**
+     * @brief Add the content of a file to a hash
+     *
+     * @param hash hash to update
+     * @param filename file
+     * @return false if \a filename is not a regular file or can't be read
+     */
+    static bool hashFile(uint64_t &hash, const char *filename);
+
+    static constexpr uint64_t hashInit = 14695981039346656037ULL;
+};
+
+}
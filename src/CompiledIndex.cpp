@@ -0,0 +1,446 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include "CompiledIndex.h"
+#include "overflow.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+
+#include <map>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if !defined(__WINDOWS__)
+# include <sys/mman.h>
+#endif
+
+namespace Maskuni {
+
+static const char compiled_index_magic[8] = {'M', 'S', 'K', 'U', 'N', 'I', 'D', 'X'};
+static const uint32_t compiled_index_version = 1;
+static const uint32_t compiled_index_byte_order = 0x01020304;
+
+/*
+ * Header of a compiled index
+ * The positions are byte offsets from the beginning of the file, aligned on 8 bytes
+ */
+struct CompiledIndexHeader {
+    char m_magic[8];            /*!< compiled_index_magic */
+    uint32_t m_version;         /*!< compiled_index_version */
+    uint32_t m_byte_order;      /*!< compiled_index_byte_order as written by the host */
+    uint64_t m_char_size;       /*!< sizeof(T) */
+    uint64_t m_n_masks;         /*!< number of masks */
+    uint64_t m_total;           /*!< total number of words */
+    uint64_t m_max_width;       /*!< maximum width of the masks */
+    uint64_t m_offsets_pos;     /*!< uint64_t[m_n_masks], number of words before each mask */
+    uint64_t m_masks_pos;       /*!< CompiledIndexMask[m_n_masks] */
+    uint64_t m_refs_pos;        /*!< uint32_t[m_n_refs], charsets of the masks */
+    uint64_t m_n_refs;
+    uint64_t m_charsets_pos;    /*!< CompiledIndexCharset[m_n_charsets] */
+    uint64_t m_n_charsets;
+    uint64_t m_data_pos;        /*!< T[m_n_data], characters of the charsets */
+    uint64_t m_n_data;
+    uint64_t m_file_size;       /*!< size of the whole file */
+};
+
+struct CompiledIndexMask {
+    uint64_t m_width;           /*!< number of charsets */
+    uint64_t m_refs;            /*!< index of the first charset in the refs */
+};
+
+struct CompiledIndexCharset {
+    uint64_t m_data;            /*!< index of the first character in the data */
+    uint64_t m_len;             /*!< number of characters */
+};
+
+static uint64_t align8(uint64_t v)
+{
+    return (v + 7) & ~((uint64_t) 7);
+}
+
+static bool writeAll(int fd, const void *data, size_t len)
+{
+    const char *p = (const char *) data;
+    while (len) {
+        ssize_t r = write(fd, p, len);
+        if (r <= 0) {
+            return false;
+        }
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+static bool writePadding(int fd, uint64_t len)
+{
+    static const char zeros[8] = {0};
+    return writeAll(fd, zeros, align8(len) - len);
+}
+
+template<typename T>
+bool writeCompiledIndex(const char *filename, MaskGenerator<T> &gen)
+{
+    std::map<std::vector<T>, uint32_t> charsets_ids;
+    std::vector<CompiledIndexCharset> charsets;
+    std::vector<T> data;
+    std::vector<uint64_t> offsets;
+    std::vector<CompiledIndexMask> masks;
+    std::vector<uint32_t> refs;
+    uint64_t total = 0;
+    uint64_t max_width = 0;
+
+    gen.reset();
+    Mask<T> mask;
+    while (gen(mask)) {
+        // the empty masks come from the comments
+        if (mask.getWidth() == 0) {
+            continue;
+        }
+        masks.push_back({mask.getWidth(), refs.size()});
+        offsets.push_back(total);
+        for (size_t i = 0; i < mask.getWidth(); i++) {
+            const Charset<T> &charset = mask.getCharset(i);
+            std::vector<T> content(charset.data(), charset.data() + charset.getLen());
+            auto it = charsets_ids.find(content);
+            if (it == charsets_ids.end()) {
+                it = charsets_ids.insert(std::make_pair(content, (uint32_t) charsets.size())).first;
+                charsets.push_back({data.size(), content.size()});
+                data.insert(data.end(), content.begin(), content.end());
+            }
+            refs.push_back(it->second);
+        }
+        if (uadd64_overflow(total, mask.getLen(), &total)) {
+            fprintf(stderr, "Error: the total number of words would overflow a 64 bits integer\n");
+            return false;
+        }
+        max_width = std::max<uint64_t>(max_width, mask.getWidth());
+    }
+    if (!gen.good()) {
+        return false;
+    }
+
+    CompiledIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_magic, compiled_index_magic, sizeof(header.m_magic));
+    header.m_version = compiled_index_version;
+    header.m_byte_order = compiled_index_byte_order;
+    header.m_char_size = sizeof(T);
+    header.m_n_masks = masks.size();
+    header.m_total = total;
+    header.m_max_width = max_width;
+    header.m_offsets_pos = align8(sizeof(header));
+    header.m_masks_pos = align8(header.m_offsets_pos + offsets.size() * sizeof(uint64_t));
+    header.m_refs_pos = align8(header.m_masks_pos + masks.size() * sizeof(CompiledIndexMask));
+    header.m_n_refs = refs.size();
+    header.m_charsets_pos = align8(header.m_refs_pos + refs.size() * sizeof(uint32_t));
+    header.m_n_charsets = charsets.size();
+    header.m_data_pos = align8(header.m_charsets_pos + charsets.size() * sizeof(CompiledIndexCharset));
+    header.m_n_data = data.size();
+    header.m_file_size = align8(header.m_data_pos + data.size() * sizeof(T));
+
+#if defined(__WINDOWS__) || defined(__CYGWIN__)
+    int fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT | O_BINARY, S_IRUSR|S_IWUSR);
+#else
+    int fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR|S_IWUSR);
+#endif
+    if (fd < 0) {
+        fprintf(stderr, "Error: can't open the index file '%s': %m\n", filename);
+        return false;
+    }
+    bool ok = writeAll(fd, &header, sizeof(header)) && writePadding(fd, sizeof(header))
+        && writeAll(fd, offsets.data(), offsets.size() * sizeof(uint64_t))
+        && writeAll(fd, masks.data(), masks.size() * sizeof(CompiledIndexMask))
+        && writeAll(fd, refs.data(), refs.size() * sizeof(uint32_t)) && writePadding(fd, refs.size() * sizeof(uint32_t))
+        && writeAll(fd, charsets.data(), charsets.size() * sizeof(CompiledIndexCharset))
+        && writeAll(fd, data.data(), data.size() * sizeof(T)) && writePadding(fd, data.size() * sizeof(T));
+    if (close(fd) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error while writing the index file '%s': %m\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief A generator over the masks of a mapped compiled index
+ *
+ * The index was validated when loaded except for the length of the masks which is
+ * checked when each mask is generated.
+ */
+template<typename T>
+class CompiledIndexGenerator: public MaskGenerator<T>
+{
+    void *m_content;                        /*!< content of the file, owned */
+    size_t m_content_len;                   /*!< size of the file */
+    bool m_mapped;                          /*!< true if m_content must be unmapped, false if it was malloced */
+    const CompiledIndexHeader *m_header;    /*!< header */
+    const uint64_t *m_offsets;              /*!< number of words before each mask */
+    const CompiledIndexMask *m_masks;       /*!< masks */
+    const uint32_t *m_refs;                 /*!< charsets of the masks */
+    std::vector<Charset<T>> m_charsets;     /*!< the charsets */
+    uint64_t m_next;                        /*!< index of the next mask */
+    bool m_error;                           /*!< error flag */
+
+    uint64_t maskLen(uint64_t i) const
+    {
+        return (i + 1 < m_header->m_n_masks ? m_offsets[i + 1] : m_header->m_total) - m_offsets[i];
+    }
+
+public:
+    CompiledIndexGenerator(void *content, size_t content_len, bool mapped) :
+        m_content(content), m_content_len(content_len), m_mapped(mapped),
+        m_header((const CompiledIndexHeader *) content),
+        m_offsets((const uint64_t *) ((const char *) content + m_header->m_offsets_pos)),
+        m_masks((const CompiledIndexMask *) ((const char *) content + m_header->m_masks_pos)),
+        m_refs((const uint32_t *) ((const char *) content + m_header->m_refs_pos)),
+        m_charsets(), m_next(0), m_error(false)
+    {
+        const CompiledIndexCharset *charsets = (const CompiledIndexCharset *) ((const char *) content + m_header->m_charsets_pos);
+        const T *data = (const T *) ((const char *) content + m_header->m_data_pos);
+        m_charsets.reserve(m_header->m_n_charsets);
+        for (uint64_t i = 0; i < m_header->m_n_charsets; i++) {
+            m_charsets.emplace_back(data + charsets[i].m_data, charsets[i].m_len);
+        }
+    }
+
+    ~CompiledIndexGenerator()
+    {
+#if !defined(__WINDOWS__)
+        if (m_mapped) {
+            munmap(m_content, m_content_len);
+            return;
+        }
+#endif
+        free(m_content);
+    }
+
+    const uint64_t *getOffsets() const
+    {
+        return m_offsets;
+    }
+
+    bool operator()(Mask<T> &mask)
+    {
+        if (m_next >= m_header->m_n_masks) {
+            return false;
+        }
+        const CompiledIndexMask &m = m_masks[m_next];
+        mask.clear();
+        for (uint64_t i = 0; i < m.m_width; i++) {
+            mask.push_charset_right(m_charsets[m_refs[m.m_refs + i]]);
+        }
+        if (mask.getLen() != maskLen(m_next)) {
+            fprintf(stderr, "Error: the index is corrupted at the mask %" PRIu64 "\n", m_next);
+            m_error = true;
+            return false;
+        }
+        m_next++;
+        return true;
+    }
+
+    bool operator()(uint64_t &size, size_t &width)
+    {
+        if (m_next >= m_header->m_n_masks) {
+            return false;
+        }
+        size = maskLen(m_next);
+        width = m_masks[m_next].m_width;
+        m_next++;
+        return true;
+    }
+
+    void reset()
+    {
+        m_next = 0;
+        m_error = false;
+    }
+
+    bool seek(uint64_t mask_idx)
+    {
+        m_next = mask_idx;
+        m_error = false;
+        return mask_idx <= m_header->m_n_masks;
+    }
+
+    bool good()
+    {
+        return !m_error;
+    }
+};
+
+/* check that an array of n elements of size s at the position pos fits in a file of size len */
+static bool checkSection(uint64_t pos, uint64_t n, uint64_t s, uint64_t len)
+{
+    uint64_t size, end;
+    if (pos % 8 != 0 || umul64_overflow(n, s, &size) || uadd64_overflow(pos, size, &end)) {
+        return false;
+    }
+    return end <= len;
+}
+
+template<typename T>
+static bool validateCompiledIndex(const char *filename, const void *content, size_t content_len)
+{
+    const CompiledIndexHeader *h = (const CompiledIndexHeader *) content;
+    if (content_len < sizeof(CompiledIndexHeader) || memcmp(h->m_magic, compiled_index_magic, sizeof(h->m_magic)) != 0) {
+        fprintf(stderr, "Error: '%s' is not a compiled index\n", filename);
+        return false;
+    }
+    if (h->m_version != compiled_index_version || h->m_byte_order != compiled_index_byte_order) {
+        fprintf(stderr, "Error: the index '%s' was compiled by another version or for another platform\n", filename);
+        return false;
+    }
+    if (h->m_char_size != sizeof(T)) {
+        if (h->m_char_size == sizeof(uint32_t)) {
+            fprintf(stderr, "Error: the index '%s' was compiled with --unicode\n", filename);
+        }
+        else {
+            fprintf(stderr, "Error: the index '%s' was compiled without --unicode\n", filename);
+        }
+        return false;
+    }
+    if (h->m_file_size != content_len
+        || !checkSection(h->m_offsets_pos, h->m_n_masks, sizeof(uint64_t), content_len)
+        || !checkSection(h->m_masks_pos, h->m_n_masks, sizeof(CompiledIndexMask), content_len)
+        || !checkSection(h->m_refs_pos, h->m_n_refs, sizeof(uint32_t), content_len)
+        || !checkSection(h->m_charsets_pos, h->m_n_charsets, sizeof(CompiledIndexCharset), content_len)
+        || !checkSection(h->m_data_pos, h->m_n_data, sizeof(T), content_len)) {
+        fprintf(stderr, "Error: the index '%s' is corrupted\n", filename);
+        return false;
+    }
+
+    // the charsets and the masks are small compared to the words, check them all
+    const CompiledIndexCharset *charsets = (const CompiledIndexCharset *) ((const char *) content + h->m_charsets_pos);
+    for (uint64_t i = 0; i < h->m_n_charsets; i++) {
+        if (charsets[i].m_len == 0 || charsets[i].m_data > h->m_n_data || charsets[i].m_len > h->m_n_data - charsets[i].m_data) {
+            fprintf(stderr, "Error: the index '%s' is corrupted (charset %" PRIu64 ")\n", filename, i);
+            return false;
+        }
+    }
+    const uint64_t *offsets = (const uint64_t *) ((const char *) content + h->m_offsets_pos);
+    const CompiledIndexMask *masks = (const CompiledIndexMask *) ((const char *) content + h->m_masks_pos);
+    const uint32_t *refs = (const uint32_t *) ((const char *) content + h->m_refs_pos);
+    for (uint64_t i = 0; i < h->m_n_masks; i++) {
+        uint64_t next_offset = i + 1 < h->m_n_masks ? offsets[i + 1] : h->m_total;
+        if (masks[i].m_width == 0 || masks[i].m_width > h->m_max_width || offsets[i] >= next_offset
+            || masks[i].m_refs > h->m_n_refs || masks[i].m_width > h->m_n_refs - masks[i].m_refs) {
+            fprintf(stderr, "Error: the index '%s' is corrupted (mask %" PRIu64 ")\n", filename, i);
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < h->m_n_refs; i++) {
+        if (refs[i] >= h->m_n_charsets) {
+            fprintf(stderr, "Error: the index '%s' is corrupted (charset reference %" PRIu64 ")\n", filename, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename T>
+MaskGenerator<T> *readCompiledIndex(const char *filename, MaskIndex &index, size_t &max_width)
+{
+#if defined(__WINDOWS__) || defined(__CYGWIN__)
+    int fd = open(filename, O_RDONLY | O_BINARY);
+#else
+    int fd = open(filename, O_RDONLY);
+#endif
+    if (fd < 0) {
+        fprintf(stderr, "Error: can't open the index file '%s': %m\n", filename);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        fprintf(stderr, "Error: '%s' is not a compiled index\n", filename);
+        close(fd);
+        return NULL;
+    }
+    size_t content_len = st.st_size;
+    void *content = NULL;
+    bool mapped = false;
+
+#if !defined(__WINDOWS__)
+    content = mmap(NULL, content_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (content == MAP_FAILED) {
+        content = NULL;
+    }
+    else {
+        mapped = true;
+    }
+#endif
+    if (content == NULL) {
+        // no mmap, read the whole file into an aligned buffer
+        content = malloc(content_len);
+        ssize_t r = read(fd, content, content_len);
+        if (r < 0 || (size_t) r != content_len) {
+            fprintf(stderr, "Error while reading '%s'\n", filename);
+            free(content);
+            close(fd);
+            return NULL;
+        }
+    }
+    close(fd);
+
+    if (!validateCompiledIndex<T>(filename, content, content_len)) {
+#if !defined(__WINDOWS__)
+        if (mapped) {
+            munmap(content, content_len);
+            return NULL;
+        }
+#endif
+        free(content);
+        return NULL;
+    }
+
+    const CompiledIndexHeader *header = (const CompiledIndexHeader *) content;
+    CompiledIndexGenerator<T> *gen = new CompiledIndexGenerator<T>(content, content_len, mapped);
+    index = MaskIndex::wrap(gen->getOffsets(), header->m_n_masks, header->m_total);
+    max_width = header->m_max_width;
+    return gen;
+}
+
+bool writeCompiledIndexAscii(const char *filename, MaskGenerator<char> &gen)
+{
+    return writeCompiledIndex<char>(filename, gen);
+}
+
+bool writeCompiledIndexUtf8(const char *filename, MaskGenerator<uint32_t> &gen)
+{
+    return writeCompiledIndex<uint32_t>(filename, gen);
+}
+
+MaskGenerator<char> *readCompiledIndexAscii(const char *filename, MaskIndex &index, size_t &max_width)
+{
+    return readCompiledIndex<char>(filename, index, max_width);
+}
+
+MaskGenerator<uint32_t> *readCompiledIndexUtf8(const char *filename, MaskIndex &index, size_t &max_width)
+{
+    return readCompiledIndex<uint32_t>(filename, index, max_width);
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "MaskGenerator.h"
+#include "MaskIndex.h"
+
+namespace Maskuni {
+
+/*
+ * A compiled index is a binary file holding the already parsed masks of a generator:
+ * - a header (see CompiledIndexHeader in CompiledIndex.cpp)
+ * - the number of words before each mask
+ * - for each mask, its width and the offset of its list of charsets
+ * - the lists of charsets of the masks, as indexes in the table of charsets
+ * - the table of the deduplicated and expanded charsets
+ *
+ * The file is written with the byte order and the character type of the host
+ * so that it can be mapped and used as is.
+ */
+
+/**
+ * @brief Write the masks of an 8-bit generator into a compiled index
+ *
+ * The generator is reset and fully iterated. The empty masks are dropped.
+ *
+ * @param filename output file
+ * @param gen a generator already validated by a sizing pass
+ * @return false on error (a message is printed)
+ */
+bool writeCompiledIndexAscii(const char *filename, MaskGenerator<char> &gen);
+/**
+ * @brief Write the masks of an unicode generator into a compiled index
+ *
+ * The generator is reset and fully iterated. The empty masks are dropped.
+ *
+ * @param filename output file
+ * @param gen a generator already validated by a sizing pass
+ * @return false on error (a message is printed)
+ */
+bool writeCompiledIndexUtf8(const char *filename, MaskGenerator<uint32_t> &gen);
+
+/**
+ * @brief Map a compiled index of 8-bit masks and return a MaskGenerator for the masks
+ *
+ * @param filename compiled index
+ * @param index set to an index of every mask, valid as long as the generator lives
+ * @param max_width set to the maximum width of the masks
+ * @return new MaskGenerator or NULL (a message is printed)
+ */
+MaskGenerator<char> *readCompiledIndexAscii(const char *filename, MaskIndex &index, size_t &max_width);
+/**
+ * @brief Map a compiled index of unicode masks and return a MaskGenerator for the masks
+ *
+ * @param filename compiled index
+ * @param index set to an index of every mask, valid as long as the generator lives
+ * @param max_width set to the maximum width of the masks
+ * @return new MaskGenerator or NULL (a message is printed)
+ */
+MaskGenerator<uint32_t> *readCompiledIndexUtf8(const char *filename, MaskIndex &index, size_t &max_width);
+
+}
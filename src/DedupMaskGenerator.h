@@ -0,0 +1,352 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Mask.h"
+#include "MaskGenerator.h"
+#include "overflow.h"
+
+namespace Maskuni {
+
+/**
+ * @brief Remove the words already generated by the previous masks of a generator
+ *
+ * A mask is a box: the cartesian product of its charsets. The words of a mask which
+ * are also in a previous mask of the same width are removed by subtracting the previous
+ * box symbolically: A \ B is cut into at most width disjoint boxes, where the box k
+ * keeps A ∩ B on the positions before k, A \ B on the position k and A after k.
+ * The remaining boxes of each mask are generated as masks, in the order of the
+ * characters of the original charsets. The characters repeated in a charset are removed too.
+ *
+ * Only the charsets of the previous masks are kept, the memory doesn't depend on the number of words.
+ * The previous masks of each width are indexed by a trie of their distinct charsets, position
+ * by position, so that finding the previous masks overlapping a mask only visits the branches
+ * whose charsets intersect it. The cost grows with the number of overlapping masks, not with
+ * the size of the list.
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ */
+template<typename T>
+class DedupMaskGenerator : public MaskGenerator<T>
+{
+    typedef std::vector<std::vector<T>> Box; /*!< characters of each position */
+
+    /**
+     * @brief Node of the trie of the previous masks
+     */
+    struct Node {
+        std::map<uint32_t, uint32_t> m_children;    /*!< charset id at the next position -> node */
+        std::vector<uint64_t> m_masks;              /*!< previous masks ending here, for the last position */
+    };
+
+    /**
+     * @brief Previous masks of a given width
+     */
+    struct Index {
+        std::vector<std::map<std::vector<T>, uint32_t>> m_ids;      /*!< id of the sorted charsets, by position */
+        std::vector<std::vector<std::vector<T>>> m_sets;            /*!< sorted charsets of each id, by position */
+        std::vector<std::vector<uint32_t>> m_masks;                 /*!< charset ids of each previous mask */
+        std::vector<Node> m_nodes;                                  /*!< trie of the masks, the root first */
+    };
+
+    std::unique_ptr<MaskGenerator<T>> m_gen;    /*!< generator of the original masks */
+    std::vector<Index> m_seen;                  /*!< previous masks, by width */
+    std::vector<Box> m_boxes;                   /*!< remaining boxes of the current mask */
+    std::vector<Box> m_next_boxes;              /*!< boxes remaining after a subtraction */
+    size_t m_next_box;                          /*!< next box to generate in m_boxes */
+    Mask<T> m_mask;                             /*!< current original mask */
+    bool m_good;                                /*!< false after an error */
+
+    /**
+     * @brief Test if a character belongs to a sorted charset
+     */
+    static bool contains(const std::vector<T> &sorted, T c)
+    {
+        return std::binary_search(sorted.begin(), sorted.end(), c);
+    }
+
+    /**
+     * @brief Test if two sorted charsets share a character
+     */
+    static bool intersects(const std::vector<T> &a, const std::vector<T> &b)
+    {
+        auto i = a.begin(), j = b.begin();
+        while (i != a.end() && j != b.end()) {
+            if (*i < *j) {
+                ++i;
+            }
+            else if (*j < *i) {
+                ++j;
+            }
+            else {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Subtract a previous mask from a box
+     *
+     * @param a box
+     * @param b sorted charsets of the previous mask
+     * @param out receives the disjoint boxes of a \ b
+     */
+    static void subtract(Box &a, const std::vector<const std::vector<T> *> &b, std::vector<Box> &out)
+    {
+        const size_t width = a.size();
+        for (size_t k = 0; k < width; k++) {
+            if (std::none_of(a[k].begin(), a[k].end(), [&](T c) { return contains(*b[k], c); })) {
+                // disjoint
+                out.push_back(std::move(a));
+                return;
+            }
+        }
+        for (size_t k = 0; k < width; k++) {
+            std::vector<T> inter, diff;
+            for (T c : a[k]) {
+                (contains(*b[k], c) ? inter : diff).push_back(c);
+            }
+            if (!diff.empty()) {
+                out.emplace_back();
+                Box &box = out.back();
+                box.reserve(width);
+                box.insert(box.end(), a.begin(), a.begin() + k);
+                box.push_back(std::move(diff));
+                box.insert(box.end(), a.begin() + k + 1, a.end());
+            }
+            a[k] = std::move(inter);
+        }
+    }
+
+    /**
+     * @brief Find the previous masks overlapping a mask
+     *
+     * @param index previous masks of the width of the mask
+     * @param sorted sorted charsets of the mask
+     * @param overlapping receives the indexes of the overlapping masks, in the order of the input
+     */
+    static void findOverlapping(const Index &index, const Box &sorted, std::vector<uint64_t> &overlapping)
+    {
+        const size_t width = sorted.size();
+        overlapping.clear();
+        if (index.m_nodes.empty()) {
+            return;
+        }
+        // charsets of the previous masks intersecting the mask, by position
+        std::vector<std::vector<bool>> hits(width);
+        for (size_t i = 0; i < width; i++) {
+            hits[i].resize(index.m_sets[i].size());
+            for (size_t id = 0; id < hits[i].size(); id++) {
+                hits[i][id] = intersects(sorted[i], index.m_sets[i][id]);
+            }
+        }
+        std::vector<std::pair<uint32_t, size_t>> stack(1, std::make_pair(0u, size_t(0)));
+        while (!stack.empty()) {
+            const uint32_t node = stack.back().first;
+            const size_t pos = stack.back().second;
+            stack.pop_back();
+            if (pos == width) {
+                const std::vector<uint64_t> &masks = index.m_nodes[node].m_masks;
+                overlapping.insert(overlapping.end(), masks.begin(), masks.end());
+                continue;
+            }
+            for (const auto &child : index.m_nodes[node].m_children) {
+                if (hits[pos][child.first]) {
+                    stack.push_back(std::make_pair(child.second, pos + 1));
+                }
+            }
+        }
+        std::sort(overlapping.begin(), overlapping.end());
+    }
+
+    /**
+     * @brief Add a mask to the previous masks
+     *
+     * @param index previous masks of the width of the mask
+     * @param sorted sorted charsets of the mask
+     */
+    static void insert(Index &index, Box &sorted)
+    {
+        const size_t width = sorted.size();
+        if (index.m_nodes.empty()) {
+            index.m_ids.resize(width);
+            index.m_sets.resize(width);
+            index.m_nodes.emplace_back();
+        }
+        std::vector<uint32_t> ids(width);
+        uint32_t node = 0;
+        for (size_t i = 0; i < width; i++) {
+            auto it = index.m_ids[i].find(sorted[i]);
+            if (it == index.m_ids[i].end()) {
+                it = index.m_ids[i].insert(std::make_pair(sorted[i], (uint32_t) index.m_sets[i].size())).first;
+                index.m_sets[i].push_back(std::move(sorted[i]));
+            }
+            ids[i] = it->second;
+            auto child = index.m_nodes[node].m_children.find(ids[i]);
+            if (child == index.m_nodes[node].m_children.end()) {
+                const uint32_t n = index.m_nodes.size();
+                index.m_nodes[node].m_children[ids[i]] = n;
+                index.m_nodes.emplace_back();
+                node = n;
+            }
+            else {
+                node = child->second;
+            }
+        }
+        index.m_nodes[node].m_masks.push_back(index.m_masks.size());
+        index.m_masks.push_back(std::move(ids));
+    }
+
+    /**
+     * @brief Cut the current original mask into the boxes not generated yet
+     *
+     * @return false if the mask leaves too many boxes
+     */
+    bool split()
+    {
+        const size_t width = m_mask.getWidth();
+        Box box(width), sorted(width);
+        for (size_t i = 0; i < width; i++) {
+            const Charset<T> &charset = m_mask.getCharset(i);
+            for (const T *c = charset.data(); c != charset.data() + charset.getLen(); c++) {
+                if (std::find(box[i].begin(), box[i].end(), *c) == box[i].end()) {
+                    box[i].push_back(*c);
+                }
+            }
+            sorted[i] = box[i];
+            std::sort(sorted[i].begin(), sorted[i].end());
+        }
+        m_boxes.clear();
+        m_boxes.push_back(std::move(box));
+        m_next_box = 0;
+        if (m_seen.size() <= width) {
+            m_seen.resize(width + 1);
+        }
+        Index &index = m_seen[width];
+        std::vector<uint64_t> overlapping;
+        findOverlapping(index, sorted, overlapping);
+        std::vector<const std::vector<T> *> previous(width);
+        for (uint64_t idx : overlapping) {
+            for (size_t i = 0; i < width; i++) {
+                previous[i] = &index.m_sets[i][index.m_masks[idx][i]];
+            }
+            m_next_boxes.clear();
+            for (Box &b : m_boxes) {
+                subtract(b, previous, m_next_boxes);
+            }
+            std::swap(m_boxes, m_next_boxes);
+            if (m_boxes.empty()) {
+                break;
+            }
+            if (m_boxes.size() > maxBoxes) {
+                fprintf(stderr, "Error: a mask overlaps the previous masks in more than %zu parts\n", maxBoxes);
+                return false;
+            }
+        }
+        insert(index, sorted);
+        return true;
+    }
+
+    /**
+     * @brief Move to the next remaining box
+     *
+     * @return NULL when there is no more mask or if there was an error
+     */
+    const Box *nextBox()
+    {
+        while (m_next_box == m_boxes.size()) {
+            if (!m_good || !(*m_gen)(m_mask)) {
+                return NULL;
+            }
+            if (!split()) {
+                m_good = false;
+                return NULL;
+            }
+        }
+        return &m_boxes[m_next_box++];
+    }
+
+public:
+    static constexpr size_t maxBoxes = 1 << 16; /*!< maximum number of parts of a single mask */
+
+    /**
+     * @brief Remove the duplicated words of a generator
+     *
+     * @param gen generator of the original masks, owned by the new generator
+     */
+    explicit DedupMaskGenerator(MaskGenerator<T> *gen) :
+        m_gen(gen), m_seen(), m_boxes(), m_next_boxes(), m_next_box(0), m_mask(), m_good(true)
+    {
+    }
+
+    bool operator()(Mask<T> &mask) override {
+        const Box *box = nextBox();
+        if (box == NULL) {
+            return false;
+        }
+        mask.clear();
+        for (const auto &set : *box) {
+            mask.push_charset_right(set.data(), set.size());
+        }
+        return true;
+    }
+
+    bool operator()(uint64_t &size, size_t &width) override {
+        const Box *box = nextBox();
+        if (box == NULL) {
+            return false;
+        }
+        size = 1;
+        for (const auto &set : *box) {
+            if (umul64_overflow(size, set.size(), &size)) {
+                fprintf(stderr, "Error: the length of the mask would overflow a 64 bits integer\n");
+                m_good = false;
+                return false;
+            }
+        }
+        width = box->size();
+        return true;
+    }
+
+    void reset() override {
+        m_gen->reset();
+        m_seen.clear();
+        m_boxes.clear();
+        m_next_box = 0;
+        m_good = true;
+    }
+
+    bool canReset() override {
+        return m_gen->canReset();
+    }
+
+    bool good() override {
+        return m_good && m_gen->good();
+    }
+};
+
+}
@@ -18,97 +18,125 @@
 
 #include "ReadCharsets.h"
 
-#include <list>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_set>
 
 namespace Maskuni {
 
+/**
+ * @brief Remove the duplicated characters of an 8-bit charset, keeping the first occurrences
+ */
+static inline void removeDuplicates(std::vector<char> &cset)
+{
+    uint64_t seen[4];
+    memset(seen, 0, sizeof(seen));
+    size_t n = 0;
+    for (char c : cset) {
+        const unsigned char u = (unsigned char) c;
+        if (!(seen[u >> 6] & (UINT64_C(1) << (u & 63)))) {
+            seen[u >> 6] |= UINT64_C(1) << (u & 63);
+            cset[n++] = c;
+        }
+    }
+    cset.resize(n);
+}
+
+/**
+ * @brief Remove the duplicated codepoints of an unicode charset, keeping the first occurrences
+ */
+static inline void removeDuplicates(std::vector<uint32_t> &cset)
+{
+    std::unordered_set<uint32_t> seen(cset.size());
+    size_t n = 0;
+    for (uint32_t c : cset) {
+        if (seen.insert(c).second) {
+            cset[n++] = c;
+        }
+    }
+    cset.resize(n);
+}
+
+/**
+ * @brief Append the expansion of a charset definition to \a out
+ *
+ * A reference to a charset already expanded \a n times in \a keys_history is replaced by its
+ * \a n th previous definition. The definitions which are not final are expanded recursively.
+ *
+ * @param charsets charset map
+ * @param def charset definition
+ * @param len length of \a def
+ * @param keys_history names of the charsets being expanded, from the outermost one
+ * @param out expanded charset, with duplicates
+ * @return false if a reference is undefined or recursive without a previous definition
+ */
+template<typename T, T escapeChar>
+bool expandCharsetInto(const CharsetMap<T> &charsets, const T *def, size_t len, std::vector<T> &keys_history, std::vector<T> &out)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (def[i] != escapeChar || i + 1 == len) {
+            out.push_back(def[i]);
+            continue;
+        }
+        const T key = def[++i];
+        if (key == escapeChar) {
+            out.push_back(escapeChar);
+            continue;
+        }
+        // how many definitions of the charset are available
+        const size_t n_repl_avail = charsets.count(key);
+        // the number of times we already expanded this charset name
+        const size_t n_replaced = std::count(keys_history.begin(), keys_history.end(), key);
+        if (n_replaced >= n_repl_avail) {
+            // no charset found or can't recurse anymore, fatal
+            return false;
+        }
+        auto it_repl = charsets.upper_bound(key); // upper_bound is past the last definition
+        std::advance(it_repl, -(1 + (std::ptrdiff_t) n_replaced));
+        const DefaultCharset<T> &repl = it_repl->second;
+        if (repl.final) {
+            out.insert(out.end(), repl.cset.begin(), repl.cset.end());
+        }
+        else {
+            keys_history.push_back(key);
+            bool ok = expandCharsetInto<T, escapeChar>(charsets, repl.cset.data(), repl.cset.size(), keys_history, out);
+            keys_history.pop_back();
+            if (!ok) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Expand a charset replacing all the charset references by their values, then uniquify the charset
+ *
+ * The expansion is written into a single buffer, and the duplicates are removed in one pass
+ * (with a bitmap for the 8-bit charsets, a hash set for the unicode charsets).
+ *
+ * @param charsets charset map
+ * @param charset charset to expand, left unchanged on error
+ * @param charset_name name of \a charset, its references use the previous definitions
+ * @return false if a reference is undefined or recursive without a previous definition
+ */
 template<typename T, T escapeChar = T('?')>
 bool expandCharset(const CharsetMap<T> &charsets, DefaultCharset<T> &charset, T charset_name)
 {
     if (charset.final) {
         return true;
     }
-    
-    // working with a list allows fast random insert and erase without invalidating iterators (except iterators on erased elements...)
-    std::list<T> lcharset(charset.cset.begin(), charset.cset.end());
-    typedef typename decltype(lcharset)::iterator literator;
-    
-    // store a range of chars to read, with starting iterator and length
-    // we can't use an iterator for the end of the range since it may be invalidated
-    // the starting iterator is never invalidated during the loop
-    std::list<std::pair<literator, size_t>> queue;
-    // store the keys that where previously seen before expanding the ranges defined in 'queue'
-    std::list<std::list<T> > keys_histories;
-    queue.emplace_back(lcharset.begin(), lcharset.size());
-    keys_histories.push_back({charset_name});
-    
-    while (!queue.empty()) {
-        auto boundaries = queue.back();
-        auto keys_history = keys_histories.back();
-        queue.pop_back();
-        keys_histories.pop_back();
-        
-        size_t n_chars = 0;
-        for (auto it = boundaries.first; n_chars != boundaries.second; ) {
-            T c = *it;
-            if (c == escapeChar) {
-                if (n_chars + 1 == boundaries.second) {
-                    it++;
-                    n_chars++;
-                } else {
-                    T key = *std::next(it);
-                    if (key == escapeChar) {
-                        it = lcharset.erase(it);
-                        it ++;
-                        
-                    } else {
-                        int n_repl_avail = charsets.count(key); // how many definitions of the charset are available
-                        if (n_repl_avail != 0) {
-                            it = lcharset.erase(it);
-                            it = lcharset.erase(it);
-                            // the number of times we already expanded this charset name
-                            int n_replaced = std::count(keys_history.begin(), keys_history.end(), key);
-                            // if we still have more previous definition to use
-                            if (n_replaced < n_repl_avail) {
-                                auto it_repl = charsets.upper_bound(key);// upper_bound is past the last definition
-                                std::advance(it_repl, -(1 + n_replaced));
-                                it = lcharset.insert(it, it_repl->second.cset.begin(), it_repl->second.cset.end());
-                                if (!it_repl->second.final) {
-                                    keys_histories.emplace_back(keys_history);
-                                    keys_histories.back().push_back(key);
-                                    queue.emplace_back(it, it_repl->second.cset.size());
-                                }
-                                it = std::next(it, it_repl->second.cset.size());
-                            }
-                            else {
-                                // can't recurse anymore, make it fatal
-                                return false;
-                            }
-                        }
-                        else {
-                            // no charset found, fatal.
-                            return false;
-                        }
-                    }
-                    n_chars += 2;
-                }
-            } else {
-                it++;
-                n_chars++;
-            }
-        }
-    }
-    
-    // remove duplicates
-    for (auto it = lcharset.begin(); it != lcharset.end(); it++) {
-        auto it_dupl = std::find(std::next(it), lcharset.end(), *it);
-        while (it_dupl != lcharset.end()) {
-            it_dupl = lcharset.erase(it_dupl);
-            it_dupl = std::find(it_dupl, lcharset.end(), *it);
-        }
+
+    std::vector<T> keys_history(1, charset_name);
+    std::vector<T> expanded;
+    expanded.reserve(charset.cset.size());
+    if (!expandCharsetInto<T, escapeChar>(charsets, charset.cset.data(), charset.cset.size(), keys_history, expanded)) {
+        return false;
     }
-    
-    charset.cset = std::vector<T>(lcharset.begin(), lcharset.end());
+    removeDuplicates(expanded);
+
+    charset.cset.swap(expanded);
     charset.final = true;
     return true;
 }
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Mask.h"
+
+namespace Maskuni {
+
+/**
+ * @brief A mask with a width known at compile time
+ *
+ * A FixedMask is a view over the charsets of a Mask<T> which must outlive it.
+ * All the loops over the positions have a constant trip count so that the compiler
+ * can unroll the carry chain.
+ *
+ * \a setPosition must be called before iterating over the mask
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ * @param W width of the mask
+ */
+template<typename T, size_t W>
+class FixedMask
+{
+    static_assert(W >= 1, "FixedMask requires a width of at least 1");
+
+    const T *m_set[W];      /*!< characters of each charset */
+    const T *m_set_end[W];  /*!< m_set + length of each charset */
+    const T *m_p[W];        /*!< current position of each charset */
+    uint64_t m_len;         /*!< number of words */
+
+public:
+    /**
+     * @brief Create a view over the charsets of \a mask
+     *
+     * @param mask a mask of width W
+     */
+    explicit FixedMask(const Mask<T> &mask) : m_len(mask.getLen())
+    {
+        for (size_t i = 0; i < W; i++) {
+            const Charset<T> &charset = mask.getCharset(i);
+            m_set[i] = charset.data();
+            m_set_end[i] = charset.data() + charset.getLen();
+            m_p[i] = m_set[i];
+        }
+    }
+
+    /**
+     * @brief Get the length of this mask (number of words)
+     *
+     * @return Length of the mask
+     */
+    inline __attribute__((always_inline)) uint64_t getLen() const
+    {
+        return m_len;
+    }
+
+    /**
+     * @brief Get the characters of a charset
+     *
+     * @param i index of the charset
+     * @return pointer to the characters
+     */
+    inline __attribute__((always_inline)) const T *getSet(size_t i) const
+    {
+        return m_set[i];
+    }
+
+    /**
+     * @brief Get the number of characters of a charset
+     *
+     * @param i index of the charset
+     * @return length of the charset
+     */
+    inline __attribute__((always_inline)) uint64_t getSetLen(size_t i) const
+    {
+        return m_set_end[i] - m_set[i];
+    }
+
+    /**
+     * @brief Get the current position of a charset
+     *
+     * @param i index of the charset
+     * @return position in the charset
+     */
+    inline __attribute__((always_inline)) uint64_t getSetPosition(size_t i) const
+    {
+        return m_p[i] - m_set[i];
+    }
+
+    /**
+     * @brief Set the current position in the mask (between 0 and \a getLen())
+     *
+     * @param o Position
+     */
+    void setPosition(uint64_t o)
+    {
+        if (m_len == 0) {
+            return;
+        }
+        if (o >= m_len) {
+            o = (o % m_len);
+        }
+        for (size_t i = W; i != 0; i--) {
+            uint64_t s = m_set_end[i - 1] - m_set[i - 1];
+            uint64_t q = o / s;
+            uint64_t r = o - q * s;
+            m_p[i - 1] = m_set[i - 1] + r;
+            o = q;
+        }
+    }
+
+    /**
+     * @brief Copy the current word into w without incrementing the mask
+     *
+     * @param w buffer of at least W elements
+     */
+    inline __attribute__((always_inline)) void getCurrent(T *w) const
+    {
+        for (size_t i = 0; i < W; i++) {
+            w[i] = *m_p[i];
+        }
+    }
+
+    /**
+     * @brief Increment the first \a N charsets (from the left) and update the word
+     *
+     * The charsets on the right of \a N are not modified
+     *
+     * @param w buffer of at least W elements
+     * @return true if the N first charsets are back to position 0 ("carry")
+     */
+    template<size_t N>
+    inline __attribute__((always_inline)) bool getNextPrefix(T *w)
+    {
+        static_assert(N <= W, "can't increment more charsets than the width of the mask");
+        bool carry = true;
+        for (size_t i = N; carry && i != 0; i--) {
+            const T *p = m_p[i - 1] + 1;
+            carry = (p == m_set_end[i - 1]);
+            p = carry ? m_set[i - 1] : p;
+            m_p[i - 1] = p;
+            w[i - 1] = *p;
+        }
+        return carry;
+    }
+
+    /**
+     * @brief Increment the first \a n charsets (from the left) and update the word
+     * 
+     * Same as \a getNextPrefix for a number of charsets known at runtime
+     * 
+     * @param n number of charsets to increment, at most W
+     * @param w buffer of at least W elements
+     * @return true if the n first charsets are back to position 0 ("carry")
+     */
+    inline __attribute__((always_inline)) bool getNextPrefix(size_t n, T *w)
+    {
+        bool carry = true;
+        for (size_t i = n; carry && i != 0; i--) {
+            const T *p = m_p[i - 1] + 1;
+            carry = (p == m_set_end[i - 1]);
+            p = carry ? m_set[i - 1] : p;
+            m_p[i - 1] = p;
+            w[i - 1] = *p;
+        }
+        return carry;
+    }
+
+    /**
+     * @brief Increment the mask and update a buffer with the next word
+     *
+     * @param w buffer of at least W elements
+     * @return true if the mask is back to position 0 ("carry")
+     */
+    inline __attribute__((always_inline)) bool getNext(T *w)
+    {
+        return getNextPrefix<W>(w);
+    }
+};
+
+}
@@ -0,0 +1,446 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <vector>
+
+#include "Mask.h"
+#include "FixedMask.h"
+#include "SimdKernels.h"
+
+namespace Maskuni {
+
+#if defined(__WINDOWS__) || defined(__CYGWIN__)
+/*
+ * For msys2/mingw64 or cygwin, gcc doesn't seem to use a fast builtin memcpy
+ * Instead we have a slow one from the MS runtime, and an extra potato one from cygwin1.dll
+ * This simple memcpy is faster...
+ */
+static inline void *my_memcpy(void * __restrict dest, const void * __restrict src, size_t n) {
+    union P {
+        uint64_t *p64;
+        uint32_t *p32;
+        uint8_t *p8;
+        P(void *p) : p64(reinterpret_cast<uint64_t *>(p)) {}
+    };
+    union CP {
+        const uint64_t *p64;
+        const uint32_t *p32;
+        const uint8_t *p8;
+        CP(const void *p) : p64(reinterpret_cast<const uint64_t *>(p)) {}
+    };
+    P d(dest);
+    CP s(src);
+    while (n >= sizeof(uint64_t)) {
+        *d.p64++ = *s.p64++;
+        n -= sizeof(uint64_t);
+    }
+    while (n >= sizeof(uint32_t)) {
+        *d.p32++ = *s.p32++;
+        n -= sizeof(uint32_t);
+    }
+    while (n > 0) {
+        *d.p8++ = *s.p8++;
+        n --;
+    }
+    return dest;
+}
+#define MASKUNI_MEMCPY my_memcpy
+#else
+#define MASKUNI_MEMCPY memcpy
+#endif /* __WINDOWS__ || __CYGWIN__ */
+
+/*
+ * With -DMASKUNI_TARGET_CLONES=ON, the generation loops are also compiled for the x86-64-v2, v3
+ * and v4 levels and the best version for the CPU is selected when the program is loaded
+ */
+#ifdef MASKUNI_TARGET_CLONES
+#define MASKUNI_CLONES __attribute__((target_clones("default", "arch=x86-64-v2", "arch=x86-64-v3", "arch=x86-64-v4")))
+#else
+#define MASKUNI_CLONES
+#endif
+
+/**
+ * @brief An output buffer filled by the generation loops
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ */
+template<typename T>
+struct OutputBuffer {
+    T *m_begin;     /*!< start of the buffer */
+    T *m_p;         /*!< write position */
+    T *m_end;       /*!< end of the buffer */
+};
+
+/**
+ * @brief Reference generation loop, write the words one at a time using Mask<T>::getNext
+ *
+ * See \a generateWords for the parameters
+ *
+ * @param mask the mask, its position is modified
+ * @param start position of the first word in the mask
+ * @param count number of words to generate, must not be greater than mask.getLen() - start
+ * @param delim word delimiter
+ * @param delim_width 1 to write the delimiter, 0 otherwise
+ * @param word buffer of at least mask.getWidth() + 1 elements
+ * @param out output buffer
+ * @param flush callable used to empty the output buffer
+ */
+template<typename T, typename Flush>
+MASKUNI_CLONES void generateWordsGeneric(Mask<T> &mask, uint64_t start, uint64_t count, T delim, int delim_width, T *word, OutputBuffer<T> &out, Flush &flush)
+{
+    if (count == 0) {
+        return;
+    }
+    mask.setPosition(start);
+    size_t w = mask.getWidth();
+    // the first word needs to use Mask<T>::getCurrent to fully initialize the word
+    mask.getCurrent(word);
+    word[w] = delim;
+    if (w + delim_width > size_t(out.m_end - out.m_p)) {
+        flush(out);
+    }
+    MASKUNI_MEMCPY(out.m_p, word, sizeof(T) * (w + delim_width));
+    out.m_p += w + delim_width;
+    // following words use Mask<T>::getNext to update the word
+    for (uint64_t i = 1; i < count; i++) {
+        mask.getNext(word);
+        word[w] = delim;
+        if (w + delim_width > size_t(out.m_end - out.m_p)) {
+            flush(out);
+        }
+        MASKUNI_MEMCPY(out.m_p, word, sizeof(T) * (w + delim_width));
+        out.m_p += w + delim_width;
+    }
+}
+
+/**
+ * @brief Odometer generation loop
+ *
+ * The last \a levels variable charsets (1 or 2) of the mask are iterated inline.
+ * The word, used as a template, is copied for each value of the rightmost variable charset
+ * and only its character is written. The static characters on its right are part of the template.
+ * The carry through the remaining charsets is done by Mask<T>::getNext once per run
+ * of the inlined charsets.
+ *
+ * See \a generateWords for the other parameters
+ *
+ * @param levels number of inlined charsets, 1 or 2, must not be greater than mask.getVariableCount()
+ */
+template<typename T, typename Flush>
+MASKUNI_CLONES void generateWordsOdometer(Mask<T> &mask, uint64_t start, uint64_t count, T delim, int delim_width, T *word, OutputBuffer<T> &out, Flush &flush, int levels)
+{
+    if (count == 0) {
+        return;
+    }
+    mask.setPosition(start);
+    const size_t w = mask.getWidth();
+    const size_t stride = w + delim_width;
+    mask.getCurrent(word);
+    word[w] = delim;
+
+    const size_t n_var = mask.getVariableCount();
+    const size_t last_pos = mask.getVariablePosition(n_var - 1);
+    Charset<T> &last = mask.getCharset(last_pos);
+    const T *last_set = last.data();
+    const uint64_t last_len = last.getLen();
+    uint64_t p = last.getPosition();
+
+    // second level, only used if levels == 2
+    const size_t prev_pos = mask.getVariablePosition(levels == 2 ? n_var - 2 : n_var - 1);
+    Charset<T> &prev = mask.getCharset(prev_pos);
+    const T *prev_set = prev.data();
+    const uint64_t prev_len = prev.getLen();
+    uint64_t q = prev.getPosition();
+
+    while (count) {
+        uint64_t room = (out.m_end - out.m_p) / stride;
+        if (room == 0) {
+            flush(out);
+            room = (out.m_end - out.m_p) / stride;
+        }
+        uint64_t run = std::min(std::min(count, last_len - p), room);
+
+        // stamp the words of this run
+        T *o = out.m_p;
+        const T *set_p = last_set + p;
+        for (uint64_t i = 0; i < run; i++) {
+            MASKUNI_MEMCPY(o, word, sizeof(T) * stride);
+            o[last_pos] = set_p[i];
+            o += stride;
+        }
+        out.m_p = o;
+        count -= run;
+        p += run;
+
+        if (p == last_len && count) {
+            p = 0;
+            if (levels == 2 && q + 1 < prev_len) {
+                // inline carry into the second level
+                q++;
+                word[prev_pos] = prev_set[q];
+            }
+            else {
+                // carry through the whole mask, the inlined charsets are set on their
+                // last character so that they are back to position 0 after getNext
+                last.setPosition(last_len - 1);
+                if (levels == 2) {
+                    prev.setPosition(prev_len - 1);
+                }
+                mask.getNext(word);
+                q = 0;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Odometer generation loop for a mask of width \a W known at compile time
+ *
+ * Same principle as \a generateWordsOdometer for the rightmost variable charset but the word template
+ * is copied with a constant size (W + 1 elements, the delimiter is always copied) and the carry
+ * chain of \a FixedMask can be unrolled when the rightmost charset is variable.
+ *
+ * See \a generateWords for the parameters
+ *
+ * @param W width of \a mask
+ */
+template<typename T, size_t W, typename Flush>
+MASKUNI_CLONES void generateWordsFixed(Mask<T> &mask, uint64_t start, uint64_t count, T delim, int delim_width, OutputBuffer<T> &out, Flush &flush)
+{
+    if (count == 0) {
+        return;
+    }
+    FixedMask<T, W> fmask(mask);
+    fmask.setPosition(start);
+    T word[W + 1];
+    fmask.getCurrent(word);
+    word[W] = delim;
+
+    const size_t stride = W + delim_width;
+    // the static suffix is part of the template
+    const size_t last_pos = mask.getVariableCount() ? mask.getVariablePosition(mask.getVariableCount() - 1) : W - 1;
+    const T *last_set = fmask.getSet(last_pos);
+    const uint64_t last_len = fmask.getSetLen(last_pos);
+    uint64_t p = fmask.getSetPosition(last_pos);
+
+    while (count) {
+        size_t avail = out.m_end - out.m_p;
+        if (avail < W + 1) {
+            flush(out);
+            avail = out.m_end - out.m_p;
+        }
+        // each copy writes W + 1 elements, even without delimiter
+        uint64_t room = (avail - (W + 1 - stride)) / stride;
+        uint64_t run = std::min(std::min(count, last_len - p), room);
+
+        T *o = out.m_p;
+        const T *set_p = last_set + p;
+        for (uint64_t i = 0; i < run; i++) {
+            MASKUNI_MEMCPY(o, word, sizeof(T) * (W + 1));
+            o[last_pos] = set_p[i];
+            o += stride;
+        }
+        out.m_p = o;
+        count -= run;
+        p += run;
+
+        if (p == last_len && count) {
+            p = 0;
+            if (last_pos == W - 1) {
+                fmask.template getNextPrefix<W - 1>(word);
+            }
+            else {
+                fmask.getNextPrefix(last_pos, word);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Vectorized generation loop for 8-bit masks
+ *
+ * The last k charsets (1 to 3) are combined into a table of k-tuples in iteration order.
+ * A run over the whole table is written by the SIMD backend, which builds several words
+ * per vector by shuffling the word template and the tuples. The remaining words of a run
+ * are written by a scalar loop, then the rest of the mask is incremented once.
+ *
+ * See \a generateWords for the parameters
+ *
+ * @return false if the SIMD generation is not enabled or can't be used for this mask
+ */
+template<typename Flush>
+bool generateWordsSimd(Mask<char> &mask, uint64_t start, uint64_t count, char delim, int delim_width, OutputBuffer<char> &out, Flush &flush)
+{
+    const Simd::Backend *backend = Simd::activeBackend();
+    const size_t w = mask.getWidth();
+    const size_t stride = w + delim_width;
+    if (backend == NULL || w == 0 || stride > 16 || count == 0) {
+        return false;
+    }
+
+    // choose the number of stamped charsets so that a run holds a few periods
+    Simd::StampPlan plan;
+    size_t k = 0;
+    uint64_t tuples_len = 1;
+    for (size_t n = 1; n <= 3 && n <= w; n++) {
+        tuples_len *= mask.getCharset(w - n).getLen();
+        if (tuples_len * n > (1 << 18)) {
+            break;
+        }
+        if (!Simd::preparePlan(plan, *backend, stride, w - n, n)) {
+            return false;
+        }
+        if (tuples_len >= 4 * plan.m_words_per_period) {
+            k = n;
+            break;
+        }
+    }
+    if (k == 0) {
+        return false;
+    }
+
+    // the k-tuples in iteration order, followed by enough padding for the vector loads
+    std::vector<char> tuples(tuples_len * k + 32, 0);
+    for (uint64_t j = 0; j < tuples_len; j++) {
+        uint64_t o = j;
+        for (size_t n = 0; n < k; n++) {
+            const Charset<char> &charset = mask.getCharset(w - 1 - n);
+            tuples[j * k + (k - 1 - n)] = charset.data()[o % charset.getLen()];
+            o /= charset.getLen();
+        }
+    }
+
+    mask.setPosition(start);
+    char word[32] = {0};
+    mask.getCurrent(word);
+    word[w] = delim;
+    uint64_t p = 0;
+    for (size_t n = k; n != 0; n--) {
+        const Charset<char> &charset = mask.getCharset(w - n);
+        p = p * charset.getLen() + charset.getPosition();
+    }
+
+    while (count) {
+        uint64_t room = (out.m_end - out.m_p) / stride;
+        if (room == 0) {
+            flush(out);
+            room = (out.m_end - out.m_p) / stride;
+        }
+        uint64_t run = std::min(std::min(count, tuples_len - p), room);
+
+        const char *t = tuples.data() + p * k;
+        size_t done = backend->m_stamp(plan, out.m_p, word, t, run);
+        char *o = out.m_p + done * stride;
+        for (uint64_t i = done; i < run; i++) {
+            MASKUNI_MEMCPY(o, word, stride);
+            MASKUNI_MEMCPY(o + w - k, t + i * k, k);
+            o += stride;
+        }
+        out.m_p = o;
+        count -= run;
+        p += run;
+
+        if (p == tuples_len && count) {
+            p = 0;
+            // put the stamped charsets on their last character, they're back to 0 after getNext
+            for (size_t n = 1; n <= k; n++) {
+                Charset<char> &charset = mask.getCharset(w - n);
+                charset.setPosition(charset.getLen() - 1);
+            }
+            mask.getNext(word);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief No vectorized generation loop for the unicode masks
+ *
+ * @return false
+ */
+template<typename Flush>
+bool generateWordsSimd(Mask<uint32_t> &, uint64_t, uint64_t, uint32_t, int, OutputBuffer<uint32_t> &, Flush &)
+{
+    return false;
+}
+
+/**
+ * @brief Write \a count words of \a mask, starting with the word at position \a start, into \a out
+ *
+ * When there is not enough space left in \a out for the next word, flush(out) is called.
+ * The callable must empty the buffer (reset out.m_p to out.m_begin at least)
+ * or replace it by another empty buffer.
+ *
+ * When enabled, the vectorized loop is used for the 8-bit masks if possible.
+ * Masks of width 6 to 16 use a kernel specialized for their width.
+ * Otherwise the odometer loop is selected when the rightmost variable charsets are large enough
+ * to amortize the cost of a run, and the reference loop is used for the other masks.
+ *
+ * @param mask the mask, its position is modified
+ * @param start position of the first word in the mask
+ * @param count number of words to generate, must not be greater than mask.getLen() - start
+ * @param delim word delimiter
+ * @param delim_width 1 to write the delimiter, 0 otherwise
+ * @param word buffer of at least mask.getWidth() + 1 elements
+ * @param out output buffer
+ * @param flush callable used to empty the output buffer
+ */
+template<typename T, typename Flush>
+void generateWords(Mask<T> &mask, uint64_t start, uint64_t count, T delim, int delim_width, T *word, OutputBuffer<T> &out, Flush &flush)
+{
+    if (generateWordsSimd(mask, start, count, delim, delim_width, out, flush)) {
+        return;
+    }
+    const size_t w = mask.getWidth();
+    switch (w) {
+#define MASKUNI_FIXED_CASE(W) case W: generateWordsFixed<T, W>(mask, start, count, delim, delim_width, out, flush); return;
+        MASKUNI_FIXED_CASE(6)
+        MASKUNI_FIXED_CASE(7)
+        MASKUNI_FIXED_CASE(8)
+        MASKUNI_FIXED_CASE(9)
+        MASKUNI_FIXED_CASE(10)
+        MASKUNI_FIXED_CASE(11)
+        MASKUNI_FIXED_CASE(12)
+        MASKUNI_FIXED_CASE(13)
+        MASKUNI_FIXED_CASE(14)
+        MASKUNI_FIXED_CASE(15)
+        MASKUNI_FIXED_CASE(16)
+#undef MASKUNI_FIXED_CASE
+        default:
+            break;
+    }
+    const size_t n_var = mask.getVariableCount();
+    if (n_var >= 1 && count >= 2) {
+        uint64_t last_len = mask.getCharset(mask.getVariablePosition(n_var - 1)).getLen();
+        if (last_len >= 16) {
+            generateWordsOdometer(mask, start, count, delim, delim_width, word, out, flush, 1);
+            return;
+        }
+        if (n_var >= 2 && last_len * mask.getCharset(mask.getVariablePosition(n_var - 2)).getLen() >= 16) {
+            generateWordsOdometer(mask, start, count, delim, delim_width, word, out, flush, 2);
+            return;
+        }
+    }
+    generateWordsGeneric(mask, start, count, delim, delim_width, word, out, flush);
+}
+
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "Mask.h"
+#include "Generate.h"
+#include "utf_conv.h"
+
+namespace Maskuni {
+
+/**
+ * @brief The characters of a charset encoded in UTF-8
+ *
+ * The character i is m_bytes[m_offsets[i]] to m_bytes[m_offsets[i + 1]] (excluded)
+ */
+struct Utf8Charset {
+    std::vector<char> m_bytes;          /*!< encoded characters */
+    std::vector<uint32_t> m_offsets;    /*!< getLen() + 1 offsets in m_bytes */
+    size_t m_max_len;                   /*!< length of the longest encoded character */
+};
+
+/**
+ * @brief A cache of the UTF-8 encoded charsets
+ *
+ * The charsets are identified by their buffer. The cache keeps a reference on the buffers
+ * so that a buffer can't be reused by another charset while it's cached.
+ * The cache is cleared by \a trim when it has reached \a max_entries.
+ */
+class Utf8Encoder
+{
+    struct Key {
+        const uint32_t *m_set;
+        size_t m_len;
+        bool operator==(const Key &o) const
+        {
+            return m_set == o.m_set && m_len == o.m_len;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const
+        {
+            return std::hash<const uint32_t *>()(k.m_set) ^ k.m_len;
+        }
+    };
+    struct Entry {
+        Charset<uint32_t> m_charset;    /*!< holds the buffer */
+        Utf8Charset m_encoded;          /*!< encoded characters */
+    };
+
+    std::unordered_map<Key, Entry, KeyHash> m_cache;    /*!< encoded charsets */
+    size_t m_max_entries;                               /*!< maximum size of the cache */
+
+public:
+    /**
+     * @brief Create an empty cache
+     *
+     * @param max_entries maximum number of cached charsets
+     */
+    explicit Utf8Encoder(size_t max_entries = 4096) : m_cache(), m_max_entries(std::max<size_t>(1, max_entries)) {}
+
+    /**
+     * @brief Get the UTF-8 encoded characters of a charset
+     *
+     * @param charset charset
+     * @return the encoded characters, valid until the next call to \a trim
+     */
+    const Utf8Charset &encode(const Charset<uint32_t> &charset)
+    {
+        Key key = {charset.data(), (size_t) charset.getLen()};
+        auto it = m_cache.find(key);
+        if (it != m_cache.end()) {
+            return it->second.m_encoded;
+        }
+        Entry entry = {charset, Utf8Charset()};
+        Utf8Charset &e = entry.m_encoded;
+        e.m_bytes.resize(key.m_len * 4);
+        e.m_offsets.resize(key.m_len + 1);
+        e.m_max_len = 0;
+        uint32_t o = 0;
+        for (size_t i = 0; i < key.m_len; i++) {
+            e.m_offsets[i] = o;
+            int l = UTF::impl::CpToUtf8::write(key.m_set[i], e.m_bytes.data() + o);
+            e.m_max_len = std::max<size_t>(e.m_max_len, l);
+            o += l;
+        }
+        e.m_offsets[key.m_len] = o;
+        e.m_bytes.resize(o);
+        return m_cache.emplace(key, std::move(entry)).first->second.m_encoded;
+    }
+
+    /**
+     * @brief Clear the cache if it has reached its maximum size
+     */
+    void trim()
+    {
+        if (m_cache.size() >= m_max_entries) {
+            m_cache.clear();
+        }
+    }
+};
+
+/**
+ * @brief Width of the fixed size copies used by \a generateWordsUtf8 for the short words
+ *
+ * The output buffer must keep this many bytes of slack after the words to use them.
+ */
+static constexpr size_t utf8_copy_width = 16;
+
+/**
+ * @brief Generation loop for the unicode masks writing UTF-8 encoded words
+ *
+ * The words are made of three parts:
+ * - the prefix, on the left of the rightmost variable charset, encoded again after each carry
+ * - the rightmost variable charset, its characters followed by the static suffix and the delimiter
+ *   are encoded once for the mask ("tails")
+ * Each word is then written with two copies and the code points are never encoded while generating.
+ *
+ * See \a generateWords for the parameters
+ *
+ * @param mask the mask, its position is modified
+ * @param words_buffer buffer of at least mask.getWidth() elements
+ * @param out output buffer, a flush must leave room for at least 4 * mask.getWidth() + 1 bytes
+ *            (plus utf8_copy_width for the fastest loop)
+ * @param encoder cache of the encoded charsets
+ * @return true
+ */
+template<typename Flush>
+MASKUNI_CLONES bool generateWordsUtf8(Mask<uint32_t> &mask, uint64_t start, uint64_t count, uint32_t delim, int delim_width,
+                       uint32_t *words_buffer, OutputBuffer<char> &out, Flush &flush, Utf8Encoder &encoder)
+{
+    if (count == 0) {
+        return true;
+    }
+    encoder.trim();
+    const size_t w = mask.getWidth();
+    const size_t n_var = mask.getVariableCount();
+    const size_t last_pos = n_var ? mask.getVariablePosition(n_var - 1) : w - 1;
+    mask.setPosition(start);
+    mask.getCurrent(words_buffer);
+
+    // static suffix and delimiter
+    char suffix[4 * 64 + 1];
+    std::vector<char> long_suffix;
+    char *suffix_p = suffix;
+    if ((w - last_pos - 1) > 64) {
+        long_suffix.resize(4 * (w - last_pos - 1) + 1);
+        suffix_p = long_suffix.data();
+    }
+    size_t suffix_len = 0;
+    for (size_t i = last_pos + 1; i < w; i++) {
+        suffix_len += UTF::impl::CpToUtf8::write(words_buffer[i], suffix_p + suffix_len);
+    }
+    if (delim_width) {
+        suffix_p[suffix_len++] = (char) delim;
+    }
+
+    // the tails: characters of the last variable charset followed by the suffix,
+    // stored in slots of at least 16 bytes
+    Charset<uint32_t> &last = mask.getCharset(last_pos);
+    const uint64_t last_len = last.getLen();
+    uint64_t p = last.getPosition();
+    const Utf8Charset &enc_last = encoder.encode(last);
+    const size_t max_tail = enc_last.m_max_len + suffix_len;
+    const size_t tail_stride = std::max<size_t>(utf8_copy_width, max_tail);
+    std::vector<char> tails(last_len * tail_stride);
+    std::vector<uint8_t> tails_len(last_len);
+    for (uint64_t i = 0; i < last_len; i++) {
+        size_t l = enc_last.m_offsets[i + 1] - enc_last.m_offsets[i];
+        char *t = tails.data() + i * tail_stride;
+        memcpy(t, enc_last.m_bytes.data() + enc_last.m_offsets[i], l);
+        memcpy(t + l, suffix_p, suffix_len);
+        tails_len[i] = (uint8_t) std::min<size_t>(l + suffix_len, 255);
+    }
+
+    // the encoded prefix, only rewritten from the leftmost charset modified by a carry
+    std::vector<const Utf8Charset *> prefix_enc(last_pos);
+    std::vector<size_t> prefix_offsets(last_pos + 1);
+    std::vector<char> prefix(std::max<size_t>(utf8_copy_width, 4 * last_pos));
+    for (size_t i = 0; i < last_pos; i++) {
+        prefix_enc[i] = &encoder.encode(mask.getCharset(i));
+    }
+    auto encodePrefix = [&](size_t from) -> size_t {
+        size_t o = prefix_offsets[from];
+        for (size_t i = from; i < last_pos; i++) {
+            const Utf8Charset &enc = *prefix_enc[i];
+            uint64_t pos = mask.getCharset(i).getPosition();
+            size_t l = enc.m_offsets[pos + 1] - enc.m_offsets[pos];
+            prefix_offsets[i] = o;
+            memcpy(prefix.data() + o, enc.m_bytes.data() + enc.m_offsets[pos], l);
+            o += l;
+        }
+        prefix_offsets[last_pos] = o;
+        return o;
+    };
+    size_t prefix_len = encodePrefix(0);
+
+    while (count) {
+        // short parts are copied with fixed size copies which may write up to 16 bytes past the word
+        const size_t max_word = prefix_len + max_tail;
+        bool fixed_copies = prefix_len <= utf8_copy_width && max_tail <= utf8_copy_width;
+        size_t slack = fixed_copies ? utf8_copy_width : 0;
+        size_t avail = out.m_end - out.m_p;
+        uint64_t room = avail >= slack ? (avail - slack) / max_word : 0;
+        if (room == 0) {
+            flush(out);
+            avail = out.m_end - out.m_p;
+            room = avail >= slack ? (avail - slack) / max_word : 0;
+            if (room == 0) {
+                fixed_copies = false;
+                room = avail / max_word;
+            }
+        }
+        uint64_t run = std::min(std::min(count, last_len - p), room);
+
+        char *o = out.m_p;
+        if (fixed_copies) {
+            for (uint64_t i = p; i < p + run; i++) {
+                memcpy(o, prefix.data(), utf8_copy_width);
+                o += prefix_len;
+                memcpy(o, tails.data() + i * tail_stride, utf8_copy_width);
+                o += tails_len[i];
+            }
+        }
+        else {
+            for (uint64_t i = p; i < p + run; i++) {
+                size_t l = enc_last.m_offsets[i + 1] - enc_last.m_offsets[i] + suffix_len;
+                MASKUNI_MEMCPY(o, prefix.data(), prefix_len);
+                o += prefix_len;
+                MASKUNI_MEMCPY(o, tails.data() + i * tail_stride, l);
+                o += l;
+            }
+        }
+        out.m_p = o;
+        count -= run;
+        p += run;
+
+        if (p == last_len && count) {
+            p = 0;
+            // carry through the prefix, the last charset is back to position 0 after getNext
+            last.setPosition(last_len - 1);
+            mask.getNext(words_buffer);
+            // the carry stops at the rightmost variable charset which didn't wrap
+            size_t from = 0;
+            for (size_t v = n_var - 1; v > 0; v--) {
+                size_t i = mask.getVariablePosition(v - 1);
+                if (mask.getCharset(i).getPosition() != 0) {
+                    from = i;
+                    break;
+                }
+            }
+            prefix_len = encodePrefix(from);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief The 8-bit masks are not encoded
+ *
+ * @return false
+ */
+template<typename Flush>
+bool generateWordsUtf8(Mask<char> &, uint64_t, uint64_t, char, int, char *, OutputBuffer<char> &, Flush &, Utf8Encoder &)
+{
+    return false;
+}
+
+}
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <cstdio>
+#include <algorithm>
 
 #include "Charset.h"
 #include "overflow.h"
@@ -32,6 +33,9 @@ namespace Maskuni {
  * \a getCurrent should be use to get the first word of the mask.
  * \a getNext should be called with the same parameter to get the subsequent words.
  * 
+ * The static positions (charsets of a single character) are written once by \a getCurrent
+ * and are then skipped: only the variable positions are part of the carry chain.
+ * 
  * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
  */
 template<typename T>
@@ -40,6 +44,7 @@ class Mask
     std::vector<Charset<T>> m_charsets; /*!< list of charsets from left to right */
     size_t m_n_charsets;                /*!< m_charsets.size() */
     uint64_t m_len;                     /*!< sum of the charsets' length */
+    std::vector<size_t> m_variable;     /*!< indexes of the charsets with more than one character, from left to right */
 
 public:
     /**
@@ -47,9 +52,10 @@ public:
      *
      * @param reserve Reserve memory for \a reserve charsets for faster insertions
      */
-    Mask(unsigned int reserve = 0) : m_charsets(), m_n_charsets(0), m_len(0)
+    Mask(unsigned int reserve = 0) : m_charsets(), m_n_charsets(0), m_len(0), m_variable()
     {
         m_charsets.reserve(reserve);
+        m_variable.reserve(reserve);
     }
     
     /**
@@ -60,6 +66,7 @@ public:
         m_charsets.clear();
         m_len = 0;
         m_n_charsets = 0;
+        m_variable.clear();
     }
 
     /**
@@ -80,6 +87,33 @@ public:
                 abort();
             }
         }
+        if (m_charsets.back().getLen() > 1) {
+            m_variable.push_back(m_n_charsets);
+        }
+        m_n_charsets++;
+    }
+
+    /**
+     * @brief Add a charset to the right of the already defined charsets without copying its characters
+     * This method will abort if the length of the mask would not fit in an unsigned 64 bit integer
+     * 
+     * @param set characters, shared with the new charset
+     * @param set_len number of characters
+     */
+    void push_charset_right(const std::shared_ptr<T> &set, uint64_t set_len)
+    {
+        m_charsets.emplace_back(set, set_len);
+        if (m_n_charsets == 0) {
+            m_len = m_charsets.back().getLen();
+        } else {
+            if (umul64_overflow(m_len, m_charsets.back().getLen(), &m_len)) {
+                fprintf(stderr, "Error: the length of the mask would overflow a 64 bits integer\n");
+                abort();
+            }
+        }
+        if (m_charsets.back().getLen() > 1) {
+            m_variable.push_back(m_n_charsets);
+        }
         m_n_charsets++;
     }
 
@@ -100,6 +134,9 @@ public:
                 abort();
             }
         }
+        if (m_charsets.back().getLen() > 1) {
+            m_variable.push_back(m_n_charsets);
+        }
         m_n_charsets++;
     }
 
@@ -121,6 +158,12 @@ public:
                 abort();
             }
         }
+        for (auto &v : m_variable) {
+            v++;
+        }
+        if (m_charsets.front().getLen() > 1) {
+            m_variable.insert(m_variable.begin(), 0);
+        }
         m_n_charsets++;
     }
 
@@ -141,6 +184,12 @@ public:
                 abort();
             }
         }
+        for (auto &v : m_variable) {
+            v++;
+        }
+        if (m_charsets.front().getLen() > 1) {
+            m_variable.insert(m_variable.begin(), 0);
+        }
         m_n_charsets++;
     }
 
@@ -164,6 +213,49 @@ public:
         return m_charsets.size();
     }
 
+    /**
+     * @brief Get the number of variable positions (charsets of more than one character)
+     * 
+     * @return number of variable positions
+     */
+    inline __attribute__((always_inline)) size_t getVariableCount() const
+    {
+        return m_variable.size();
+    }
+
+    /**
+     * @brief Get the index of a variable position
+     * 
+     * @param i index of the variable position, from left to right, less than getVariableCount()
+     * @return index of the charset in the mask
+     */
+    inline __attribute__((always_inline)) size_t getVariablePosition(size_t i) const
+    {
+        return m_variable[i];
+    }
+
+    /**
+     * @brief Access a charset of the mask
+     * 
+     * @param i index of the charset, from left to right
+     * @return the charset
+     */
+    inline __attribute__((always_inline)) Charset<T> &getCharset(size_t i)
+    {
+        return m_charsets[i];
+    }
+
+    /**
+     * @brief Access a charset of the mask
+     * 
+     * @param i index of the charset, from left to right
+     * @return the charset
+     */
+    inline __attribute__((always_inline)) const Charset<T> &getCharset(size_t i) const
+    {
+        return m_charsets[i];
+    }
+
     /**
      * @brief Set the current position in the mask (between 0 and \a getLen())
      * Must be called before using \a getCurrent and \a getNext
@@ -179,14 +271,71 @@ public:
             o = (o % m_len);
         }
 
-        // set the position from right to left
-        for (auto it = m_charsets.rbegin(); it != m_charsets.rend(); it++) {
-            uint64_t s = (*it).getLen();
+        // set the position from right to left, the static positions are always at 0
+        for (auto it = m_variable.rbegin(); it != m_variable.rend(); it++) {
+            Charset<T> &charset = m_charsets[*it];
+            uint64_t s = charset.getLen();
             uint64_t q = o / s;
             uint64_t r = o - q * s;
-            (*it).setPosition(r);
+            charset.setPosition(r);
+            o = q;
+        }
+    }
+
+    /**
+     * @brief Get the word at a given position without changing the position of the mask
+     * 
+     * The position is decomposed the same way as \a setPosition
+     * 
+     * @param o position of the word, counting from 0
+     * @param w buffer of at least getWidth() elements
+     * @return false if \a o is not less than \a getLen()
+     */
+    bool wordAt(uint64_t o, T *w) const
+    {
+        if (o >= m_len) {
+            return false;
+        }
+        for (size_t i = 0; i < m_n_charsets; i++) {
+            w[i] = m_charsets[i].data()[0];
+        }
+        for (auto it = m_variable.rbegin(); it != m_variable.rend(); it++) {
+            const Charset<T> &charset = m_charsets[*it];
+            uint64_t s = charset.getLen();
+            uint64_t q = o / s;
+            w[*it] = charset.data()[o - q * s];
             o = q;
         }
+        return true;
+    }
+
+    /**
+     * @brief Get the position of a word in the mask, the reverse of \a wordAt
+     * 
+     * A character found several times in a charset is taken at its first position
+     * 
+     * @param w word of getWidth() elements
+     * @param o set to the position of the word, counting from 0
+     * @return false if the word doesn't belong to the mask
+     */
+    bool indexOf(const T *w, uint64_t &o) const
+    {
+        if (m_len == 0) {
+            return false;
+        }
+        uint64_t r = 0;
+        for (size_t i = 0; i < m_n_charsets; i++) {
+            const Charset<T> &charset = m_charsets[i];
+            const T *set = charset.data();
+            const T *c = std::find(set, set + charset.getLen(), w[i]);
+            if (c == set + charset.getLen()) {
+                return false;
+            }
+            // the static positions don't take part in the position
+            r = r * charset.getLen() + (c - set);
+        }
+        o = r;
+        return true;
     }
 
     /**
@@ -208,7 +357,7 @@ public:
      * therefore getNext whould always be called with the same parameter
      * and only after initializing the first word with \a getCurrent.
      * 
-     * The word is iterated from right to left.
+     * The word is iterated from right to left, only through the variable positions.
      * 
      * @param w buffer of at least getWidth() elements
      * @return true if the mask is back to position 0 ("carry")
@@ -216,8 +365,9 @@ public:
     inline __attribute__((always_inline)) bool getNext(T *w)
     {
         bool carry = true;
-        for (size_t i = m_n_charsets; carry && i != 0; i--) {
-            carry = m_charsets[i - 1].getNext(w + (i - 1));
+        for (size_t i = m_variable.size(); carry && i != 0; i--) {
+            size_t pos = m_variable[i - 1];
+            carry = m_charsets[pos].getNext(w + pos);
         }
         return carry;
     }
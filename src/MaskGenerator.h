@@ -49,7 +49,7 @@ public:
     /**
      * @brief generation method, get only the next mask's size and width
      * 
-     * Should be overwritten to provide a faster version
+     * Should be overridden to provide a faster version
      * 
      * @param size the new mask's size is copied into \a size
      * @param width the new mask's width is copied into \a width
@@ -71,6 +71,71 @@ public:
      */
     virtual void reset() = 0;
     
+    /**
+     * @brief Move the generator so that the next generated mask is the mask number \a mask_idx
+     * 
+     * Should be overridden to provide a faster version than a reset followed by
+     * \a mask_idx calls to the sizing method
+     * 
+     * @param mask_idx index of the next mask, counting from 0
+     * @return false if there are less than \a mask_idx masks or if there was an error
+     */
+    virtual bool seek(uint64_t mask_idx) {
+        reset();
+        uint64_t size;
+        size_t width;
+        for (uint64_t i = 0; i < mask_idx; i++) {
+            if (!(*this)(size, width)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    /**
+     * @brief Count the words without a sizing pass
+     * 
+     * Should be overridden by the generators able to count their words directly,
+     * \a seekWord must then be overridden too.
+     * Exit the program if the total number of words would overflow a 64 bits integer.
+     * 
+     * @param len set to the total number of words
+     * @param max_width updated with the width of the widest mask
+     * @return false if the words can't be counted directly, a sizing pass is needed
+     */
+    virtual bool countWords(uint64_t &len, size_t &max_width) {
+        (void) len;
+        (void) max_width;
+        return false;
+    }
+    
+    /**
+     * @brief Move the generator so that the next generated mask holds the word \a word_idx
+     * 
+     * Only available when \a countWords succeeds
+     * 
+     * @param word_idx position of the word, counting from 0
+     * @param offset set to the position of the word in its mask
+     * @return false if there are less than \a word_idx + 1 words
+     */
+    virtual bool seekWord(uint64_t word_idx, uint64_t &offset) {
+        (void) word_idx;
+        (void) offset;
+        return false;
+    }
+    
+    /**
+     * @brief Test if the generator can be reset
+     * 
+     * Should be overridden by the generators reading their masks from a stream,
+     * they can only be iterated once, without a sizing pass
+     * 
+     * @return false if \a reset and \a seek are not available
+     */
+    virtual bool canReset() {
+        return true;
+    }
+    
     /**
      * @brief Test if there was an error
      * 
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+
+#include "overflow.h"
+
+namespace Maskuni {
+
+/**
+ * @brief A sampled prefix sum of the masks' lengths
+ *
+ * The index is filled with the length of each mask during the sizing pass.
+ * Every \a interval masks, the number of words before the mask is recorded.
+ * It's then possible to find, by a binary search, a mask close to any word
+ * and to start iterating over at most \a interval masks from there.
+ *
+ * An index can also refer to an external array holding the offsets of every mask
+ * (see \a wrap), which must outlive the index.
+ */
+class MaskIndex
+{
+    uint64_t m_interval;                /*!< number of masks between two samples */
+    uint64_t m_n_masks;                 /*!< number of masks pushed */
+    uint64_t m_total;                   /*!< number of words of the masks pushed */
+    std::vector<uint64_t> m_offsets;    /*!< m_offsets[i] is the number of words before the mask i * m_interval */
+    const uint64_t *m_ext_offsets;      /*!< external offsets used instead of m_offsets or NULL */
+    uint64_t m_n_ext_offsets;           /*!< number of external offsets */
+
+public:
+    /**
+     * @brief Create an empty index
+     *
+     * @param interval number of masks between two samples
+     */
+    explicit MaskIndex(uint64_t interval = 256) :
+        m_interval(std::max<uint64_t>(1, interval)), m_n_masks(0), m_total(0), m_offsets(),
+        m_ext_offsets(NULL), m_n_ext_offsets(0) {}
+
+    /**
+     * @brief Create an index over an external array of offsets sampled at every mask
+     *
+     * @param offsets offsets[i] is the number of words before the mask i, must outlive the index
+     * @param n_masks number of masks in \a offsets
+     * @param total total number of words
+     * @return an index which can't be pushed into
+     */
+    static MaskIndex wrap(const uint64_t *offsets, uint64_t n_masks, uint64_t total)
+    {
+        MaskIndex index(1);
+        index.m_n_masks = n_masks;
+        index.m_total = total;
+        index.m_ext_offsets = offsets;
+        index.m_n_ext_offsets = n_masks;
+        return index;
+    }
+
+    /**
+     * @brief Add the next mask to the index
+     *
+     * @param len length of the mask
+     * @return false if the total number of words would overflow a 64 bits integer
+     */
+    bool push(uint64_t len)
+    {
+        assert(m_ext_offsets == NULL);
+        if (m_n_masks % m_interval == 0) {
+            m_offsets.push_back(m_total);
+        }
+        m_n_masks++;
+        return !uadd64_overflow(m_total, len, &m_total);
+    }
+
+    /**
+     * @brief Get the number of masks in the index
+     *
+     * @return number of masks
+     */
+    uint64_t getMasksCount() const
+    {
+        return m_n_masks;
+    }
+
+    /**
+     * @brief Get the total number of words
+     *
+     * @return number of words
+     */
+    uint64_t getLen() const
+    {
+        return m_total;
+    }
+
+    /**
+     * @brief Find the last sampled mask starting at or before a word
+     *
+     * @param word_idx global position of the word
+     * @param words_before set to the number of words before the returned mask
+     * @return index of the sampled mask
+     */
+    uint64_t locate(uint64_t word_idx, uint64_t &words_before) const
+    {
+        const uint64_t *begin = m_ext_offsets ? m_ext_offsets : m_offsets.data();
+        const uint64_t *end = begin + (m_ext_offsets ? m_n_ext_offsets : m_offsets.size());
+        if (begin == end) {
+            words_before = 0;
+            return 0;
+        }
+        // last sample with an offset <= word_idx
+        const uint64_t *it = std::upper_bound(begin, end, word_idx);
+        if (it != begin) {
+            it--;
+        }
+        words_before = *it;
+        return (it - begin) * m_interval;
+    }
+};
+
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include "Maskuni.h"
+
+#include <utility>
+#include <vector>
+
+namespace Maskuni {
+
+bool initCharsets(CharsetMapAscii &charsets)
+{
+    initDefaultCharsetsAscii(charsets);
+    for (const auto &p : charsets) {
+        if (!expandCharsetAscii(charsets, p.first)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool initCharsets(CharsetMapUnicode &charsets)
+{
+    initDefaultCharsetsUnicode(charsets);
+    for (const auto &p : charsets) {
+        if (!expandCharsetUnicode(charsets, p.first)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool addCharset(CharsetMapAscii &charsets, char key, const char *spec)
+{
+    std::vector<char> charset;
+    if (!readCharsetAscii(spec, charset)) {
+        return false;
+    }
+    charsets.insert(std::make_pair(key, DefaultCharset<char>(charset, false)));
+    return expandCharsetAscii(charsets, key);
+}
+
+bool addCharset(CharsetMapUnicode &charsets, uint32_t key, const char *spec)
+{
+    std::vector<uint32_t> charset;
+    if (!readCharsetUtf8(spec, charset)) {
+        return false;
+    }
+    charsets.insert(std::make_pair(key, DefaultCharset<uint32_t>(charset, false)));
+    return expandCharsetUnicode(charsets, key);
+}
+
+}
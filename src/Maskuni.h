@@ -0,0 +1,118 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Entry point of the maskuni library
+ *
+ * The charsets are set up with \a initCharsets and \a addCharset, the masks are read
+ * into a MaskGenerator by \a readMaskList or \a readBruteforce (or the functions of ReadMasks.h,
+ * ReadBruteforce.h and CompiledIndex.h), then the words are pulled from memory with a WordBatcher:
+ *
+ *     Maskuni::CharsetMapAscii charsets;
+ *     Maskuni::initCharsets(charsets);
+ *     Maskuni::WordBatcher<char> batcher(Maskuni::readMaskList("?l?l?l?d", charsets));
+ *     char buf[1 << 16];
+ *     size_t width, n;
+ *     while ((n = batcher.fillBatch(buf, sizeof(buf) / sizeof(buf[0]), width)) != 0) {
+ *         // n words of width characters in buf
+ *     }
+ */
+
+#include <cstdint>
+
+#include "ReadCharsets.h"
+#include "ReadMasks.h"
+#include "ReadBruteforce.h"
+#include "MaskGenerator.h"
+#include "WordBatcher.h"
+
+namespace Maskuni {
+
+/**
+ * @brief Clear a charset map, then add and expand the 8-bit built-in charsets
+ *
+ * @param charsets charset map
+ * @return false if a charset couldn't be expanded
+ */
+bool initCharsets(CharsetMapAscii &charsets);
+
+/**
+ * @brief Clear a charset map, then add and expand the unicode built-in charsets
+ *
+ * @param charsets charset map
+ * @return false if a charset couldn't be expanded
+ */
+bool initCharsets(CharsetMapUnicode &charsets);
+
+/**
+ * @brief Define or redefine an 8-bit charset, like the option -1 of maskuni
+ *
+ * The definition may reference the charsets already defined, including the previous definition of \a key
+ *
+ * @param charsets charset map
+ * @param key name of the charset
+ * @param spec charset file name or charset content
+ * @return false if the charset couldn't be read or expanded
+ */
+bool addCharset(CharsetMapAscii &charsets, char key, const char *spec);
+
+/**
+ * @brief Define or redefine an unicode charset, like the option -1 of maskuni
+ *
+ * The definition may reference the charsets already defined, including the previous definition of \a key
+ *
+ * @param charsets charset map
+ * @param key name of the charset
+ * @param spec charset file name or UTF-8 charset content
+ * @return false if the charset couldn't be read or expanded
+ */
+bool addCharset(CharsetMapUnicode &charsets, uint32_t key, const char *spec);
+
+/**
+ * @brief Read an 8-bit mask list from a file or from a single mask, see \a readMaskListAscii
+ */
+inline MaskGenerator<char> *readMaskList(const char *spec, const CharsetMapAscii &charsets)
+{
+    return readMaskListAscii(spec, charsets);
+}
+
+/**
+ * @brief Read an unicode mask list from a file or from a single mask, see \a readMaskListUtf8
+ */
+inline MaskGenerator<uint32_t> *readMaskList(const char *spec, const CharsetMapUnicode &charsets)
+{
+    return readMaskListUtf8(spec, charsets);
+}
+
+/**
+ * @brief Read an 8-bit bruteforce description file, see \a readBruteforceAscii
+ */
+inline MaskGenerator<char> *readBruteforce(const char *spec, const CharsetMapAscii &charsets)
+{
+    return readBruteforceAscii(spec, charsets);
+}
+
+/**
+ * @brief Read an unicode bruteforce description file, see \a readBruteforceUtf8
+ */
+inline MaskGenerator<uint32_t> *readBruteforce(const char *spec, const CharsetMapUnicode &charsets)
+{
+    return readBruteforceUtf8(spec, charsets);
+}
+
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "Mask.h"
+#include "MaskGenerator.h"
+
+namespace Maskuni {
+
+/**
+ * @brief Order of the masks
+ */
+enum MaskOrder {
+    ORDER_FILE,     /*!< order of the input */
+    ORDER_SIZE,     /*!< smallest masks first */
+    ORDER_PRIORITY, /*!< highest priorities first */
+    ORDER_DENSITY,  /*!< highest priorities per word first */
+};
+
+/**
+ * @brief Generate the masks of a generator in another order
+ *
+ * The masks are sized once when sorting, then each mask is read again from the original
+ * generator when it's generated, with a seek unless it follows the previous one.
+ * The order is stable: the masks of the same rank keep the order of the input.
+ * The order only depends on the input, so the words keep the same global positions
+ * from one run to another.
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ */
+template<typename T>
+class OrderedMaskGenerator : public MaskGenerator<T>
+{
+    std::unique_ptr<MaskGenerator<T>> m_gen;    /*!< generator of the original masks */
+    std::vector<uint64_t> m_order;              /*!< indexes of the original masks, in the new order */
+    std::vector<uint64_t> m_sizes;              /*!< number of words of the original masks */
+    std::vector<size_t> m_widths;               /*!< width of the original masks */
+    uint64_t m_pos;                             /*!< next mask to generate in m_order */
+    uint64_t m_gen_next;                        /*!< index of the next original mask of m_gen */
+    bool m_good;                                /*!< false after an error */
+
+public:
+    /**
+     * @brief Reorder the masks of a generator, \a sort must be called before generating
+     *
+     * @param gen generator of the original masks, owned by the new generator
+     */
+    explicit OrderedMaskGenerator(MaskGenerator<T> *gen) :
+        m_gen(gen), m_order(), m_sizes(), m_widths(), m_pos(0), m_gen_next(0), m_good(true)
+    {
+    }
+
+    /**
+     * @brief Size the original masks and sort them
+     *
+     * @param order order of the masks
+     * @param priorities non-negative priority of each original mask for ORDER_PRIORITY and ORDER_DENSITY
+     * @return false if the original generator failed or if the number of priorities doesn't match
+     */
+    bool sort(MaskOrder order, const std::vector<double> &priorities)
+    {
+        uint64_t size;
+        size_t width;
+        m_gen->reset();
+        while ((*m_gen)(size, width)) {
+            m_sizes.push_back(size);
+            m_widths.push_back(width);
+        }
+        m_gen_next = m_sizes.size();
+        if (!m_gen->good()) {
+            m_good = false;
+            return false;
+        }
+        const bool prioritized = order == ORDER_PRIORITY || order == ORDER_DENSITY;
+        if (prioritized && priorities.size() != m_sizes.size()) {
+            fprintf(stderr, "Error: %zu priorities for %zu masks\n", priorities.size(), m_sizes.size());
+            return false;
+        }
+        m_order.resize(m_sizes.size());
+        for (uint64_t i = 0; i < m_order.size(); i++) {
+            m_order[i] = i;
+        }
+        if (order == ORDER_SIZE) {
+            std::stable_sort(m_order.begin(), m_order.end(), [this](uint64_t a, uint64_t b) { return m_sizes[a] < m_sizes[b]; });
+        }
+        else if (order == ORDER_PRIORITY) {
+            std::stable_sort(m_order.begin(), m_order.end(), [&](uint64_t a, uint64_t b) { return priorities[a] > priorities[b]; });
+        }
+        else if (order == ORDER_DENSITY) {
+            // the empty masks (comment lines) have no density
+            auto density = [&](uint64_t i) { return m_sizes[i] ? priorities[i] / (double) m_sizes[i] : 0.0; };
+            std::stable_sort(m_order.begin(), m_order.end(), [&](uint64_t a, uint64_t b) { return density(a) > density(b); });
+        }
+        m_pos = 0;
+        return true;
+    }
+
+    bool operator()(Mask<T> &mask) override {
+        if (!m_good || m_pos == m_order.size()) {
+            return false;
+        }
+        const uint64_t idx = m_order[m_pos];
+        if (idx != m_gen_next && !m_gen->seek(idx)) {
+            m_good = false;
+            return false;
+        }
+        if (!(*m_gen)(mask)) {
+            m_good = false;
+            return false;
+        }
+        m_gen_next = idx + 1;
+        m_pos++;
+        return true;
+    }
+
+    bool operator()(uint64_t &size, size_t &width) override {
+        if (!m_good || m_pos == m_order.size()) {
+            return false;
+        }
+        size = m_sizes[m_order[m_pos]];
+        width = m_widths[m_order[m_pos]];
+        m_pos++;
+        return true;
+    }
+
+    void reset() override {
+        m_pos = 0;
+    }
+
+    bool seek(uint64_t mask_idx) override {
+        if (mask_idx > m_order.size()) {
+            return false;
+        }
+        m_pos = mask_idx;
+        return true;
+    }
+
+    bool good() override {
+        return m_good && m_gen->good();
+    }
+};
+
+}
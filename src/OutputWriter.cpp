@@ -0,0 +1,327 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include "OutputWriter.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+# include <sys/uio.h>
+# define MASKUNI_HAVE_VMSPLICE
+#endif
+
+namespace Maskuni {
+
+OutputWriter::OutputWriter(int fd, size_t buffer_size, bool splice, unsigned int n_buffers) :
+    m_fd(fd), m_buffer_size(std::max<size_t>(1, buffer_size)), m_splice(false), m_splice_failed(false),
+    m_buffers(), m_current(0), m_buffer(NULL),
+    m_async(n_buffers > 1), m_fill(0), m_thread(), m_mutex(), m_cv_pending(), m_cv_free(),
+    m_pending(), m_free(), m_spliced(), m_stop(false),
+    m_timed(false), m_bytes(0), m_stall(0), m_stall_since(0)
+{
+    size_t alignment = 0;
+#if defined(MASKUNI_HAVE_VMSPLICE)
+    struct stat st;
+    if (splice && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        long page_size = sysconf(_SC_PAGESIZE);
+        if (page_size <= 0) {
+            page_size = 4096;
+        }
+        // try to grow the pipe to the buffer size, the buffers must be at least as large as the pipe
+        fcntl(fd, F_SETPIPE_SZ, (int) std::min<size_t>(m_buffer_size, 1 << 30));
+        int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+        if (pipe_size > 0) {
+            m_buffer_size = std::max<size_t>(m_buffer_size, pipe_size);
+            m_buffer_size = (m_buffer_size + page_size - 1) / page_size * page_size;
+            m_splice = true;
+            alignment = page_size;
+        }
+    }
+#else
+    (void) splice;
+#endif
+    if (m_async) {
+        allocateBuffers(m_splice ? std::max(n_buffers, n_spliced_held + 2) : n_buffers, alignment);
+        m_buffer = m_buffers[0];
+        m_free.assign(m_buffers.begin() + 1, m_buffers.end());
+        m_thread = std::thread(&OutputWriter::writerLoop, this);
+    }
+    else {
+        allocateBuffers(m_splice ? n_splice_buffers : 1, alignment);
+        m_buffer = m_buffers[0];
+    }
+}
+
+OutputWriter::~OutputWriter()
+{
+    if (m_async) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_cv_pending.notify_one();
+        }
+        m_thread.join();
+    }
+    // the spliced buffers are left to the process exit, the pipe may still reference them
+    if (!m_splice) {
+        for (char *b : m_buffers) {
+            free(b);
+        }
+    }
+}
+
+void OutputWriter::allocateBuffers(unsigned int n, size_t alignment)
+{
+    for (unsigned int i = 0; i < n; i++) {
+        void *p = NULL;
+        if (alignment) {
+            if (posix_memalign(&p, alignment, m_buffer_size) != 0) {
+                p = NULL;
+            }
+        }
+        else {
+            p = malloc(m_buffer_size);
+        }
+        if (p == NULL) {
+            fprintf(stderr, "Error: can't allocate the output buffers\n");
+            exit(1);
+        }
+        m_buffers.push_back((char *) p);
+    }
+}
+
+/**
+ * @brief Get a monotonic time
+ *
+ * @return time in nanoseconds
+ */
+static uint64_t clockNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t OutputWriter::beginStall()
+{
+    uint64_t t = clockNs();
+    m_stall_since.store(t, std::memory_order_relaxed);
+    return t;
+}
+
+void OutputWriter::endStall(uint64_t since)
+{
+    m_stall_since.store(0, std::memory_order_relaxed);
+    m_stall.fetch_add(clockNs() - since, std::memory_order_relaxed);
+}
+
+uint64_t OutputWriter::getStallTime() const
+{
+    // include the current stall
+    uint64_t since = m_stall_since.load(std::memory_order_relaxed);
+    uint64_t stall = m_stall.load(std::memory_order_relaxed);
+    if (since) {
+        uint64_t t = clockNs();
+        stall += t > since ? t - since : 0;
+    }
+    return stall;
+}
+
+void OutputWriter::writeAll(const char *data, size_t len)
+{
+    while (len) {
+        ssize_t r = ::write(m_fd, data, len);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            fprintf(stderr, "Error while writing the output data: %m");
+            exit(1);
+        }
+        data += r;
+        len -= r;
+    }
+}
+
+bool OutputWriter::spliceAll(const char *data, size_t len)
+{
+#if defined(MASKUNI_HAVE_VMSPLICE)
+    while (len) {
+        struct iovec iov;
+        iov.iov_base = (void *) data;
+        iov.iov_len = len;
+        ssize_t r = vmsplice(m_fd, &iov, 1, 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            if (errno == EINVAL || errno == ENOSYS) {
+                // not supported for this pipe, write the rest
+                m_splice_failed.store(true, std::memory_order_relaxed);
+                writeAll(data, len);
+                return true;
+            }
+            fprintf(stderr, "Error while writing the output data: %m");
+            exit(1);
+        }
+        data += r;
+        len -= r;
+    }
+    return true;
+#else
+    (void) data;
+    (void) len;
+    return false;
+#endif
+}
+
+void OutputWriter::writerLoop()
+{
+    // the buffers must be held after being written, even after a fallback
+    const bool hold = m_splice;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cv_pending.wait(lock, [this]{ return !m_pending.empty() || m_stop; });
+        if (m_pending.empty()) {
+            return;
+        }
+        std::pair<char *, size_t> buffer = m_pending.front();
+        lock.unlock();
+
+        if (m_splice && !m_splice_failed.load(std::memory_order_relaxed)) {
+            spliceAll(buffer.first, buffer.second);
+        }
+        else {
+            writeAll(buffer.first, buffer.second);
+        }
+
+        lock.lock();
+        m_pending.pop_front();
+        if (hold) {
+            // the pipe may still reference the last spliced buffers, even after a fallback
+            m_spliced.push_back(buffer.first);
+            if (m_spliced.size() > n_spliced_held) {
+                m_free.push_back(m_spliced.front());
+                m_spliced.pop_front();
+            }
+        }
+        else {
+            m_free.push_back(buffer.first);
+        }
+        m_cv_free.notify_one();
+    }
+}
+
+void OutputWriter::commitAsync(size_t len)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_pending.push_back(std::make_pair(m_buffer, len));
+    m_cv_pending.notify_one();
+    // only the waits for a free buffer are output stalls
+    const bool timed = m_timed && m_free.empty();
+    uint64_t t = timed ? beginStall() : 0;
+    m_cv_free.wait(lock, [this]{ return !m_free.empty(); });
+    if (timed) {
+        endStall(t);
+    }
+    m_buffer = m_free.front();
+    m_free.pop_front();
+}
+
+void OutputWriter::commit(size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    m_bytes.fetch_add(len, std::memory_order_relaxed);
+    if (m_async) {
+        commitAsync(len);
+        return;
+    }
+    uint64_t t = m_timed ? beginStall() : 0;
+    if (m_buffers.size() > 1) {
+        // the buffers allocated for the splicing are kept in rotation even after a fallback,
+        // the pipe may still reference the previous ones
+        if (m_splice && !m_splice_failed.load(std::memory_order_relaxed)) {
+            spliceAll(m_buffer, len);
+        }
+        else {
+            writeAll(m_buffer, len);
+        }
+        m_current = (m_current + 1) % m_buffers.size();
+        m_buffer = m_buffers[m_current];
+    }
+    else {
+        writeAll(m_buffer, len);
+    }
+    if (m_timed) {
+        endStall(t);
+    }
+}
+
+void OutputWriter::write(const char *data, size_t len)
+{
+    m_bytes.fetch_add(len, std::memory_order_relaxed);
+    if (!m_async) {
+        uint64_t t = m_timed ? beginStall() : 0;
+        writeAll(data, len);
+        if (m_timed) {
+            endStall(t);
+        }
+        return;
+    }
+    while (len) {
+        size_t n = std::min(len, m_buffer_size - m_fill);
+        memcpy(m_buffer + m_fill, data, n);
+        m_fill += n;
+        data += n;
+        len -= n;
+        if (m_fill == m_buffer_size) {
+            m_fill = 0;
+            commitAsync(m_buffer_size);
+        }
+    }
+}
+
+void OutputWriter::flush()
+{
+    if (!m_async) {
+        return;
+    }
+    if (m_fill) {
+        size_t len = m_fill;
+        m_fill = 0;
+        commitAsync(len);
+    }
+    uint64_t t = m_timed ? beginStall() : 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv_free.wait(lock, [this]{ return m_pending.empty(); });
+    if (m_timed) {
+        endStall(t);
+    }
+}
+
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Maskuni {
+
+/**
+ * @brief Write the generated data to a file descriptor
+ *
+ * The writer owns an output buffer which can be filled in place then committed.
+ * External data can also be written directly.
+ *
+ * When the splicing is requested and the file descriptor is a pipe (Linux only),
+ * the committed buffers are given to the pipe with vmsplice instead of being copied by write.
+ * The kernel then references the pages of the buffer until the reader consumes them,
+ * so the writer rotates over 3 page aligned buffers at least as large as the pipe
+ * and each committed buffer must be at least half full (except the last one).
+ * The reader must copy the data (read), a reader which splices the pages further
+ * would see them modified.
+ *
+ * With a ring of several buffers, the committed buffers are written by a separate thread
+ * while the caller fills the next free buffer, the caller only waits when all the buffers
+ * are pending. When splicing, a buffer is kept out of the ring until two more buffers
+ * have been spliced after it (the ring has at least 4 buffers).
+ * The writer must be used by a single thread, only the counters may be read from other threads.
+ */
+class OutputWriter
+{
+    static constexpr unsigned int n_splice_buffers = 3;
+    static constexpr unsigned int n_spliced_held = 2;
+
+    int m_fd;                                   /*!< output file descriptor */
+    size_t m_buffer_size;                       /*!< size of each buffer */
+    bool m_splice;                              /*!< true if the buffers are spliced, only set by the constructor */
+    std::atomic<bool> m_splice_failed;          /*!< vmsplice isn't supported by the pipe, the buffers are written */
+    std::vector<char *> m_buffers;              /*!< all the buffers */
+    unsigned int m_current;                     /*!< index of the buffer returned by getBuffer (synchronous writer) */
+    char *m_buffer;                             /*!< buffer returned by getBuffer */
+
+    bool m_async;                               /*!< true if the buffers are written by m_thread */
+    size_t m_fill;                              /*!< bytes copied into m_buffer by write (asynchronous writer) */
+    std::thread m_thread;                       /*!< writer thread */
+    std::mutex m_mutex;                         /*!< protects the following members */
+    std::condition_variable m_cv_pending;       /*!< signaled when a buffer is committed or when the writer stops */
+    std::condition_variable m_cv_free;          /*!< signaled when a buffer has been written */
+    std::deque<std::pair<char *, size_t>> m_pending;    /*!< committed buffers, the front one is being written */
+    std::deque<char *> m_free;                  /*!< free buffers */
+    std::deque<char *> m_spliced;               /*!< buffers which may still be referenced by the pipe */
+    bool m_stop;                                /*!< true when the writer thread must stop */
+
+    bool m_timed;                               /*!< true to measure m_stall */
+    std::atomic<uint64_t> m_bytes;              /*!< number of bytes given to the writer */
+    std::atomic<uint64_t> m_stall;              /*!< nanoseconds spent by the caller waiting for the output */
+    std::atomic<uint64_t> m_stall_since;        /*!< start time of the current wait or 0 */
+
+    void writeAll(const char *data, size_t len);
+    bool spliceAll(const char *data, size_t len);
+    void allocateBuffers(unsigned int n, size_t alignment);
+    void writerLoop();
+    void commitAsync(size_t len);
+    uint64_t beginStall();
+    void endStall(uint64_t since);
+
+public:
+    /**
+     * @brief Create a writer
+     *
+     * @param fd output file descriptor, not closed by the writer
+     * @param buffer_size size of the buffer (may be increased to the pipe size for the splicing)
+     * @param splice true to use vmsplice if \a fd is a pipe
+     * @param n_buffers number of buffers written by a separate thread, 0 or 1 to write from the calling thread
+     */
+    OutputWriter(int fd, size_t buffer_size, bool splice, unsigned int n_buffers = 1);
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter &) = delete;
+    OutputWriter &operator=(const OutputWriter &) = delete;
+
+    /**
+     * @brief Test if the committed buffers are spliced
+     *
+     * The buffers keep the constraints of the splicing even if the pipe doesn't support vmsplice
+     * and the writer falls back to write.
+     *
+     * @return true if vmsplice is used
+     */
+    bool isSplicing() const
+    {
+        return m_splice;
+    }
+
+    /**
+     * @brief Measure the time spent waiting for the output by the caller
+     *
+     * The time spent in write system calls, or waiting for a free buffer of the ring,
+     * is then added to \a getStallTime
+     */
+    void setTimed()
+    {
+        m_timed = true;
+    }
+
+    /**
+     * @brief Get the number of bytes given to the writer, may be called from any thread
+     *
+     * @return bytes committed or written so far
+     */
+    uint64_t getBytes() const
+    {
+        return m_bytes.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Get the time spent waiting for the output, may be called from any thread
+     *
+     * @return nanoseconds including the current wait, always 0 without \a setTimed
+     */
+    uint64_t getStallTime() const;
+
+    /**
+     * @brief Get the buffer to fill before calling \a commit
+     *
+     * The buffer changes after each call to \a commit
+     *
+     * @return buffer of getBufferSize() bytes
+     */
+    char *getBuffer()
+    {
+        return m_buffer;
+    }
+
+    /**
+     * @brief Get the size of the buffer returned by \a getBuffer
+     *
+     * @return size in bytes
+     */
+    size_t getBufferSize() const
+    {
+        return m_buffer_size;
+    }
+
+    /**
+     * @brief Output the first \a len bytes of the current buffer and switch to the next buffer
+     *
+     * With a ring of buffers, wait for a free buffer and don't mix with \a write.
+     * Exit the program on error
+     *
+     * @param len number of bytes, at least getBufferSize() / 2 when splicing except for the last commit
+     */
+    void commit(size_t len);
+
+    /**
+     * @brief Output some data which doesn't come from \a getBuffer
+     *
+     * With a ring of buffers, the data is copied into the buffers.
+     * Exit the program on error
+     *
+     * @param data content
+     * @param len number of bytes
+     */
+    void write(const char *data, size_t len);
+
+    /**
+     * @brief Wait until all the data given to the writer is written
+     *
+     * Must be called before closing the file descriptor.
+     * Exit the program on error
+     */
+    void flush();
+};
+
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace Maskuni {
+
+/**
+ * @brief A pseudo-random bijection over [0, n) derived from a seed
+ *
+ * The values are permuted by a balanced Feistel network over the smallest even number
+ * of bits holding n - 1. The values of the network's domain which are not less than n
+ * are sent through the network again ("cycle walking") until they fall in [0, n),
+ * which takes less than 4 rounds of the network on average.
+ *
+ * This is not a cryptographic permutation, it only spreads the values over the range.
+ */
+class IndexPermutation
+{
+    static constexpr unsigned int n_rounds = 6;
+
+    uint64_t m_n;                   /*!< size of the range */
+    unsigned int m_half_bits;       /*!< number of bits of each half of the network */
+    uint64_t m_half_mask;           /*!< mask of the bits of a half */
+    uint64_t m_keys[n_rounds];      /*!< keys of the rounds */
+
+    static uint64_t splitmix64(uint64_t &state)
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDULL;
+        x ^= x >> 33;
+        x *= 0xC4CEB9FE1A85EC53ULL;
+        return x ^ (x >> 33);
+    }
+
+    uint64_t network(uint64_t x) const
+    {
+        uint64_t l = x >> m_half_bits;
+        uint64_t r = x & m_half_mask;
+        for (unsigned int i = 0; i < n_rounds; i++) {
+            uint64_t t = r;
+            r = (l ^ mix(r ^ m_keys[i])) & m_half_mask;
+            l = t;
+        }
+        return (l << m_half_bits) | r;
+    }
+
+public:
+    /**
+     * @brief Create the permutation
+     *
+     * @param n size of the range
+     * @param seed seed of the permutation, the same seed always gives the same permutation
+     */
+    IndexPermutation(uint64_t n, uint64_t seed) : m_n(n), m_half_bits(1), m_half_mask(1), m_keys()
+    {
+        // number of bits of n - 1
+        unsigned int bits = 0;
+        for (uint64_t v = n > 1 ? n - 1 : 0; v != 0; v >>= 1) {
+            bits++;
+        }
+        m_half_bits = bits < 2 ? 1 : (bits + 1) / 2;
+        m_half_mask = (1ULL << m_half_bits) - 1;
+        uint64_t state = seed;
+        for (unsigned int i = 0; i < n_rounds; i++) {
+            m_keys[i] = splitmix64(state);
+        }
+    }
+
+    /**
+     * @brief Get the image of a value
+     *
+     * @param i value in [0, n)
+     * @return the permuted value in [0, n)
+     */
+    uint64_t operator()(uint64_t i) const
+    {
+        if (m_n <= 1) {
+            return i;
+        }
+        do {
+            i = network(i);
+        } while (i >= m_n);
+        return i;
+    }
+};
+
+}
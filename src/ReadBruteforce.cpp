@@ -18,12 +18,15 @@
 
 #include "ReadBruteforce.h"
 #include "ExpandCharset.h"
+#include "CharsetPool.h"
+#include "overflow.h"
 #include "utf_conv.h"
 
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
 
+#include <algorithm>
 #include <memory>
 #include <list>
 #include <type_traits>
@@ -56,9 +59,10 @@ struct ConstrainedCharset {
      * @param charset must be already expanded
      * @param min minimum number of occurrences
      * @param max maximum number of occurrences
+     * @param pool pool sharing the identical charsets
      */
-    ConstrainedCharset(DefaultCharset<T> &charset, unsigned int min, unsigned int max) :
-        m_charset(charset.cset.data(), charset.cset.size()), m_min(min), m_max(max) {}
+    ConstrainedCharset(DefaultCharset<T> &charset, unsigned int min, unsigned int max, CharsetPool<T> &pool) :
+        m_charset(pool.get(charset.cset.data(), charset.cset.size())), m_min(min), m_max(max) {}
 };
 
 // Simon Tatham's style
@@ -77,102 +81,320 @@ struct ConstrainedCharset {
 #define crFinish } return false;
 
 /**
- * @brief 2nd stage of the mask generation
- * 
- * A generator which yields the masks satisfying a set of reduced constraints (words's width and exact number of occurrences for each charsets).
- * Must be called by \a FirstStageGen<T>
- * 
- * Note that de \a counts parameter is passed by reference and is used by this generator
- * At the end of the generation, \a counts is back in is initial state.
- * 
- * This generator is recursive
- * 
+ * @brief Move to the next valid combination of occurrences
+ *
+ * The number of occurrences of the first charset varies the fastest.
+ *
  * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ * @param counts number of occurrences for each charsets, must be a valid combination
+ * @param current_len sum of the occurrences
+ * @param target_len word's width
+ * @return false after the last combination
  */
 template<typename T>
-class SecondStageGen {
-    unsigned int state;
-    struct P {
-        // charsets with current remaining number of occurrences
-        // this reference is shared with the parent FirstStageGen and the recursive
-        // instances of SecondStateGen
-        std::vector<std::pair<const ConstrainedCharset<T> *, unsigned int>> &counts;
-        // words's width
-        unsigned int target_len;
-        // current mask in cooking shared with the recursive instances of SecondStateGen
-        // the ptr is allocated by the main constructor and copied by the 2nd
-        std::shared_ptr<std::vector<const ConstrainedCharset<T> *>> mask;
-    } params;
-    struct { // generator's pseudo stack
-        size_t i;
-        SecondStageGen<T> *ngen; // ngen is allocated on first use and kept until this is deleted
-    } vars;
+bool nextCombination(std::vector<std::pair<const ConstrainedCharset<T> *, unsigned int>> &counts, unsigned int &current_len, unsigned int target_len)
+{
+    while (true) {
+        // increment the combination
+        bool carry = true;
+        for (auto it = counts.begin(); it != counts.end() && carry; it++) {
+            it->second++;
+            current_len++;
+            if (it->second > it->first->m_max || current_len > target_len) {
+                // also skip some other invalid combinations
+                current_len -= it->second;
+                it->second = it->first->m_min;
+                current_len += it->second;
+                carry = true;
+            }
+            else {
+                carry = false;
+            }
+        }
+        if (carry) {
+            return false;
+        }
+
+        // skip a few invalid combinations
+        if (current_len < target_len) {
+            auto it = counts.begin();
+            unsigned int diff = std::min(target_len - current_len, it->first->m_max - it->second);
+            it->second += diff;
+            current_len += diff;
+        }
+        if (current_len == target_len) {
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief Move to the first valid combination of occurrences
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ * @param counts set to the number of occurrences for each charsets
+ * @param constraints constrained charsets
+ * @param current_len set to the sum of the occurrences
+ * @param target_len word's width
+ * @return false if there is no valid combination
+ */
+template<typename T>
+bool firstCombination(std::vector<std::pair<const ConstrainedCharset<T> *, unsigned int>> &counts,
+                      const std::vector<ConstrainedCharset<T>> &constraints, unsigned int &current_len, unsigned int target_len)
+{
+    // initialize the number of occurrences with the minimum allowed for each charsets
+    counts.resize(constraints.size());
+    current_len = 0;
+    for (size_t i = 0; i < constraints.size(); i++) {
+        if (constraints[i].m_min > constraints[i].m_max) {
+            return false;
+        }
+        counts[i].first = &constraints[i];
+        counts[i].second = constraints[i].m_min;
+        current_len += constraints[i].m_min;
+    }
+    if (counts.empty()) {
+        return false;
+    }
+    if (current_len < target_len) {
+        auto it = counts.begin();
+        unsigned int diff = std::min(target_len - current_len, it->first->m_max - it->second);
+        it->second += diff;
+        current_len += diff;
+    }
+    if (current_len == target_len) {
+        return true;
+    }
+    return nextCombination(counts, current_len, target_len);
+}
+
+/**
+ * @brief Count and locate the masks and the words of the valid combinations of occurrences
+ *
+ * The combinations are ordered as enumerated by \a nextCombination and the masks
+ * of a combination are its distinct permutations in lexicographic order (as std::next_permutation),
+ * which is the order of the generation.
+ *
+ * The counts are tabulated by dynamic programming over the charsets, for the charsets [0, i) filling r positions:
+ * - the number of sequences (masks), sum of the multinomial coefficients of the combinations
+ * - the number of words of these sequences, each combination contributing its multinomial coefficient
+ *   times the product of the powers of the charsets' lengths
+ *
+ * The counts saturate at UINT64_MAX.
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ */
+template<typename T>
+class CombinationCounter {
+    typedef std::vector<std::pair<const ConstrainedCharset<T> *, unsigned int>> Combination;
+
+    const std::vector<ConstrainedCharset<T>> &m_constraints; /*!< constrained charsets */
+    unsigned int m_target_len;              /*!< word's width */
+    size_t m_stride;                        /*!< m_target_len + 1 */
+    std::vector<uint64_t> m_sequences;      /*!< [i * m_stride + r] number of sequences of length r of the charsets [0, i) */
+    std::vector<uint64_t> m_words;          /*!< [i * m_stride + r] number of words of these sequences */
+    std::vector<uint64_t> m_powers;         /*!< [i * m_stride + v] length of the charset i to the power v */
+    std::vector<uint64_t> m_binomials;      /*!< [n * m_stride + k] binomial coefficients */
+
+    static uint64_t add(uint64_t a, uint64_t b)
+    {
+        uint64_t r;
+        return uadd64_overflow(a, b, &r) ? UINT64_MAX : r;
+    }
+    static uint64_t mul(uint64_t a, uint64_t b)
+    {
+        uint64_t r;
+        return umul64_overflow(a, b, &r) ? UINT64_MAX : r;
+    }
+    uint64_t binomial(unsigned int n, unsigned int k) const
+    {
+        return m_binomials[n * m_stride + k];
+    }
+    uint64_t power(size_t i, unsigned int v) const
+    {
+        return m_powers[i * m_stride + v];
+    }
 
 public:
-    SecondStageGen(
-            std::vector<std::pair<const ConstrainedCharset<T> *, unsigned int>> &counts,
-            unsigned int target_len) :
-            state(0),
-            params {counts,
-                    target_len,
-                    std::make_shared<typename decltype(params.mask)::element_type>()
-                    },
-            vars {0, NULL} {
-                params.mask->reserve(params.target_len);
+    CombinationCounter(const std::vector<ConstrainedCharset<T>> &constraints, unsigned int target_len) :
+        m_constraints(constraints), m_target_len(target_len), m_stride(target_len + 1),
+        m_sequences((constraints.size() + 1) * m_stride, 0),
+        m_words((constraints.size() + 1) * m_stride, 0),
+        m_powers(constraints.size() * m_stride, 0),
+        m_binomials(m_stride * m_stride, 0)
+    {
+        for (unsigned int n = 0; n <= m_target_len; n++) {
+            m_binomials[n * m_stride] = 1;
+            for (unsigned int k = 1; k <= n; k++) {
+                m_binomials[n * m_stride + k] = add(m_binomials[(n - 1) * m_stride + k - 1], m_binomials[(n - 1) * m_stride + k]);
             }
-    
-    // reset a generator by copying another, avoid some reallocations
-    // keep vars.ngen
-    void reset(const SecondStageGen &o) {
-        state = 0;
-        params.counts = o.params.counts;
-        params.target_len = o.params.target_len;
-        params.mask = o.params.mask;
-        vars.i = 0;
+        }
+        for (size_t i = 0; i < m_constraints.size(); i++) {
+            m_powers[i * m_stride] = 1;
+            for (unsigned int v = 1; v <= m_target_len; v++) {
+                m_powers[i * m_stride + v] = mul(m_powers[i * m_stride + v - 1], m_constraints[i].m_charset.getLen());
+            }
+        }
+        m_sequences[0] = 1;
+        m_words[0] = 1;
+        for (size_t i = 0; i < m_constraints.size(); i++) {
+            const ConstrainedCharset<T> &c = m_constraints[i];
+            for (unsigned int r = 0; r <= m_target_len; r++) {
+                uint64_t sequences = 0, words = 0;
+                for (unsigned int v = c.m_min; v <= std::min(c.m_max, r); v++) {
+                    uint64_t placed = binomial(r, v);
+                    sequences = add(sequences, mul(placed, m_sequences[i * m_stride + r - v]));
+                    words = add(words, mul(mul(placed, power(i, v)), m_words[i * m_stride + r - v]));
+                }
+                m_sequences[(i + 1) * m_stride + r] = sequences;
+                m_words[(i + 1) * m_stride + r] = words;
+            }
+        }
     }
-    
-    // reset a generator with the constructor arguments, avoid some reallocations
-    // keep vars.ngen and reset params.mask
-    void reset(std::vector<std::pair<const ConstrainedCharset<T> *, unsigned int>> &counts, unsigned int target_len) {
-        state = 0;
-        params.counts = counts;
-        params.target_len = target_len;
-        params.mask->clear();
-        vars.i = 0;
+
+    /**
+     * @brief Get the total number of masks
+     *
+     * @return number of masks, UINT64_MAX on overflow
+     */
+    uint64_t getMasksCount() const
+    {
+        return m_sequences[m_constraints.size() * m_stride + m_target_len];
     }
-    
-    ~SecondStageGen() {
-        delete vars.ngen;
+
+    /**
+     * @brief Get the total number of words
+     *
+     * @return number of words, UINT64_MAX on overflow
+     */
+    uint64_t getWordsCount() const
+    {
+        // the masks of width 0 have no word
+        return m_target_len == 0 ? 0 : m_words[m_constraints.size() * m_stride + m_target_len];
     }
 
-    bool operator()(const std::vector<const ConstrainedCharset<T> *> ** mask_out) {
-        crBegin
-        if (params.mask->size() == params.target_len) {
-            // done cooking!
-            *mask_out = params.mask.get();
-            crReturn
+    /**
+     * @brief Get the number of words of each mask of a combination
+     *
+     * @param counts number of occurrences for each charsets
+     * @return product of the powers of the charsets' lengths
+     */
+    uint64_t getMaskLen(const Combination &counts) const
+    {
+        uint64_t len = m_target_len == 0 ? 0 : 1;
+        for (size_t i = 0; i < counts.size(); i++) {
+            len = mul(len, power(i, counts[i].second));
         }
-        else {
-            for (vars.i = 0; vars.i < params.counts.size(); vars.i++) {
-                if (params.counts[vars.i].second > 0) {
-                    params.counts[vars.i].second--;
-                    params.mask->push_back(params.counts[vars.i].first);
-                    if (vars.ngen == NULL) {
-                        vars.ngen = new SecondStageGen(*this);
-                    }
-                    else {
-                        vars.ngen->reset(*this);
-                    }
-                    while ((*vars.ngen)(mask_out)) {
-                        // climb back up
-                        crReturn
-                    }
-                    params.counts[vars.i].second++;
-                    params.mask->pop_back();
+        return len;
+    }
+
+    /**
+     * @brief Get the number of distinct permutations of a multiset
+     *
+     * @param counts number of occurrences for each charsets
+     * @param len sum of the occurrences
+     * @return multinomial coefficient, UINT64_MAX on overflow
+     */
+    uint64_t getPermutationsCount(const std::vector<unsigned int> &counts, unsigned int len) const
+    {
+        uint64_t perms = 1;
+        for (unsigned int c : counts) {
+            perms = mul(perms, binomial(len, c));
+            len -= c;
+        }
+        return perms;
+    }
+
+    /**
+     * @brief Find the combination holding a mask or a word
+     *
+     * @param idx position of the mask, or of the word if \a by_word
+     * @param by_word true if \a idx is the position of a word
+     * @param counts set to the combination
+     * @param masks_before set to the number of masks before the combination
+     * @param words_before set to the number of words before the combination
+     * @return false if \a idx is out of range
+     */
+    bool locate(uint64_t idx, bool by_word, Combination &counts, uint64_t &masks_before, uint64_t &words_before) const
+    {
+        const size_t n = m_constraints.size();
+        masks_before = 0;
+        words_before = 0;
+        if (n == 0 || idx >= (by_word ? getWordsCount() : getMasksCount())) {
+            return false;
+        }
+        counts.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            counts[i].first = &m_constraints[i];
+        }
+        // choose the number of occurrences from the last charset, which varies the slowest
+        unsigned int rem = m_target_len;
+        uint64_t arrangements = 1; // ways to place the charsets already chosen
+        uint64_t len = 1; // product of the powers of the lengths of the charsets already chosen
+        for (size_t i = n - 1; i > 0; i--) {
+            const ConstrainedCharset<T> &c = m_constraints[i];
+            bool found = false;
+            for (unsigned int v = c.m_min; v <= std::min(c.m_max, rem); v++) {
+                uint64_t sequences = m_sequences[i * m_stride + rem - v];
+                if (sequences == 0) {
+                    continue;
+                }
+                uint64_t placed = mul(arrangements, binomial(rem, v));
+                uint64_t prefix_len = mul(len, power(i, v));
+                uint64_t masks = mul(placed, sequences);
+                uint64_t words = mul(mul(placed, prefix_len), m_words[i * m_stride + rem - v]);
+                uint64_t weight = by_word ? words : masks;
+                if (idx < weight) {
+                    counts[i].second = v;
+                    arrangements = placed;
+                    len = prefix_len;
+                    rem -= v;
+                    found = true;
+                    break;
                 }
+                idx -= weight;
+                masks_before = add(masks_before, masks);
+                words_before = add(words_before, words);
+            }
+            if (!found) {
+                return false;
+            }
+        }
+        // the first charset takes the remaining positions
+        counts[0].second = rem;
+        return true;
+    }
+
+    /**
+     * @brief Build a mask of a combination from its position
+     *
+     * @param counts combination
+     * @param k position of the mask among the distinct permutations of the combination
+     * @param mask set to the mask
+     */
+    void unrankMask(const Combination &counts, uint64_t k, std::vector<const ConstrainedCharset<T> *> &mask) const
+    {
+        std::vector<unsigned int> rem_counts(counts.size());
+        for (size_t i = 0; i < counts.size(); i++) {
+            rem_counts[i] = counts[i].second;
+        }
+        mask.clear();
+        for (unsigned int rem = m_target_len; rem > 0; rem--) {
+            // the permutations are grouped by their first charset
+            for (size_t i = 0; i < rem_counts.size(); i++) {
+                if (rem_counts[i] == 0) {
+                    continue;
+                }
+                rem_counts[i]--;
+                uint64_t perms = getPermutationsCount(rem_counts, rem - 1);
+                if (k < perms) {
+                    mask.push_back(counts[i].first);
+                    break;
+                }
+                k -= perms;
+                rem_counts[i]++;
             }
         }
-        crFinish
     }
 };
 
@@ -191,7 +413,10 @@ public:
  *   ?d*5, ?l*1
  *   ?d*6, ?l*0
  *
- * For each of those valid constraints, use a \a SecondStageGen to get the associated masks
+ * For each of those valid constraints, the masks are the distinct permutations
+ * of the charsets, visited in lexicographic order with std::next_permutation
+ * 
+ * The generation can start from any mask (see \a CombinationCounter).
  * 
  * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
  */
@@ -201,77 +426,53 @@ class FirstStageGen {
     struct {
         const std::vector<ConstrainedCharset<T>> &constraints; // constained charsets
         unsigned int target_len; // word's width
+        std::vector<std::pair<const ConstrainedCharset<T> *, unsigned int>> first; // first combination, empty to start from the beginning
+        std::vector<const ConstrainedCharset<T> *> first_mask; // first mask of the first combination, empty to start from its first mask
     } params;
     struct {
         std::vector<std::pair<const ConstrainedCharset<T> *, unsigned int>> counts; // number of occurrences for each charsets
         unsigned int current_len; // current word's width
-        SecondStageGen<T> *gen2; // will be allocated on first use and kept until this is deleted
+        bool valid; // true while counts is a valid combination
+        std::vector<const ConstrainedCharset<T> *> mask; // current mask
     } vars;
 
 public:
-    FirstStageGen(const std::vector<ConstrainedCharset<T>> &constraints, unsigned int target_len):
-        state(0), params {constraints, target_len}, vars{{}, 0, NULL} {}
-        
-    ~FirstStageGen() {
-        delete vars.gen2;
-    }
+    FirstStageGen(const std::vector<ConstrainedCharset<T>> &constraints, unsigned int target_len,
+                  const std::vector<std::pair<const ConstrainedCharset<T> *, unsigned int>> &first = {},
+                  const std::vector<const ConstrainedCharset<T> *> &first_mask = {}):
+        state(0), params {constraints, target_len, first, first_mask}, vars{{}, 0, false, {}} {}
 
     // the returned pointer is valid until the next call and should not be modified
     bool operator()(const std::vector<const ConstrainedCharset<T> *> ** mask_out) {
         crBegin
 
-        // initialize the number of occurrences with the minimum allowed for each charsets
-        vars.counts.resize(params.constraints.size());
-        vars.current_len = 0;
-        for (size_t i = 0; i < params.constraints.size(); i++) {
-            vars.counts[i].first = &params.constraints[i];
-            vars.counts[i].second = params.constraints[i].m_min;
-            vars.current_len += params.constraints[i].m_min;
-        }
-
-        while (true) {
-            // skip a few invalid combinations
-            if (vars.current_len < params.target_len) {
-                auto it = vars.counts.begin();
-                unsigned int diff = std::min(params.target_len - vars.current_len, it->first->m_max - it->second);
-                it->second += diff;
-                vars.current_len += diff;
-            }
+        if (params.first.empty()) {
+            vars.valid = firstCombination(vars.counts, params.constraints, vars.current_len, params.target_len);
+        }
+        else {
+            vars.counts = params.first;
+            vars.current_len = params.target_len;
+            vars.valid = true;
+        }
 
-            // this combination is valid
-            if (vars.current_len == params.target_len) {
-                // use the 2nd generator to generate its masks
-                // and yield them
-                if (vars.gen2 == NULL) {
-                    vars.gen2 = new SecondStageGen<T>(vars.counts, params.target_len);
-                }
-                else {
-                    vars.gen2->reset(vars.counts, params.target_len);
-                }
-                while ((*vars.gen2)(mask_out)) {
-                    crReturn
-                }
+        while (vars.valid) {
+            if (!params.first_mask.empty()) {
+                vars.mask.swap(params.first_mask);
+                params.first_mask.clear();
             }
-
-            // increment the combination
-            bool carry = true;
-            for (auto it = vars.counts.begin(); it != vars.counts.end() && carry; it++) {
-                it->second++;
-                vars.current_len++;
-                if (it->second > it->first->m_max || vars.current_len > params.target_len) {
-                    // also skip some other invalid combinations
-                    vars.current_len -= it->second;
-                    it->second = it->first->m_min;
-                    vars.current_len += it->second;
-                    carry = true;
+            else {
+                // first permutation, the charsets are sorted by their position in the constraints
+                vars.mask.clear();
+                for (auto &c : vars.counts) {
+                    vars.mask.insert(vars.mask.end(), c.second, c.first);
                 }
-                else {
-                    carry = false;
-                }
-            }
-            if (carry) {
-                break;
             }
+            do {
+                *mask_out = &vars.mask;
+                crReturn
+            } while (std::next_permutation(vars.mask.begin(), vars.mask.end()));
+
+            vars.valid = nextCombination(vars.counts, vars.current_len, params.target_len);
         }
 
         *mask_out = NULL;
@@ -288,19 +489,37 @@ public:
  * 
  * It's a wrapper over \a FirstStageGen<T>
  * 
+ * The words are counted in closed form by \a CombinationCounter<T>
+ * and any mask or word can be reached without enumerating the masks before it.
+ * 
  * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
  */
 template<typename T>
 class BruteforceGenerator : public MaskGenerator<T>
 {
+    typedef std::vector<std::pair<const ConstrainedCharset<T> *, unsigned int>> Combination;
+
     const std::vector<ConstrainedCharset<T>> m_constraints; /*!< input data */
     unsigned int m_target_len; /*!< bruteforce width */
+    CombinationCounter<T> m_counter; /*!< counts of the masks and words */
     FirstStageGen<T> *m_gen; /*!< The actual generator */
     bool m_done; /*!< flag */
     
+    /**
+     * @brief Restart the generation at the mask \a k of the combination \a counts
+     */
+    void start(const Combination &counts, uint64_t k) {
+        std::vector<const ConstrainedCharset<T> *> mask;
+        m_counter.unrankMask(counts, k, mask);
+        delete m_gen;
+        m_gen = new FirstStageGen<T>(m_constraints, m_target_len, counts, mask);
+        m_done = false;
+    }
+    
 public:
     BruteforceGenerator(const std::vector<ConstrainedCharset<T>> &constraints, unsigned int target_len) :
     m_constraints(constraints), m_target_len(target_len),
+    m_counter(m_constraints, m_target_len),
     m_gen(new FirstStageGen<T>(m_constraints, m_target_len)),
     m_done(false)
     {}
@@ -357,6 +576,51 @@ public:
         m_done = false;
     }
     
+    bool seek(uint64_t mask_idx) override {
+        uint64_t n_masks = m_counter.getMasksCount();
+        if (n_masks == UINT64_MAX) {
+            return MaskGenerator<T>::seek(mask_idx);
+        }
+        if (mask_idx >= n_masks) {
+            reset();
+            m_done = true;
+            return mask_idx == n_masks;
+        }
+        Combination counts;
+        uint64_t masks_before = 0, words_before = 0;
+        if (!m_counter.locate(mask_idx, false, counts, masks_before, words_before)) {
+            return false;
+        }
+        start(counts, mask_idx - masks_before);
+        return true;
+    }
+    
+    bool countWords(uint64_t &len, size_t &max_width) override {
+        len = m_counter.getWordsCount();
+        if (len == UINT64_MAX) {
+            fprintf(stderr, "Error: the total number of words would overflow a 64 bits integer\n");
+            abort();
+        }
+        if (m_counter.getMasksCount() != 0) {
+            max_width = std::max<size_t>(max_width, m_target_len);
+        }
+        return true;
+    }
+    
+    bool seekWord(uint64_t word_idx, uint64_t &offset) override {
+        Combination counts;
+        uint64_t masks_before = 0, words_before = 0;
+        if (!m_counter.locate(word_idx, true, counts, masks_before, words_before)) {
+            return false;
+        }
+        // all the masks of a combination have the same length
+        uint64_t mask_len = m_counter.getMaskLen(counts);
+        uint64_t idx = word_idx - words_before;
+        start(counts, idx / mask_len);
+        offset = idx % mask_len;
+        return true;
+    }
+    
     bool good() override {
         return true; // we don't do errors here. 
     }
@@ -430,6 +694,7 @@ MaskGenerator<T> *readBruteforce(const char *spec, const CharsetMap<T> &charsets
 
     // the first objective is to build this list describing the constraints read from the file
     std::list<ConstrainedCharset<T>> constrained_charsets;
+    CharsetPool<T> pool;
 
     while ((r = getline(&line, &line_size, f))!= -1) {
         line_number++;
@@ -464,6 +729,13 @@ MaskGenerator<T> *readBruteforce(const char *spec, const CharsetMap<T> &charsets
                 return NULL;
             }
 
+            if (min_len > max_len) {
+                fprintf(stderr, "Error: the minimum number of occurrences is greater than the maximum in '%s' at line '%u'\n", spec, line_number);
+                fclose(f);
+                free(line);
+                return NULL;
+            }
+
             DefaultCharset<T> new_charset;
             new_charset.final = false;
 
@@ -494,7 +766,7 @@ MaskGenerator<T> *readBruteforce(const char *spec, const CharsetMap<T> &charsets
             if (max_len > mask_len) {
                 max_len = mask_len;
             }
-            constrained_charsets.emplace_back(new_charset, min_len, max_len);
+            constrained_charsets.emplace_back(new_charset, min_len, max_len, pool);
         }
     }
     
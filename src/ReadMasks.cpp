@@ -18,12 +18,17 @@
 
 #include "ReadMasks.h"
 #include "ExpandCharset.h"
+#include "CharsetPool.h"
 #include "utf_conv.h"
 
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
 
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -35,24 +40,62 @@
 
 namespace Maskuni {
 
+/* FNV-1a hash of the inline charsets of a line */
+template<typename T>
+struct InlineCharsetsHash {
+    size_t operator()(const std::vector<T> &key) const {
+        uint64_t h = 14695981039346656037ULL;
+        for (T c : key) {
+            h ^= (uint64_t) c;
+            h *= 1099511628211ULL;
+        }
+        return (size_t) h;
+    }
+};
+
+/* buffers reused from one line to the other to avoid the allocations while parsing */
+template<typename T>
+struct MaskParserBuffers {
+    std::vector<std::vector<T>> tokens;             /*!< tokens of the line, only the first n_tokens are used */
+    size_t n_tokens;                                /*!< number of tokens of the current line */
+    std::vector<std::pair<const T *, size_t>> sets; /*!< charsets of the mask being built */
+    CharsetPool<T> pool;                            /*!< charsets shared by all the masks */
+    std::vector<T> inline_key;                      /*!< raw inline charsets of the current line, each after its length */
+    /*! expanded inline charsets by raw inline charsets, the predefined charsets of a generator never change */
+    std::unordered_map<std::vector<T>, std::vector<std::vector<T>>, InlineCharsetsHash<T>> inline_cache;
+    static constexpr size_t max_inline_cache = 4096;
+    
+    MaskParserBuffers() : tokens(), n_tokens(0), sets(), pool(), inline_key(), inline_cache() {}
+};
+
 /* create a mask from a string and all the defined charsets
  * Return an empty mask if there was an error (undefined charset)
  * 
+ * The charsets are taken from the pool of \a buffers so that the identical charsets share their characters
+ * The \a n_inline expanded inline charsets of a mask file line, named '1' to '9', take precedence over \a defined_charsets
+ * 
  * note that T('?') is valid for unicode as the codepoint of ASCII character is their value
  */
 template<typename T, T escapeChar = T('?')>
-bool readMask(const std::vector<T> &str, const CharsetMap<T> &defined_charsets, Mask<T> &mask) {
-    for (size_t i = 0; i < str.size();) {
-        if (str[i] == escapeChar && i + 1 < str.size()) {
+bool readMask(const T *str, size_t str_len, const CharsetMap<T> &defined_charsets, Mask<T> &mask, MaskParserBuffers<T> &buffers,
+              const std::vector<T> *inline_charsets = NULL, size_t n_inline = 0) {
+    auto &sets = buffers.sets;
+    sets.clear();
+    for (size_t i = 0; i < str_len;) {
+        if (str[i] == escapeChar && i + 1 < str_len) {
             T key = str[i+1];
             if (key == escapeChar) {
-                mask.push_charset_right(&(str[i]), 1);
+                sets.emplace_back(&(str[i]), 1);
+            }
+            else if (key >= T('1') && (size_t) (key - T('1')) < n_inline) {
+                const std::vector<T> &cset = inline_charsets[key - T('1')];
+                sets.emplace_back(cset.data(), cset.size());
             }
             else {
                 auto it_range = defined_charsets.equal_range(key);
                 if (it_range.first != it_range.second) {
                     auto it_charset = std::prev(it_range.second);
-                    mask.push_charset_right(it_charset->second.cset.data(), it_charset->second.cset.size());
+                    sets.emplace_back(it_charset->second.cset.data(), it_charset->second.cset.size());
                 }
                 else {
                     if (std::is_same<T, char>::value) {
@@ -70,80 +113,134 @@ bool readMask(const std::vector<T> &str, const CharsetMap<T> &defined_charsets,
             i += 2;
         }
         else {
-            mask.push_charset_right(&(str[i]), 1);
+            sets.emplace_back(&(str[i]), 1);
             i++;
         }
     }
     
+    for (const auto &set : sets) {
+        mask.push_charset_right(buffers.pool.get(set.first, set.second));
+    }
+    
     return true;
 }
 
 /* Read a line from a mask file
+ * 
+ * The inline charsets are pushed into \a charsets while reading the line and are removed before returning
  * 
  * note that T('?') and T(',') are valid for unicode as the codepoint of ASCII character is their value
  */
 template<typename T, T charsetEscapeChar = T('?'), T lineEscapeChar = ('\\'), T separatorChar = T(','), T commentChar = T('#')>
-static bool readMaskLine(const T *line, size_t line_len, const CharsetMap<T> &charsets, Mask<T> &mask) {
-    CharsetMap<T> effective_charsets = charsets;
-                
-    std::vector<std::vector<T>> tokens;
-    tokens.resize(1);
-    
+static bool readMaskLine(const T *line, size_t line_len, CharsetMap<T> &charsets, Mask<T> &mask, MaskParserBuffers<T> &buffers) {
     // remove commented and empty lines
     if (line_len == 0 || line[0] == commentChar) {
         return true;
     }
     
+    auto &tokens = buffers.tokens;
+    size_t &n_tokens = buffers.n_tokens;
+    n_tokens = 1;
+    if (tokens.empty()) {
+        tokens.resize(1);
+    }
+    tokens[0].clear();
+    
     // split the line on ,
     for (size_t i = 0; i < line_len; ) {
         T c = line[i];
         // escaped characters
         if (c == lineEscapeChar && i + 1 < line_len ) {
-            tokens.back().push_back(line[i+1]);
+            tokens[n_tokens - 1].push_back(line[i+1]);
             i += 2;
         }
         else if (c == separatorChar) { // an unescaped ,
             // finish this token and skip the ,
-            tokens.resize(tokens.size() + 1);
+            n_tokens++;
+            if (tokens.size() < n_tokens) {
+                tokens.resize(n_tokens);
+            }
+            tokens[n_tokens - 1].clear();
             i++;
         }
         else {
-            tokens.back().push_back(c);
+            tokens[n_tokens - 1].push_back(c);
             i++;
         }
     }
     
     // we won't name a charset with 2 digits...
-    if (tokens.size() > 10) {
+    if (n_tokens > 10) {
         fprintf(stderr, "Error: too many custom charsets defined (max: 9)\n");
         return false;
     }
     
-    // create the user defined charsets without expanding them
-    for (size_t n = 0; n + 1 < tokens.size(); n++) {
+    // the expansion of the inline charsets only depends on their raw definitions
+    auto &key = buffers.inline_key;
+    key.clear();
+    for (size_t n = 0; n + 1 < n_tokens; n++) {
         if (tokens[n].size() == 0) {
             fprintf(stderr, "Error: empty custom charset\n");
             return false;
         }
-        T charset_key = T('1' + n);
-        typename decltype(effective_charsets)::mapped_type new_charset;
-        new_charset.cset = tokens[n];
-        new_charset.final = false;
-        effective_charsets.insert(std::make_pair(charset_key, new_charset));
+        for (size_t i = 0; i < sizeof(size_t); i += sizeof(T)) {
+            key.push_back(T(tokens[n].size() >> (8 * i)));
+        }
+        key.insert(key.end(), tokens[n].begin(), tokens[n].end());
     }
     
-    // now expand all the user defined charsets
-    // expandCharset checks for recursive charset definitions so we can safely expand all the user defined charsets
-    for (size_t n = 0; n + 1 < tokens.size(); n++) {
-        T charset_key = T('1' + n);
-        if (!expandCharset<T, charsetEscapeChar>(effective_charsets, charset_key)) {
-            fprintf(stderr, "Error while reading the inline custom charset '%c'\n", (int) charset_key);
-            return false;
+    const std::vector<std::vector<T>> *expanded = NULL;
+    if (n_tokens > 1) {
+        auto it_cached = buffers.inline_cache.find(key);
+        if (it_cached != buffers.inline_cache.end()) {
+            expanded = &it_cached->second;
         }
     }
+    if (n_tokens > 1 && !expanded) {
+        // the inline charsets override the predefined charsets only for this line
+        struct Overlay {
+            CharsetMap<T> &map;
+            typename CharsetMap<T>::iterator inserted[9];
+            size_t n_inserted;
+            
+            ~Overlay() {
+                while (n_inserted) {
+                    map.erase(inserted[--n_inserted]);
+                }
+            }
+        } overlay = {charsets, {}, 0};
+        
+        // create the user defined charsets without expanding them
+        for (size_t n = 0; n + 1 < n_tokens; n++) {
+            T charset_key = T('1' + n);
+            // a multimap inserts after the existing definitions of the same key
+            overlay.inserted[overlay.n_inserted++] = charsets.insert(std::make_pair(charset_key, DefaultCharset<T>(tokens[n], false)));
+        }
+        
+        // now expand all the user defined charsets
+        // expandCharset checks for recursive charset definitions so we can safely expand all the user defined charsets
+        for (size_t n = 0; n + 1 < n_tokens; n++) {
+            T charset_key = T('1' + n);
+            if (!expandCharset<T, charsetEscapeChar>(charsets, charset_key)) {
+                fprintf(stderr, "Error while reading the inline custom charset '%c'\n", (int) charset_key);
+                return false;
+            }
+        }
+        
+        if (buffers.inline_cache.size() >= buffers.max_inline_cache) {
+            buffers.inline_cache.clear();
+        }
+        auto &entry = buffers.inline_cache[key];
+        for (size_t n = 0; n < overlay.n_inserted; n++) {
+            entry.push_back(overlay.inserted[n]->second.cset);
+        }
+        expanded = &entry;
+    }
     
     mask.clear();
-    readMask<T, charsetEscapeChar>(tokens.back(), effective_charsets, mask);
+    const std::vector<T> &mask_token = tokens[n_tokens - 1];
+    readMask<T, charsetEscapeChar>(mask_token.data(), mask_token.size(), charsets, mask, buffers,
+                                   expanded ? expanded->data() : NULL, n_tokens - 1);
     if (mask.getWidth() == 0) {
         return false;
     }
@@ -164,10 +261,25 @@ class MaskFileGenerator : public MaskGenerator<T>
     const size_t m_content_len; /*!< file content length */
     bool m_command_line_mask;   /*!< true if content is a command line argument and not the content of a file */
     char *m_filename;           /*!< name of the file for error messages */
-    const CharsetMap<T> m_charsets; /*<! predefined charsets */
+    CharsetMap<T> m_charsets;   /*<! predefined charsets, the inline charsets of a line are pushed then removed */
+    MaskParserBuffers<T> m_buffers; /*!< parsing buffers */
+    uint32_t *m_conv_buf;       /*!< UTF-8 decoding buffer for the unicode version */
+    size_t m_conv_buf_size;     /*!< size of m_conv_buf */
     const char *m_p;            /*!< read pointer in m_content */
     unsigned int m_line_number; /*!< number of line read for error messages */
     bool m_error;               /*!< error flag */
+    uint64_t m_mask_idx;        /*!< index of the next mask */
+    std::vector<std::pair<size_t, unsigned int>> m_samples; /*!< position and line number of the masks m_samples_interval * i */
+    static constexpr uint64_t m_samples_interval = 256;
+    
+    /**
+     * @brief record the position of the next mask if it's the first time it's reached
+     */
+    void recordPosition() {
+        if (m_mask_idx % m_samples_interval == 0 && m_mask_idx / m_samples_interval == m_samples.size()) {
+            m_samples.emplace_back(m_p - m_content, m_line_number);
+        }
+    }
     
     
     /**
@@ -211,11 +323,14 @@ public:
      */
     MaskFileGenerator(char *content, size_t content_len, bool command_line_mask, const char *filename, const CharsetMap<T> &charsets) :
     m_content(content), m_content_len(content_len), m_command_line_mask(command_line_mask),
-    m_filename(strdup(filename)), m_charsets(charsets), m_p(m_content), m_line_number(0), m_error(false) {}
+    m_filename(strdup(filename)), m_charsets(charsets), m_buffers(), m_conv_buf(NULL), m_conv_buf_size(0),
+    m_p(m_content), m_line_number(0), m_error(false),
+    m_mask_idx(0), m_samples() {}
     
     ~MaskFileGenerator() {
         free(m_content);
         free(m_filename);
+        free(m_conv_buf);
     }
     
     bool operator()(Maskuni::Mask<T> &mask);
@@ -224,6 +339,45 @@ public:
         m_p = m_content;
         m_line_number = 0;
         m_error = false;
+        m_mask_idx = 0;
+    }
+    
+    // jump to the closest recorded position (or to the start) then skip the lines without parsing them
+    bool seek(uint64_t mask_idx) {
+        if (m_command_line_mask) {
+            return MaskGenerator<T>::seek(mask_idx);
+        }
+        if (m_samples.empty()) {
+            reset();
+        }
+        else {
+            uint64_t sample = std::min<uint64_t>(mask_idx / m_samples_interval, m_samples.size() - 1);
+            m_p = m_content + m_samples[sample].first;
+            m_line_number = m_samples[sample].second;
+            m_mask_idx = sample * m_samples_interval;
+            m_error = false;
+        }
+        
+        const char *line;
+        size_t r;
+        while (m_mask_idx < mask_idx) {
+            recordPosition();
+            if (!readline(&line, &r)) {
+                return false;
+            }
+            m_line_number++;
+            // same rules as the generation methods for the empty lines
+            if (r >= 2 && line[r - 1] == '\n' && line[r - 2] == '\r') {
+                r -= 2;
+            }
+            else if (r >= 1 && line[r - 1] == '\n') {
+                r -= 1;
+            }
+            if (r != 0) {
+                m_mask_idx++;
+            }
+        }
+        return true;
     }
     
     bool good() {
@@ -235,6 +389,7 @@ public:
 template<> bool MaskFileGenerator<char>::operator()(Maskuni::Mask<char> &mask) {
     const char *line;
     size_t r;
+    recordPosition();
     while (true) {
         if (!readline(&line, &r)) {
             return false;
@@ -253,18 +408,20 @@ template<> bool MaskFileGenerator<char>::operator()(Maskuni::Mask<char> &mask) {
         
         mask.clear();
         if (m_command_line_mask) {
-            readMask<char>({m_content, m_content + m_content_len}, m_charsets, mask);
+            readMask<char>(m_content, m_content_len, m_charsets, mask, m_buffers);
             if (mask.getWidth() == 0) {
                 m_error = true;
                 return false;
             }
             else {
+                m_mask_idx++;
                 return true;
             }
         }
         else {
             // full parser when reading from a file
-            if (readMaskLine<char>(line, r, m_charsets, mask)) {
+            if (readMaskLine<char>(line, r, m_charsets, mask, m_buffers)) {
+                m_mask_idx++;
                 return true;
             }
             m_error = true;
@@ -280,12 +437,10 @@ template<> bool MaskFileGenerator<char>::operator()(Maskuni::Mask<char> &mask) {
 template<> bool MaskFileGenerator<uint32_t>::operator()(Maskuni::Mask<uint32_t> &mask) {
     const char *line;
     size_t r;
-    uint32_t *conv_buf = NULL;
-    size_t conv_buf_size = 0;
     size_t conv_consumed = 0, conv_written = 0;
+    recordPosition();
     while (true) {
         if (!readline(&line, &r)) {
-            free(conv_buf);
             return false;
         }
         m_line_number++;
@@ -300,7 +455,7 @@ template<> bool MaskFileGenerator<uint32_t>::operator()(Maskuni::Mask<uint32_t>
             continue;
         }
         
-        UTF::decode_utf8(line, r, &conv_buf, &conv_buf_size, &conv_consumed, &conv_written);
+        UTF::decode_utf8(line, r, &m_conv_buf, &m_conv_buf_size, &conv_consumed, &conv_written);
         if (conv_consumed != (size_t) r) {
             if (m_command_line_mask) {
                 fprintf(stderr, "Error: the mask argument '%s' contains invalid UTF-8 chars\n", m_filename);
@@ -308,32 +463,30 @@ template<> bool MaskFileGenerator<uint32_t>::operator()(Maskuni::Mask<uint32_t>
             else {
                 fprintf(stderr, "Error: the mask file '%s' contains invalid UTF-8 chars at line %u\n", m_filename, m_line_number);
             }
-            free(conv_buf);
             m_error = true;
             return false;
         }
         
         mask.clear();
         if (m_command_line_mask) {
-            readMask<uint32_t>({conv_buf, conv_buf + conv_written}, m_charsets, mask);
-            free(conv_buf);
+            readMask<uint32_t>(m_conv_buf, conv_written, m_charsets, mask, m_buffers);
             if (mask.getWidth() == 0) {
                 m_error = true;
                 return false;
             }
             else {
+                m_mask_idx++;
                 return true;
             }
         }
         else {
             // full parser when reading from a file
-            if (readMaskLine<uint32_t>(conv_buf, conv_written, m_charsets, mask)) {
-                free(conv_buf);
+            if (readMaskLine<uint32_t>(m_conv_buf, conv_written, m_charsets, mask, m_buffers)) {
+                m_mask_idx++;
                 return true;
             }
             m_error = true;
             fprintf(stderr, "Error while reading '%s' at line %u\n", m_filename, m_line_number);
-            free(conv_buf);
             return false;
         }
     }
@@ -341,6 +494,116 @@ template<> bool MaskFileGenerator<uint32_t>::operator()(Maskuni::Mask<uint32_t>
     return false;
 }
 
+/* get the characters of a mask file line, the 8-bit lines are used as is */
+static inline bool decodeMaskLine(const char *line, size_t len, const char **decoded, size_t *decoded_len, char **, size_t *) {
+    *decoded = line;
+    *decoded_len = len;
+    return true;
+}
+
+/* get the characters of a mask file line, decoded from UTF-8 into \a conv_buf */
+static inline bool decodeMaskLine(const char *line, size_t len, const uint32_t **decoded, size_t *decoded_len, uint32_t **conv_buf, size_t *conv_buf_size) {
+    size_t consumed = 0, written = 0;
+    UTF::decode_utf8(line, len, conv_buf, conv_buf_size, &consumed, &written);
+    *decoded = *conv_buf;
+    *decoded_len = written;
+    return consumed == len;
+}
+
+/**
+ * @brief Mask generator for a mask file read as a stream (a pipe, a FIFO, a terminal...)
+ * 
+ * The lines are read and parsed one at a time, so the masks can be generated while the file is
+ * still being written, whatever its size. The stream can't be rewound: the generator can't be reset
+ * once a line has been read, and the masks can't be sized before the generation.
+ */
+template<typename T>
+class MaskStreamGenerator : public MaskGenerator<T>
+{
+    FILE *m_file;               /*!< stream */
+    char *m_filename;           /*!< name of the file for error messages */
+    CharsetMap<T> m_charsets;   /*<! predefined charsets, the inline charsets of a line are pushed then removed */
+    MaskParserBuffers<T> m_buffers; /*!< parsing buffers */
+    char *m_line;               /*!< line buffer of getline */
+    size_t m_line_size;         /*!< size of m_line */
+    T *m_conv_buf;              /*!< UTF-8 decoding buffer for the unicode version */
+    size_t m_conv_buf_size;     /*!< size of m_conv_buf */
+    unsigned int m_line_number; /*!< number of line read for error messages */
+    bool m_error;               /*!< error flag */
+    
+public:
+    /**
+     * @brief construct a new generator
+     * 
+     * @param file stream, closed by the destructor
+     * @param filename filename for error messages
+     * @param charsets predefined charsets
+     */
+    MaskStreamGenerator(FILE *file, const char *filename, const CharsetMap<T> &charsets) :
+    m_file(file), m_filename(strdup(filename)), m_charsets(charsets), m_buffers(),
+    m_line(NULL), m_line_size(0), m_conv_buf(NULL), m_conv_buf_size(0), m_line_number(0), m_error(false) {}
+    
+    ~MaskStreamGenerator() {
+        fclose(m_file);
+        free(m_filename);
+        free(m_line);
+        free(m_conv_buf);
+    }
+    
+    bool operator()(Maskuni::Mask<T> &mask) {
+        ssize_t r;
+        while (!m_error && (r = getline(&m_line, &m_line_size, m_file)) != -1) {
+            m_line_number++;
+            
+            if (r >= 2 && m_line[r - 1] == '\n' && m_line[r - 2] == '\r') {
+                r -= 2;
+            }
+            else if (r >= 1 && m_line[r - 1] == '\n') {
+                r -= 1;
+            }
+            if (r == 0) {
+                continue;
+            }
+            
+            const T *decoded;
+            size_t decoded_len;
+            if (!decodeMaskLine(m_line, r, &decoded, &decoded_len, &m_conv_buf, &m_conv_buf_size)) {
+                fprintf(stderr, "Error: the mask file '%s' contains invalid UTF-8 chars at line %u\n", m_filename, m_line_number);
+                m_error = true;
+                return false;
+            }
+            
+            mask.clear();
+            if (readMaskLine<T>(decoded, decoded_len, m_charsets, mask, m_buffers)) {
+                return true;
+            }
+            m_error = true;
+            fprintf(stderr, "Error while reading '%s' at line %u\n", m_filename, m_line_number);
+            return false;
+        }
+        if (ferror(m_file)) {
+            fprintf(stderr, "Error while reading '%s'\n", m_filename);
+            m_error = true;
+        }
+        return false;
+    }
+    
+    void reset() {
+        if (m_line_number != 0) {
+            fprintf(stderr, "Error: the mask file '%s' is a stream and can't be read twice\n", m_filename);
+            m_error = true;
+        }
+    }
+    
+    bool canReset() {
+        return false;
+    }
+    
+    bool good() {
+        return !m_error;
+    }
+};
+
 template<typename T>
 MaskGenerator<T> *readMaskList(const char *spec, const CharsetMap<T> &charsets) {
 #if defined(__WINDOWS__) || defined(__CYGWIN__)
@@ -354,7 +617,8 @@ MaskGenerator<T> *readMaskList(const char *spec, const CharsetMap<T> &charsets)
     
     if (fd >= 0) {
         struct stat st;
-        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        const bool stat_ok = fstat(fd, &st) == 0;
+        if (stat_ok && S_ISREG(st.st_mode)) {
             content_len = st.st_size;
             content = (char *) malloc(content_len);
             ssize_t r = read(fd, content, content_len);
@@ -368,6 +632,16 @@ MaskGenerator<T> *readMaskList(const char *spec, const CharsetMap<T> &charsets)
             close(fd);
             return new MaskFileGenerator<T>(content, content_len, false, spec, charsets);
         }
+        else if (stat_ok && (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode) || S_ISSOCK(st.st_mode))) {
+            // a pipe or a device, read the masks while generating
+            FILE *f = fdopen(fd, "r");
+            if (f == NULL) {
+                fprintf(stderr, "Error while reading '%s'\n", spec);
+                close(fd);
+                return NULL;
+            }
+            return new MaskStreamGenerator<T>(f, spec, charsets);
+        }
         else {
             close(fd);
         }
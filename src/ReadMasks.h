@@ -25,6 +25,7 @@ namespace Maskuni {
  * @brief Read an 8-bits mask list from a file or from the mask given by \a spec and return a MaskGenerator for the masks
  * If a file named \a spec exists then the masks are read from the file
  * Otherwise the content of the mask list is the single mask created from the string \a spec
+ * A pipe or a device (like /dev/stdin) is read as a stream, the generator can't be reset (see \a MaskGenerator::canReset)
  * 
  * The list is not validated.
  * 
@@ -37,6 +38,7 @@ MaskGenerator<char> *readMaskListAscii(const char *spec, const CharsetMapAscii &
  * @brief Read an unicode mask list from a file or from the mask given by \a spec and return a MaskGenerator for the masks
  * If a file named \a spec exists then the masks are read from the file
  * Otherwise the content of the mask list is the single mask created from the string \a spec
+ * A pipe or a device (like /dev/stdin) is read as a stream, the generator can't be reset (see \a MaskGenerator::canReset)
  * 
  * The content of the file or the string \a spec must be UTF-8 encoded
  * 
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SimdKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define MASKUNI_SIMD_X86
+#elif defined(__aarch64__)
+# include <arm_neon.h>
+# define MASKUNI_SIMD_NEON
+#endif
+
+namespace Maskuni {
+
+namespace Simd {
+
+static size_t gcd(size_t a, size_t b)
+{
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+bool preparePlan(StampPlan &plan, const Backend &backend, size_t stride, size_t pos, size_t k)
+{
+    if (stride == 0 || stride > 16 || k == 0 || pos + k > stride) {
+        return false;
+    }
+    const size_t chunk = backend.m_chunk;
+    const size_t n_lanes = chunk / 16;
+    plan.m_stride = stride;
+    plan.m_pos = pos;
+    plan.m_k = k;
+    plan.m_chunk = chunk;
+    plan.m_n_chunks = stride / gcd(stride, chunk);
+    plan.m_words_per_period = plan.m_n_chunks * chunk / stride;
+    plan.m_tmpl_idx.assign(plan.m_n_chunks * chunk, 0x80);
+    plan.m_set_idx.assign(plan.m_n_chunks * chunk, 0x80);
+    plan.m_set_off.assign(plan.m_n_chunks * n_lanes, 0);
+
+    for (size_t c = 0; c < plan.m_n_chunks; c++) {
+        for (size_t lane = 0; lane < n_lanes; lane++) {
+            // the shuffles only work inside a lane of 16 bytes
+            // the tuples are read from the first stamped byte of the lane
+            size_t lane_start = c * chunk + lane * 16;
+            bool first = true;
+            size_t first_off = 0;
+            for (size_t i = 0; i < 16; i++) {
+                size_t b = lane_start + i;
+                size_t word = b / stride;
+                size_t r = b - word * stride;
+                size_t idx = c * chunk + lane * 16 + i;
+                if (r >= pos && r < pos + k) {
+                    size_t off = word * k + (r - pos);
+                    if (first) {
+                        first_off = off;
+                        first = false;
+                    }
+                    plan.m_set_idx[idx] = off - first_off;
+                }
+                else {
+                    plan.m_tmpl_idx[idx] = r;
+                }
+            }
+            plan.m_set_off[c * n_lanes + lane] = first_off;
+        }
+    }
+    return true;
+}
+
+#if defined(MASKUNI_SIMD_X86)
+
+__attribute__((target("ssse3")))
+static size_t stampSsse3(const StampPlan &plan, char *out, const char *tmpl, const char *tuples, size_t n_words)
+{
+    const size_t n_periods = n_words / plan.m_words_per_period;
+    const size_t tuples_per_period = plan.m_words_per_period * plan.m_k;
+    const __m128i t = _mm_loadu_si128((const __m128i *) tmpl);
+    for (size_t period = 0; period < n_periods; period++) {
+        const char *base = tuples + period * tuples_per_period;
+        for (size_t c = 0; c < plan.m_n_chunks; c++) {
+            __m128i tv = _mm_shuffle_epi8(t, _mm_loadu_si128((const __m128i *) (plan.m_tmpl_idx.data() + c * 16)));
+            __m128i sv = _mm_loadu_si128((const __m128i *) (base + plan.m_set_off[c]));
+            sv = _mm_shuffle_epi8(sv, _mm_loadu_si128((const __m128i *) (plan.m_set_idx.data() + c * 16)));
+            _mm_storeu_si128((__m128i *) out, _mm_or_si128(tv, sv));
+            out += 16;
+        }
+    }
+    return n_periods * plan.m_words_per_period;
+}
+
+__attribute__((target("avx2")))
+static size_t stampAvx2(const StampPlan &plan, char *out, const char *tmpl, const char *tuples, size_t n_words)
+{
+    const size_t n_periods = n_words / plan.m_words_per_period;
+    const size_t tuples_per_period = plan.m_words_per_period * plan.m_k;
+    const __m256i t = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) tmpl));
+    for (size_t period = 0; period < n_periods; period++) {
+        const char *base = tuples + period * tuples_per_period;
+        for (size_t c = 0; c < plan.m_n_chunks; c++) {
+            __m256i tv = _mm256_shuffle_epi8(t, _mm256_loadu_si256((const __m256i *) (plan.m_tmpl_idx.data() + c * 32)));
+            __m128i lo = _mm_loadu_si128((const __m128i *) (base + plan.m_set_off[2 * c]));
+            __m128i hi = _mm_loadu_si128((const __m128i *) (base + plan.m_set_off[2 * c + 1]));
+            __m256i sv = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+            sv = _mm256_shuffle_epi8(sv, _mm256_loadu_si256((const __m256i *) (plan.m_set_idx.data() + c * 32)));
+            _mm256_storeu_si256((__m256i *) out, _mm256_or_si256(tv, sv));
+            out += 32;
+        }
+    }
+    return n_periods * plan.m_words_per_period;
+}
+
+static const Backend backend_avx2 = {"avx2", 32, &stampAvx2};
+static const Backend backend_ssse3 = {"ssse3", 16, &stampSsse3};
+
+static const Backend *selectBackend()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &backend_avx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return &backend_ssse3;
+    }
+    return NULL;
+}
+
+#elif defined(MASKUNI_SIMD_NEON)
+
+static size_t stampNeon(const StampPlan &plan, char *out, const char *tmpl, const char *tuples, size_t n_words)
+{
+    const size_t n_periods = n_words / plan.m_words_per_period;
+    const size_t tuples_per_period = plan.m_words_per_period * plan.m_k;
+    const uint8x16_t t = vld1q_u8((const uint8_t *) tmpl);
+    for (size_t period = 0; period < n_periods; period++) {
+        const char *base = tuples + period * tuples_per_period;
+        for (size_t c = 0; c < plan.m_n_chunks; c++) {
+            // vqtbl1q_u8 writes 0 for the out of range indices (0x80)
+            uint8x16_t tv = vqtbl1q_u8(t, vld1q_u8(plan.m_tmpl_idx.data() + c * 16));
+            uint8x16_t sv = vld1q_u8((const uint8_t *) (base + plan.m_set_off[c]));
+            sv = vqtbl1q_u8(sv, vld1q_u8(plan.m_set_idx.data() + c * 16));
+            vst1q_u8((uint8_t *) out, vorrq_u8(tv, sv));
+            out += 16;
+        }
+    }
+    return n_periods * plan.m_words_per_period;
+}
+
+static const Backend backend_neon = {"neon", 16, &stampNeon};
+
+static const Backend *selectBackend()
+{
+    return &backend_neon;
+}
+
+#else
+
+static const Backend *selectBackend()
+{
+    return NULL;
+}
+
+#endif
+
+static const Backend *active_backend = NULL;
+
+const Backend *enableBackend()
+{
+    active_backend = selectBackend();
+    return active_backend;
+}
+
+const Backend *activeBackend()
+{
+    return active_backend;
+}
+
+}
+
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Maskuni {
+
+namespace Simd {
+
+/**
+ * @brief Precomputed shuffles for stamping words of a fixed stride
+ *
+ * The output of a run of words is periodic: every word is the same template
+ * except for its last \a m_k characters which are read from a table of k-tuples.
+ * A period is made of \a m_n_chunks vectors of \a m_chunk bytes and holds exactly
+ * \a m_words_per_period words.
+ *
+ * For each vector of the period:
+ * - m_tmpl_idx selects the bytes of the template (0x80 for the stamped bytes)
+ * - m_set_idx selects the bytes of the tuples (0x80 for the template bytes)
+ * - m_set_off is the offset of the first stamped byte of each 16 bytes lane in the tuples
+ */
+struct StampPlan {
+    size_t m_stride;                    /*!< word width + delimiter, at most 16 */
+    size_t m_pos;                       /*!< position of the first stamped byte in the word */
+    size_t m_k;                         /*!< number of stamped bytes */
+    size_t m_chunk;                     /*!< vector width of the backend */
+    size_t m_n_chunks;                  /*!< vectors per period */
+    size_t m_words_per_period;          /*!< words per period */
+    std::vector<uint8_t> m_tmpl_idx;    /*!< m_n_chunks * m_chunk template shuffles */
+    std::vector<uint8_t> m_set_idx;     /*!< m_n_chunks * m_chunk tuples shuffles */
+    std::vector<uint32_t> m_set_off;    /*!< m_n_chunks * (m_chunk / 16) tuples offsets */
+};
+
+/**
+ * @brief A vectorized stamping kernel
+ */
+struct Backend {
+    const char *m_name;     /*!< name for the messages */
+    size_t m_chunk;         /*!< vector width in bytes */
+    /**
+     * @brief Write whole periods of words
+     *
+     * @param plan plan prepared for this backend
+     * @param out output, at least n_words * plan.m_stride bytes
+     * @param tmpl word template, 16 readable bytes
+     * @param tuples n_words tuples of plan.m_k bytes followed by 16 readable bytes
+     * @param n_words maximum number of words to write
+     * @return number of words written (a multiple of plan.m_words_per_period)
+     */
+    size_t (*m_stamp)(const StampPlan &plan, char *out, const char *tmpl, const char *tuples, size_t n_words);
+};
+
+/**
+ * @brief Select the best kernel supported by the CPU and use it for the 8-bit generation
+ *
+ * @return the selected backend or NULL if no vectorized kernel is available
+ */
+const Backend *enableBackend();
+
+/**
+ * @brief Get the kernel selected by \a enableBackend
+ *
+ * @return the active backend or NULL if the SIMD generation is not enabled
+ */
+const Backend *activeBackend();
+
+/**
+ * @brief Prepare the shuffles for a backend
+ *
+ * @param plan output
+ * @param backend backend which will use the plan
+ * @param stride word width + delimiter, at most 16
+ * @param pos position of the first stamped byte in the word
+ * @param k number of stamped bytes
+ * @return false if this stride is not supported
+ */
+bool preparePlan(StampPlan &plan, const Backend &backend, size_t stride, size_t pos, size_t k);
+
+}
+
+}
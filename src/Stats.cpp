@@ -0,0 +1,172 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include "Stats.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+#include <chrono>
+
+namespace Maskuni {
+
+static const char *phase_names[Stats::N_PHASES] = {"sizing", "seek", "generation"};
+
+/**
+ * @brief Compute a rate
+ *
+ * @param n quantity
+ * @param ns duration in nanoseconds
+ * @return n per second, 0 for a null duration
+ */
+static double rate(uint64_t n, uint64_t ns)
+{
+    return ns ? (double) n * 1e9 / (double) ns : 0.;
+}
+
+Stats::Stats(bool report, unsigned int interval, const std::string &json_file) :
+    m_report(report), m_interval(interval), m_json_file(json_file), m_phases(), m_masks(),
+    m_writer(NULL), m_start(0), m_words(0), m_thread(), m_mutex(), m_cv_stop(), m_stop(false)
+{
+}
+
+Stats::~Stats()
+{
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_cv_stop.notify_one();
+        }
+        m_thread.join();
+    }
+}
+
+uint64_t Stats::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Stats::start(const OutputWriter &writer)
+{
+    m_writer = &writer;
+    m_start = now();
+    if (m_report && m_interval) {
+        m_thread = std::thread(&Stats::reportLoop, this);
+    }
+}
+
+void Stats::reportLoop()
+{
+    // the rates are given over the last interval
+    uint64_t last_time = m_start, last_words = 0, last_bytes = 0, last_stall = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_cv_stop.wait_for(lock, std::chrono::seconds(m_interval), [this]{ return m_stop; })) {
+        uint64_t t = now();
+        uint64_t words = m_words.load(std::memory_order_relaxed);
+        uint64_t bytes = m_writer->getBytes();
+        uint64_t stall = m_writer->getStallTime();
+        uint64_t elapsed = t - last_time;
+        fprintf(stderr, "Stats: %.1fs, %" PRIu64 " words (%.2f Mwords/s), %" PRIu64 " bytes (%.2f MB/s), write stalls %.1f%%\n",
+                (t - m_start) / 1e9, words, rate(words - last_words, elapsed) / 1e6, bytes, rate(bytes - last_bytes, elapsed) / 1e6,
+                elapsed ? 100. * (stall - last_stall) / elapsed : 0.);
+        last_time = t;
+        last_words = words;
+        last_bytes = bytes;
+        last_stall = stall;
+    }
+}
+
+void Stats::addMask(uint64_t first_word, size_t width, uint64_t words, uint64_t bytes, uint64_t duration)
+{
+    if (m_masks.empty() || m_masks.back().m_first_word != first_word || m_masks.back().m_width != width) {
+        m_masks.push_back({first_word, width, 0, 0, 0});
+    }
+    MaskStats &m = m_masks.back();
+    m.m_words += words;
+    m.m_bytes += bytes;
+    m.m_time += duration;
+}
+
+bool Stats::writeJson(uint64_t bytes, uint64_t stall) const
+{
+    FILE *f = fopen(m_json_file.c_str(), "w");
+    if (f == NULL) {
+        fprintf(stderr, "Error: can't open the statistics file '%s': %m\n", m_json_file.c_str());
+        return false;
+    }
+    const uint64_t gen = m_phases[PHASE_GENERATION];
+    const uint64_t words = m_words.load(std::memory_order_relaxed);
+    fprintf(f, "{\n  \"phases\": {");
+    for (int p = 0; p < N_PHASES; p++) {
+        fprintf(f, "%s\"%s\": %.9f", p ? ", " : "", phase_names[p], m_phases[p] / 1e9);
+    }
+    fprintf(f, "},\n");
+    fprintf(f, "  \"words\": %" PRIu64 ",\n  \"bytes\": %" PRIu64 ",\n", words, bytes);
+    fprintf(f, "  \"words_per_second\": %.1f,\n  \"bytes_per_second\": %.1f,\n", rate(words, gen), rate(bytes, gen));
+    fprintf(f, "  \"write_stalls\": %.9f,\n", stall / 1e9);
+    fprintf(f, "  \"masks\": [");
+    for (size_t i = 0; i < m_masks.size(); i++) {
+        const MaskStats &m = m_masks[i];
+        fprintf(f, "%s\n    {\"first_word\": %" PRIu64 ", \"width\": %zu, \"words\": %" PRIu64 ", \"bytes\": %" PRIu64
+                ", \"seconds\": %.9f, \"words_per_second\": %.1f, \"bytes_per_second\": %.1f}",
+                i ? "," : "", m.m_first_word, m.m_width, m.m_words, m.m_bytes, m.m_time / 1e9,
+                rate(m.m_words, m.m_time), rate(m.m_bytes, m.m_time));
+    }
+    fprintf(f, "%s]\n}\n", m_masks.empty() ? "" : "\n  ");
+    if (ferror(f) | fclose(f)) {
+        fprintf(stderr, "Error: can't write the statistics file '%s'\n", m_json_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Stats::finish()
+{
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_cv_stop.notify_one();
+        }
+        m_thread.join();
+    }
+    if (m_writer) {
+        m_phases[PHASE_GENERATION] += now() - m_start;
+    }
+    const uint64_t gen = m_phases[PHASE_GENERATION];
+    const uint64_t words = m_words.load(std::memory_order_relaxed);
+    const uint64_t bytes = m_writer ? m_writer->getBytes() : 0;
+    const uint64_t stall = m_writer ? m_writer->getStallTime() : 0;
+    if (m_report) {
+        fprintf(stderr, "Stats: sizing %.3fs, seek %.3fs, generation %.3fs\n",
+                m_phases[PHASE_SIZING] / 1e9, m_phases[PHASE_SEEK] / 1e9, gen / 1e9);
+        fprintf(stderr, "Stats: %" PRIu64 " words, %" PRIu64 " bytes, %.2f Mwords/s, %.2f MB/s\n",
+                words, bytes, rate(words, gen) / 1e6, rate(bytes, gen) / 1e6);
+        // the generation waits for the output more than it generates
+        bool io_bound = 2 * stall > gen;
+        fprintf(stderr, "Stats: write stalls %.3fs (%.1f%% of the generation), %s bound\n",
+                stall / 1e9, gen ? 100. * stall / gen : 0., io_bound ? "output" : "generator");
+    }
+    if (!m_json_file.empty()) {
+        return writeJson(bytes, stall);
+    }
+    return true;
+}
+
+}
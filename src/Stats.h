@@ -0,0 +1,152 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OutputWriter.h"
+
+namespace Maskuni {
+
+/**
+ * @brief Timings and counters of a run
+ *
+ * The phases before the generation are timed by the caller. During the generation,
+ * the caller counts the generated words and may record the words, bytes and time of each mask,
+ * the output writer counts the bytes and the time spent waiting for the output.
+ * The counters are read by a reporting thread which prints the progress on stderr periodically.
+ *
+ * At the end, a summary is printed on stderr and the statistics may be written as JSON into a file.
+ */
+class Stats
+{
+public:
+    enum Phase {
+        PHASE_SIZING = 0,   /*!< reading and sizing the masks */
+        PHASE_SEEK,         /*!< moving to the first word */
+        PHASE_GENERATION,   /*!< generating and writing the words */
+        N_PHASES
+    };
+
+private:
+    /**
+     * @brief Statistics of a mask
+     */
+    struct MaskStats {
+        uint64_t m_first_word;  /*!< global position of the first word of the mask */
+        size_t m_width;         /*!< width of the mask */
+        uint64_t m_words;       /*!< number of generated words */
+        uint64_t m_bytes;       /*!< number of generated bytes */
+        uint64_t m_time;        /*!< generation time in nanoseconds */
+    };
+
+    bool m_report;                          /*!< true to print on stderr */
+    unsigned int m_interval;                /*!< seconds between two progress reports, 0 to disable them */
+    std::string m_json_file;                /*!< JSON output file or empty */
+    uint64_t m_phases[N_PHASES];            /*!< duration of each phase in nanoseconds */
+    std::vector<MaskStats> m_masks;         /*!< statistics of the masks */
+    const OutputWriter *m_writer;           /*!< output of the generation */
+    uint64_t m_start;                       /*!< start time of the generation */
+    std::atomic<uint64_t> m_words;          /*!< number of generated words */
+
+    std::thread m_thread;                   /*!< reporting thread */
+    std::mutex m_mutex;                     /*!< protects m_stop */
+    std::condition_variable m_cv_stop;      /*!< signaled when m_stop is set */
+    bool m_stop;                            /*!< true when the reporting thread must stop */
+
+    void reportLoop();
+    bool writeJson(uint64_t bytes, uint64_t stall) const;
+
+public:
+    /**
+     * @brief Create the statistics of a run
+     *
+     * @param report true to print the progress and the summary on stderr
+     * @param interval seconds between two progress reports, 0 to only print the summary
+     * @param json_file file receiving the statistics as JSON, may be empty
+     */
+    Stats(bool report, unsigned int interval, const std::string &json_file);
+    ~Stats();
+
+    Stats(const Stats &) = delete;
+    Stats &operator=(const Stats &) = delete;
+
+    /**
+     * @brief Get a monotonic time
+     *
+     * @return time in nanoseconds
+     */
+    static uint64_t now();
+
+    /**
+     * @brief Record the duration of a phase
+     *
+     * @param phase phase
+     * @param duration nanoseconds added to the phase
+     */
+    void addPhase(Phase phase, uint64_t duration)
+    {
+        m_phases[phase] += duration;
+    }
+
+    /**
+     * @brief Start the generation phase and the progress reports
+     *
+     * @param writer output of the generation, must outlive \a finish
+     */
+    void start(const OutputWriter &writer);
+
+    /**
+     * @brief Get the counter of the generated words, may be incremented from any thread
+     *
+     * @return counter
+     */
+    std::atomic<uint64_t> &getWordsCounter()
+    {
+        return m_words;
+    }
+
+    /**
+     * @brief Record some words generated from a mask
+     *
+     * The consecutive records of the same mask are merged
+     *
+     * @param first_word global position of the first word of the mask
+     * @param width width of the mask
+     * @param words number of words
+     * @param bytes number of bytes
+     * @param duration generation time in nanoseconds
+     */
+    void addMask(uint64_t first_word, size_t width, uint64_t words, uint64_t bytes, uint64_t duration);
+
+    /**
+     * @brief End the generation phase, print the summary and write the JSON file
+     *
+     * @return false if the JSON file could not be written
+     */
+    bool finish();
+};
+
+}
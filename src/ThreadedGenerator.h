@@ -0,0 +1,306 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Generate.h"
+#include "MaskGenerator.h"
+
+namespace Maskuni {
+
+/**
+ * @brief Generate a range of words with several worker threads
+ *
+ * The calling thread walks the mask generator and cuts the range of words into units.
+ * Each unit is small enough to fit in a single output block.
+ * The worker threads take the units in order, generate their words into a free block
+ * and hand the block to a single writer thread.
+ * The writer either respects the order of the units (default) or writes the blocks
+ * as soon as they are ready.
+ *
+ * The number of blocks is bounded so that the memory usage doesn't depend on the
+ * speed of the output.
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ * @param Printer class with a print(const T *buffer, size_t len) method
+ */
+template<typename T, typename Printer>
+class ThreadedGenerator
+{
+    /**
+     * @brief A continuous range of words from a single mask
+     */
+    struct Segment {
+        std::shared_ptr<const Mask<T>> m_mask;  /*!< mask shared by the segments, copied by the workers */
+        uint64_t m_start;                       /*!< first word in the mask */
+        uint64_t m_count;                       /*!< number of words */
+    };
+
+    /**
+     * @brief A unit of work, the segments are generated into a single block
+     */
+    struct Unit {
+        uint64_t m_seq;                     /*!< position of the unit in the output */
+        std::vector<Segment> m_segments;    /*!< words to generate */
+    };
+
+    /**
+     * @brief An output block
+     */
+    struct Block {
+        std::vector<T> m_data;  /*!< content */
+        size_t m_len;           /*!< number of elements used in m_data */
+        uint64_t m_seq;         /*!< sequence number of the unit which filled this block */
+        uint64_t m_words;       /*!< number of words in m_data */
+    };
+
+    unsigned int m_n_threads;       /*!< maximum number of worker threads */
+    bool m_ordered;                 /*!< true if the writer must respect the order of the units */
+    size_t m_max_width;             /*!< maximum width of the words */
+    T m_delim;                      /*!< word delimiter */
+    int m_delim_width;              /*!< 1 to write the delimiter */
+    Printer &m_printer;             /*!< output */
+    std::atomic<uint64_t> *m_written_words; /*!< counter of the written words or NULL */
+    size_t m_block_size;            /*!< number of elements of each block */
+    size_t m_max_units;             /*!< maximum number of pending units */
+
+    std::mutex m_mutex;                     /*!< protects all the following members */
+    std::condition_variable m_cv_units;     /*!< signaled when a unit is pushed or when the dispatching is done */
+    std::condition_variable m_cv_space;     /*!< signaled when a unit is taken by a worker */
+    std::condition_variable m_cv_free;      /*!< signaled when a block is released by the writer */
+    std::condition_variable m_cv_ready;     /*!< signaled when a block is filled or when the work is done */
+    std::deque<Unit> m_units;               /*!< pending units */
+    std::vector<Block *> m_free;            /*!< free blocks */
+    std::map<uint64_t, Block *> m_ready;    /*!< filled blocks by sequence number */
+    std::vector<std::unique_ptr<Block>> m_blocks; /*!< all the blocks */
+    bool m_dispatch_done;                   /*!< true when there is no more unit to push */
+    uint64_t m_n_units;                     /*!< number of units pushed so far */
+    uint64_t m_n_written;                   /*!< number of blocks written so far */
+
+    /**
+     * @brief Queue a unit, wait if too many units are pending
+     */
+    void pushUnit(Unit &unit)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv_space.wait(lock, [this]{ return m_units.size() < m_max_units; });
+        m_units.emplace_back();
+        std::swap(m_units.back(), unit);
+        m_n_units++;
+        m_cv_units.notify_one();
+    }
+
+    /**
+     * @brief Worker thread, take a free block then a unit and fill the block
+     */
+    void worker()
+    {
+        std::vector<T> word(m_max_width + 1);
+        auto flush = [](OutputBuffer<T> &) {
+            // the units are sized to fit in a block
+            fprintf(stderr, "Error: a work unit doesn't fit in its output block (that wasn't expected!)\n");
+            abort();
+        };
+
+        while (true) {
+            Block *block = NULL;
+            Unit unit = Unit();
+            {
+                // the block must be taken before the unit
+                // Since the units are taken in order, the unit expected by the writer is
+                // then always either in the queue or in the hand of a worker owning a block.
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv_free.wait(lock, [this]{ return !m_free.empty(); });
+                block = m_free.back();
+                m_free.pop_back();
+                m_cv_units.wait(lock, [this]{ return !m_units.empty() || m_dispatch_done; });
+                if (m_units.empty()) {
+                    m_free.push_back(block);
+                    m_cv_free.notify_one();
+                    return;
+                }
+                std::swap(unit, m_units.front());
+                m_units.pop_front();
+                m_cv_space.notify_one();
+            }
+
+            OutputBuffer<T> out = {block->m_data.data(), block->m_data.data(), block->m_data.data() + block->m_data.size()};
+            block->m_words = 0;
+            for (auto &segment : unit.m_segments) {
+                Mask<T> mask(*segment.m_mask);
+                generateWords(mask, segment.m_start, segment.m_count, m_delim, m_delim_width, word.data(), out, flush);
+                block->m_words += segment.m_count;
+            }
+            block->m_len = out.m_p - out.m_begin;
+            block->m_seq = unit.m_seq;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_ready.insert(std::make_pair(block->m_seq, block));
+                m_cv_ready.notify_one();
+            }
+        }
+    }
+
+    /**
+     * @brief Writer thread, print the filled blocks
+     */
+    void writer()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cv_ready.wait(lock, [this]{
+                if (m_dispatch_done && m_n_written == m_n_units) {
+                    return true;
+                }
+                if (m_ordered) {
+                    return m_ready.count(m_n_written) != 0;
+                }
+                return !m_ready.empty();
+            });
+            if (m_dispatch_done && m_n_written == m_n_units) {
+                return;
+            }
+            auto it = m_ordered ? m_ready.find(m_n_written) : m_ready.begin();
+            Block *block = it->second;
+            m_ready.erase(it);
+            lock.unlock();
+
+            m_printer.print(block->m_data.data(), block->m_len);
+            if (m_written_words) {
+                m_written_words->fetch_add(block->m_words, std::memory_order_relaxed);
+            }
+
+            lock.lock();
+            m_n_written++;
+            m_free.push_back(block);
+            m_cv_free.notify_one();
+        }
+    }
+
+public:
+    /**
+     * @brief Create a new threaded generator
+     *
+     * @param n_threads maximum number of worker threads, no more than the number of units are started
+     * @param ordered true to write the words in the same order as the single threaded generation
+     * @param max_width maximum width of the masks
+     * @param delim word delimiter
+     * @param delim_width 1 to write the delimiter, 0 otherwise
+     * @param printer output
+     * @param written_words counter incremented with the number of words of each written block, may be NULL
+     */
+    ThreadedGenerator(unsigned int n_threads, bool ordered, size_t max_width, T delim, int delim_width, Printer &printer,
+                      std::atomic<uint64_t> *written_words = NULL) :
+        m_n_threads(std::max(1u, n_threads)), m_ordered(ordered),
+        m_max_width(max_width), m_delim(delim), m_delim_width(delim_width),
+        m_printer(printer), m_written_words(written_words),
+        m_block_size(std::max<size_t>(1 << 17, 4 * (max_width + 1))), m_max_units(0),
+        m_mutex(), m_cv_units(), m_cv_space(), m_cv_free(), m_cv_ready(),
+        m_units(), m_free(), m_ready(), m_blocks(),
+        m_dispatch_done(false), m_n_units(0), m_n_written(0)
+    {}
+
+    /**
+     * @brief Generate the words
+     *
+     * The words are generated from the position \a start of \a first_mask
+     * then from the following masks given by \a gen.
+     *
+     * @param gen generator positioned right after \a first_mask
+     * @param first_mask first mask
+     * @param start position of the first word in \a first_mask
+     * @param todo number of words to generate
+     */
+    void run(MaskGenerator<T> &gen, const Mask<T> &first_mask, uint64_t start, uint64_t todo)
+    {
+        // cut the range in units fitting in a block
+        // keep one spare element as the fixed width kernels always copy the delimiter
+        const uint64_t unit_words = std::max<uint64_t>(1, (m_block_size - 1) / std::max<size_t>(1, m_max_width + m_delim_width));
+
+        // no more workers than units, each worker gets 4 blocks
+        const uint64_t total_units = todo / unit_words + (todo % unit_words != 0);
+        const unsigned int n_workers = (unsigned int) std::max<uint64_t>(1, std::min<uint64_t>(m_n_threads, total_units));
+        m_max_units = 4 * n_workers;
+        for (size_t i = 0; i < 4 * (size_t) n_workers; i++) {
+            m_blocks.emplace_back(new Block());
+            m_blocks.back()->m_data.resize(m_block_size);
+            m_blocks.back()->m_len = 0;
+            m_blocks.back()->m_seq = 0;
+            m_blocks.back()->m_words = 0;
+            m_free.push_back(m_blocks.back().get());
+        }
+
+        std::thread writer_thread(&ThreadedGenerator::writer, this);
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < n_workers; i++) {
+            workers.emplace_back(&ThreadedGenerator::worker, this);
+        }
+
+        std::shared_ptr<const Mask<T>> mask = std::make_shared<const Mask<T>>(first_mask);
+        Unit unit = Unit();
+        unit.m_seq = 0;
+        uint64_t unit_count = 0;
+        while (todo) {
+            uint64_t take = std::min(std::min(todo, mask->getLen() - start), unit_words - unit_count);
+            if (take != 0) {
+                unit.m_segments.push_back({mask, start, take});
+                start += take;
+                todo -= take;
+                unit_count += take;
+            }
+            if (unit_count == unit_words || todo == 0) {
+                uint64_t next_seq = unit.m_seq + 1;
+                pushUnit(unit);
+                unit.m_segments.clear();
+                unit.m_seq = next_seq;
+                unit_count = 0;
+            }
+            if (todo && start == mask->getLen()) {
+                std::shared_ptr<Mask<T>> next_mask = std::make_shared<Mask<T>>();
+                gen(*next_mask);
+                mask = next_mask;
+                start = 0;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_dispatch_done = true;
+            m_cv_units.notify_all();
+            m_cv_ready.notify_all();
+        }
+        for (auto &t : workers) {
+            t.join();
+        }
+        writer_thread.join();
+    }
+};
+
+}
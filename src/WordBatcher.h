@@ -0,0 +1,267 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "Generate.h"
+#include "Mask.h"
+#include "MaskGenerator.h"
+#include "MaskIndex.h"
+#include "WordLocator.h"
+
+namespace Maskuni {
+
+/**
+ * @brief Pull the words of a generator by batches into the memory of the caller
+ *
+ * The words are written back to back, without delimiter. A batch is either
+ * offset-indexed (the words of any width, with the offsets of the words)
+ * or fixed-stride (the words of a single width).
+ *
+ * The masks are sized when the batcher is created, then the words can be read
+ * from any position with \a seek.
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ */
+template<typename T>
+class WordBatcher
+{
+    std::unique_ptr<MaskGenerator<T>> m_gen;    /*!< generator of the masks */
+    MaskIndex m_index;                          /*!< sampled index of the masks */
+    bool m_counted;                             /*!< true if the generator counts its words */
+    uint64_t m_len;                             /*!< total number of words */
+    size_t m_max_width;                         /*!< width of the widest mask */
+    bool m_good;                                /*!< false after an error of the generator */
+    std::unique_ptr<WordLocator<T>> m_locator;  /*!< finds the mask of a word */
+    uint64_t m_pos;                             /*!< position of the next word */
+    uint64_t m_offset;                          /*!< position of the next word in the current mask */
+    uint64_t m_left;                            /*!< words left in the current mask, 0 if not loaded */
+    std::vector<T> m_word;                      /*!< word buffer of the generation loops */
+    std::vector<T> m_last;                      /*!< receives the last word of each call of the generation loops */
+
+    /**
+     * @brief Load the mask of the next word
+     *
+     * @return false at the end of the words or on error
+     */
+    bool load()
+    {
+        if (!m_good || m_pos >= m_len) {
+            return false;
+        }
+        if (!m_locator->locate(m_pos, m_offset)) {
+            m_good = false;
+            return false;
+        }
+        m_left = m_locator->getMask().getLen() - m_offset;
+        return true;
+    }
+
+    /**
+     * @brief Write the next \a count words of the current mask at \a out
+     *
+     * The generation loops may write a delimiter after the last word, so the last word
+     * (or all the words of an empty mask) is generated into m_last then copied.
+     *
+     * @param count number of words, not greater than m_left
+     * @param out buffer of at least count * width elements
+     */
+    void generate(uint64_t count, T *out)
+    {
+        Mask<T> &mask = m_locator->getMask();
+        const size_t width = mask.getWidth();
+        // the buffers are never full
+        auto flush = [](OutputBuffer<T> &) {
+            abort();
+        };
+        const uint64_t direct = width ? count - 1 : 0;
+        if (direct) {
+            OutputBuffer<T> buffer = {out, out, out + direct * width + 1};
+            generateWords(mask, m_offset, direct, T(0), 0, m_word.data(), buffer, flush);
+        }
+        OutputBuffer<T> last = {m_last.data(), m_last.data(), m_last.data() + m_last.size()};
+        generateWords(mask, m_offset + direct, count - direct, T(0), 0, m_word.data(), last, flush);
+        std::copy(m_last.data(), m_last.data() + (count - direct) * width, out + direct * width);
+        m_pos += count;
+        m_offset += count;
+        m_left -= count;
+    }
+
+public:
+    /**
+     * @brief Create a batcher and size the masks of \a gen
+     *
+     * @param gen generator of the masks, owned by the batcher
+     */
+    explicit WordBatcher(MaskGenerator<T> *gen) :
+        m_gen(gen), m_index(), m_counted(false), m_len(0), m_max_width(0), m_good(gen != NULL),
+        m_locator(), m_pos(0), m_offset(0), m_left(0), m_word(), m_last()
+    {
+        if (!m_good) {
+            return;
+        }
+        if (!m_gen->canReset()) {
+            // the masks of a stream can't be sized beforehand
+            m_good = false;
+            return;
+        }
+        m_counted = m_gen->countWords(m_len, m_max_width);
+        uint64_t size;
+        size_t width;
+        while (!m_counted && m_gen->good() && (*m_gen)(size, width)) {
+            if (!m_index.push(size)) {
+                m_good = false;
+                return;
+            }
+            m_max_width = std::max<size_t>(m_max_width, width);
+        }
+        if (!m_gen->good()) {
+            m_good = false;
+            return;
+        }
+        if (!m_counted) {
+            m_len = m_index.getLen();
+        }
+        m_locator.reset(new WordLocator<T>(*m_gen, m_index, m_counted, m_len));
+        m_word.resize(m_max_width + 1);
+        m_last.resize(m_max_width + 1);
+    }
+
+    WordBatcher(const WordBatcher &) = delete;
+    WordBatcher &operator=(const WordBatcher &) = delete;
+
+    /**
+     * @brief Test if the batcher is usable
+     *
+     * @return false if the masks were invalid, if their number of words overflows
+     *         a 64 bits integer, if the generator failed or if it reads a stream
+     */
+    bool good() const
+    {
+        return m_good;
+    }
+
+    /**
+     * @brief Get the total number of words
+     */
+    uint64_t getLen() const
+    {
+        return m_len;
+    }
+
+    /**
+     * @brief Get the width of the widest word
+     */
+    size_t getMaxWidth() const
+    {
+        return m_max_width;
+    }
+
+    /**
+     * @brief Get the position of the next word
+     */
+    uint64_t tell() const
+    {
+        return m_pos;
+    }
+
+    /**
+     * @brief Move to a word
+     *
+     * @param word_idx position of the next word, counting from 0
+     * @return false if \a word_idx is greater than the number of words
+     */
+    bool seek(uint64_t word_idx)
+    {
+        if (word_idx > m_len) {
+            return false;
+        }
+        m_pos = word_idx;
+        m_left = 0;
+        return true;
+    }
+
+    /**
+     * @brief Fill an offset-indexed batch
+     *
+     * The word \a i of the batch is made of the elements [\a offsets[i], \a offsets[i + 1]) of \a buf
+     *
+     * @param buf buffer of \a cap elements receiving the words
+     * @param cap capacity of \a buf in elements, at least \a getMaxWidth() to always make progress
+     * @param offsets array of at least \a max_words + 1 elements receiving the offsets of the words
+     * @param max_words maximum number of words of the batch
+     * @return number of words of the batch, 0 at the end of the words or on error (see \a good)
+     */
+    size_t fillBatch(T *buf, size_t cap, size_t *offsets, size_t max_words)
+    {
+        size_t n = 0, used = 0;
+        while (n < max_words && (m_left || load())) {
+            const size_t width = m_locator->getMask().getWidth();
+            if (cap - used < width) {
+                break;
+            }
+            uint64_t count = std::min<uint64_t>(m_left, max_words - n);
+            if (width) {
+                count = std::min<uint64_t>(count, (cap - used) / width);
+            }
+            generate(count, buf + used);
+            for (uint64_t i = 0; i < count; i++) {
+                offsets[n++] = used;
+                used += width;
+            }
+        }
+        offsets[n] = used;
+        return n;
+    }
+
+    /**
+     * @brief Fill a fixed-stride batch
+     *
+     * The batch stops before the first word of a different width,
+     * the word \a i of the batch is made of the elements [\a i * \a width, (\a i + 1) * \a width) of \a buf
+     *
+     * @param buf buffer of \a cap elements receiving the words
+     * @param cap capacity of \a buf in elements, at least \a getMaxWidth() to always make progress
+     * @param width set to the width of the words of the batch
+     * @return number of words of the batch, 0 at the end of the words or on error (see \a good)
+     */
+    size_t fillBatch(T *buf, size_t cap, size_t &width)
+    {
+        size_t n = 0;
+        width = 0;
+        if (cap == 0 || (!m_left && !load())) {
+            return 0;
+        }
+        width = m_locator->getMask().getWidth();
+        const size_t max_words = cap / std::max<size_t>(width, 1);
+        while (n < max_words && (m_left || load()) && m_locator->getMask().getWidth() == width) {
+            uint64_t count = std::min<uint64_t>(m_left, max_words - n);
+            generate(count, buf + n * width);
+            n += count;
+        }
+        return n;
+    }
+};
+
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <memory>
+#include <regex>
+#include <vector>
+
+#include "BloomFilter.h"
+#include "Generate.h"
+#include "Mask.h"
+#include "utf_conv.h"
+
+namespace Maskuni {
+
+/**
+ * @brief Rules dropping some words while generating
+ *
+ * - the maximum number of consecutive identical characters: the words are generated by a
+ *   dedicated odometer which skips all the words sharing a prefix breaking the rule
+ * - the minimum number of classes of characters (lowercase, uppercase, digit, other)
+ * - a regular expression (POSIX extended, searched like grep -E) the words must match
+ * - a Bloom filter of the words to exclude
+ *
+ * Without the first rule, the words are generated by the usual loops into a staging buffer,
+ * then each full buffer is filtered at once into the output.
+ * The regular expression and the Bloom filter see the unicode words encoded in UTF-8.
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ */
+template<typename T>
+class WordFilter
+{
+    unsigned int m_max_repeat;              /*!< maximum number of consecutive identical characters, 0 for no limit */
+    unsigned int m_min_classes;             /*!< minimum number of classes of characters */
+    std::shared_ptr<const std::regex> m_regex;          /*!< expression to match or NULL */
+    std::shared_ptr<const BloomFilter> m_exclude;       /*!< words to exclude or NULL */
+    std::vector<T> m_staging;               /*!< words waiting to be filtered */
+    std::vector<char> m_bytes;              /*!< UTF-8 encoding of a unicode word */
+    std::vector<uint64_t> m_digits;         /*!< position of each charset, for the pruning odometer */
+    std::vector<unsigned int> m_runs;       /*!< length of the run of identical characters ending at each position */
+
+    static constexpr size_t staging_size = 16384;
+
+    /**
+     * @brief Get the bytes of a word for the regular expression and the Bloom filter
+     */
+    const char *bytesOf(const char *w, size_t width, size_t &len)
+    {
+        len = width;
+        return w;
+    }
+
+    const char *bytesOf(const uint32_t *w, size_t width, size_t &len)
+    {
+        m_bytes.resize(4 * width);
+        char *p = m_bytes.data();
+        for (size_t i = 0; i < width; i++) {
+            p += UTF::impl::CpToUtf8::write(w[i], p);
+        }
+        len = p - m_bytes.data();
+        return m_bytes.data();
+    }
+
+    static unsigned int classOf(T c)
+    {
+        if (c >= 'a' && c <= 'z') {
+            return 1;
+        }
+        if (c >= 'A' && c <= 'Z') {
+            return 2;
+        }
+        if (c >= '0' && c <= '9') {
+            return 4;
+        }
+        return 8;
+    }
+
+    /**
+     * @brief Test the rules of a word, except the consecutive characters when \a check_runs is false
+     */
+    bool accept(const T *w, size_t width, bool check_runs)
+    {
+        if (check_runs && m_max_repeat) {
+            unsigned int run = 1;
+            for (size_t i = 1; i < width; i++) {
+                run = w[i] == w[i - 1] ? run + 1 : 1;
+                if (run > m_max_repeat) {
+                    return false;
+                }
+            }
+        }
+        if (m_min_classes) {
+            unsigned int classes = 0;
+            for (size_t i = 0; i < width; i++) {
+                classes |= classOf(w[i]);
+            }
+            if ((unsigned int) __builtin_popcount(classes) < m_min_classes) {
+                return false;
+            }
+        }
+        if (m_regex || m_exclude) {
+            size_t len;
+            const char *b = bytesOf(w, width, len);
+            if (m_regex && !std::regex_search(b, b + len, *m_regex)) {
+                return false;
+            }
+            if (m_exclude && m_exclude->contains(b, len)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Append a word and its delimiter to the output
+     */
+    template<typename Flush>
+    static void append(const T *w, size_t len, OutputBuffer<T> &out, Flush &flush)
+    {
+        if (len > size_t(out.m_end - out.m_p)) {
+            flush(out);
+        }
+        MASKUNI_MEMCPY(out.m_p, w, sizeof(T) * len);
+        out.m_p += len;
+    }
+
+    /**
+     * @brief Odometer skipping the words whose prefix has too many consecutive identical characters
+     */
+    template<typename Flush>
+    void generatePruned(Mask<T> &mask, uint64_t start, uint64_t count, T delim, int delim_width, T *word,
+                        OutputBuffer<T> &out, Flush &flush)
+    {
+        const size_t w = mask.getWidth();
+        m_digits.resize(w);
+        m_runs.resize(w);
+        uint64_t o = start;
+        for (size_t i = w; i != 0; i--) {
+            uint64_t len = mask.getCharset(i - 1).getLen();
+            m_digits[i - 1] = o % len;
+            o /= len;
+        }
+        word[w] = delim;
+        size_t from = 0; // first position changed since the previous word
+        while (count) {
+            size_t bad = w;
+            for (size_t i = from; i < w; i++) {
+                word[i] = mask.getCharset(i).data()[m_digits[i]];
+                m_runs[i] = i && word[i] == word[i - 1] ? m_runs[i - 1] + 1 : 1;
+                if (m_runs[i] > m_max_repeat) {
+                    bad = i;
+                    break;
+                }
+            }
+            // number of positions to skip: the word, or the rest of the words sharing the bad prefix
+            uint64_t skip = 1;
+            size_t p = w - 1;
+            if (bad == w) {
+                if (accept(word, w, false)) {
+                    append(word, w + delim_width, out, flush);
+                }
+            }
+            else {
+                uint64_t weight = 1, offset = 0;
+                for (size_t i = w - 1; i > bad; i--) {
+                    offset += m_digits[i] * weight;
+                    weight *= mask.getCharset(i).getLen();
+                    m_digits[i] = 0;
+                }
+                skip = weight - offset;
+                p = bad;
+            }
+            if (skip >= count) {
+                break;
+            }
+            count -= skip;
+            // carry to the left, the range doesn't go past the end of the mask
+            while (++m_digits[p] == mask.getCharset(p).getLen()) {
+                m_digits[p] = 0;
+                p--;
+            }
+            from = p;
+        }
+    }
+
+public:
+    /**
+     * @brief Create the filter
+     *
+     * @param max_repeat maximum number of consecutive identical characters, 0 for no limit
+     * @param min_classes minimum number of classes of characters, 0 for no limit
+     * @param regex expression the words must match, may be NULL
+     * @param exclude words to exclude, may be NULL
+     */
+    WordFilter(unsigned int max_repeat, unsigned int min_classes, const std::shared_ptr<const std::regex> &regex,
+               const std::shared_ptr<const BloomFilter> &exclude) :
+        m_max_repeat(max_repeat), m_min_classes(min_classes), m_regex(regex), m_exclude(exclude),
+        m_staging(), m_bytes(), m_digits(), m_runs()
+    {
+    }
+
+    /**
+     * @brief Generate the words of a mask which pass the rules
+     *
+     * Same parameters as \a generateWords, \a count counts the words before filtering
+     */
+    template<typename Flush>
+    void generate(Mask<T> &mask, uint64_t start, uint64_t count, T delim, int delim_width, T *word,
+                  OutputBuffer<T> &out, Flush &flush)
+    {
+        if (count == 0) {
+            return;
+        }
+        if (m_max_repeat) {
+            generatePruned(mask, start, count, delim, delim_width, word, out, flush);
+            return;
+        }
+        const size_t w = mask.getWidth();
+        const size_t stride = w + delim_width;
+        if (m_staging.size() < std::max<size_t>(staging_size, 2 * (w + 1))) {
+            m_staging.resize(std::max<size_t>(staging_size, 2 * (w + 1)));
+        }
+        OutputBuffer<T> staging = {m_staging.data(), m_staging.data(), m_staging.data() + m_staging.size()};
+        auto filter_block = [&](OutputBuffer<T> &s) {
+            for (const T *p = s.m_begin; p + stride <= s.m_p; p += stride) {
+                if (accept(p, w, true)) {
+                    append(p, stride, out, flush);
+                }
+            }
+            s.m_p = s.m_begin;
+        };
+        generateWords(mask, start, count, delim, delim_width, word, staging, filter_block);
+        filter_block(staging);
+    }
+};
+
+template<typename T>
+constexpr size_t WordFilter<T>::staging_size;
+
+}
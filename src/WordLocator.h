@@ -0,0 +1,159 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "Mask.h"
+#include "MaskGenerator.h"
+#include "MaskIndex.h"
+
+namespace Maskuni {
+
+/**
+ * @brief Find the mask holding any word of a generator
+ *
+ * The generators counting their words directly are moved with \a MaskGenerator::seekWord,
+ * unless the word is the first one of their next mask.
+ * Otherwise the generator is moved to the closest mask of the sampled index, then iterated
+ * to the mask holding the word. A forward lookup close to the previous one iterates from
+ * the current mask instead of seeking again, and a lookup in the current mask is free.
+ *
+ * The generator is always left right after the current mask.
+ *
+ * @param T Either char or 8-bit charsets or uint32_t for unicode codepoints
+ */
+template<typename T>
+class WordLocator
+{
+    MaskGenerator<T> &m_gen;        /*!< generator of the masks */
+    const MaskIndex &m_index;       /*!< sampled index of the masks, unused if m_counted */
+    bool m_counted;                 /*!< true if the generator implements seekWord */
+    uint64_t m_len;                 /*!< total number of words */
+    Mask<T> m_mask;                 /*!< current mask */
+    bool m_valid;                   /*!< true if m_mask is loaded */
+    uint64_t m_mask_start;          /*!< number of words before m_mask */
+    uint64_t m_next_idx;            /*!< index of the next mask of the generator, unused if m_counted */
+    uint64_t m_next_start;          /*!< number of words before the next mask of the generator */
+
+public:
+    /**
+     * @brief Create a locator
+     *
+     * @param gen generator of the masks
+     * @param index index built by the sizing pass of \a gen, must outlive the locator
+     * @param counted true if the words were counted by \a MaskGenerator::countWords instead of a sizing pass
+     * @param len total number of words
+     */
+    WordLocator(MaskGenerator<T> &gen, const MaskIndex &index, bool counted, uint64_t len) :
+        m_gen(gen), m_index(index), m_counted(counted), m_len(len), m_mask(), m_valid(false),
+        m_mask_start(0), m_next_idx(0), m_next_start(0) {}
+
+    /**
+     * @brief Find a word in the current mask without moving the generator
+     *
+     * @param word_idx global position of the word, counting from 0
+     * @param offset set to the position of the word in the current mask
+     * @return false if the word is not in the current mask
+     */
+    bool locateLoaded(uint64_t word_idx, uint64_t &offset) const
+    {
+        if (m_valid && word_idx >= m_mask_start && word_idx - m_mask_start < m_mask.getLen()) {
+            offset = word_idx - m_mask_start;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Load the mask holding a word
+     *
+     * @param word_idx global position of the word, counting from 0
+     * @param offset set to the position of the word in its mask
+     * @return false if \a word_idx is out of range or if the generator failed
+     */
+    bool locate(uint64_t word_idx, uint64_t &offset)
+    {
+        if (word_idx >= m_len) {
+            return false;
+        }
+        if (locateLoaded(word_idx, offset)) {
+            return true;
+        }
+        if (m_counted) {
+            if (m_valid && word_idx == m_next_start) {
+                // the first word of the next mask of the generator
+                m_valid = m_gen(m_mask);
+                offset = 0;
+            }
+            else {
+                m_valid = m_gen.seekWord(word_idx, offset) && m_gen(m_mask);
+            }
+            m_mask_start = word_idx - offset;
+            m_next_start = m_mask_start + m_mask.getLen();
+            return m_valid;
+        }
+        uint64_t words_before = 0;
+        uint64_t mask_idx = m_index.locate(word_idx, words_before);
+        if (!m_valid || mask_idx > m_next_idx || word_idx < m_next_start) {
+            // the current mask is behind the closest sample or after the word
+            m_valid = false;
+            if (!m_gen.seek(mask_idx)) {
+                return false;
+            }
+            m_next_idx = mask_idx;
+            m_next_start = words_before;
+        }
+        do {
+            if (!m_gen(m_mask)) {
+                m_valid = false;
+                return false;
+            }
+            m_mask_start = m_next_start;
+            m_next_start += m_mask.getLen();
+            m_next_idx++;
+        } while (word_idx >= m_next_start);
+        m_valid = true;
+        offset = word_idx - m_mask_start;
+        return true;
+    }
+
+    /**
+     * @brief Forget the current mask after the caller iterated the generator
+     *
+     * The next lookup seeks the generator again.
+     */
+    void reset()
+    {
+        m_valid = false;
+    }
+
+    /**
+     * @brief Get the current mask
+     *
+     * The caller may then iterate the next masks of the generator into this mask
+     * if the locator isn't used anymore.
+     *
+     * @return the mask loaded by the last successful call to \a locate
+     */
+    Mask<T> &getMask()
+    {
+        return m_mask;
+    }
+};
+
+}
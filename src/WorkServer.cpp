@@ -0,0 +1,574 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include "WorkServer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#if !defined(__WINDOWS__)
+# include <arpa/inet.h>
+# include <fcntl.h>
+# include <netdb.h>
+# include <netinet/in.h>
+# include <poll.h>
+# include <sys/socket.h>
+# include <sys/types.h>
+# define MASKUNI_HAVE_SOCKETS
+#endif
+
+#if defined(MASKUNI_HAVE_SOCKETS) && !defined(MSG_NOSIGNAL)
+# define MSG_NOSIGNAL 0
+#endif
+
+namespace Maskuni {
+
+#if defined(MASKUNI_HAVE_SOCKETS)
+
+/**
+ * @brief A socket address
+ */
+struct Endpoint {
+    struct sockaddr_storage m_addr;
+    socklen_t m_len;
+};
+
+/**
+ * @brief Get the socket addresses of "[HOST:]PORT" or "[[IPV6]:]PORT"
+ *
+ * The numeric IPv4 and IPv6 addresses are parsed directly. The host names are resolved
+ * by getaddrinfo, except in the static binary: the resolver would load the NSS libraries
+ * of the host at runtime.
+ *
+ * @param address address
+ * @param passive true for the address of a server: all the interfaces without HOST
+ * @param endpoints receives the candidate addresses, in order of preference
+ * @return false on error, with a message
+ */
+static bool resolveAddress(const char *address, bool passive, std::vector<Endpoint> &endpoints)
+{
+    std::string s(address), host, port;
+    size_t colon = s.rfind(':');
+    if (colon == std::string::npos) {
+        port = s;
+    }
+    else {
+        host = s.substr(0, colon);
+        port = s.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.size() - 2);
+        }
+    }
+    char *end;
+    errno = 0;
+    unsigned long port_number = strtoul(port.c_str(), &end, 10);
+    if (port.empty() || *end != '\0' || errno != 0 || port_number == 0 || port_number > 65535
+        || (host.empty() && !passive)) {
+        fprintf(stderr, "Error: wrong server address (%s)\n", address);
+        return false;
+    }
+    Endpoint e;
+    struct sockaddr_in *in4 = reinterpret_cast<struct sockaddr_in *>(&e.m_addr);
+    struct sockaddr_in6 *in6 = reinterpret_cast<struct sockaddr_in6 *>(&e.m_addr);
+    struct in_addr addr4;
+    struct in6_addr addr6;
+    const bool any = host.empty();
+    const bool is4 = !any && inet_pton(AF_INET, host.c_str(), &addr4) == 1;
+    const bool is6 = !any && !is4 && inet_pton(AF_INET6, host.c_str(), &addr6) == 1;
+    if (any || is4) {
+        memset(&e, 0, sizeof(e));
+        in4->sin_family = AF_INET;
+        in4->sin_port = htons(port_number);
+        if (any) {
+            in4->sin_addr.s_addr = htonl(INADDR_ANY);
+        }
+        else {
+            in4->sin_addr = addr4;
+        }
+        e.m_len = sizeof(*in4);
+        endpoints.push_back(e);
+    }
+    if (any || is6) {
+        memset(&e, 0, sizeof(e));
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port_number);
+        in6->sin6_addr = any ? in6addr_any : addr6;
+        e.m_len = sizeof(*in6);
+        endpoints.push_back(e);
+    }
+    if (!endpoints.empty()) {
+        return true;
+    }
+#if defined(MASKUNI_STATIC_LINK)
+    fprintf(stderr, "Error: the static build only takes numeric IPv4 or IPv6 addresses (%s)\n", address);
+    return false;
+#else
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    struct addrinfo *res = NULL;
+    int r = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if (r != 0) {
+        fprintf(stderr, "Error: can't resolve the server address '%s': %s\n", address, gai_strerror(r));
+        return false;
+    }
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        if (ai->ai_addrlen <= sizeof(e.m_addr)) {
+            memcpy(&e.m_addr, ai->ai_addr, ai->ai_addrlen);
+            e.m_len = ai->ai_addrlen;
+            endpoints.push_back(e);
+        }
+    }
+    freeaddrinfo(res);
+    return true;
+#endif
+}
+
+/**
+ * @brief Send a whole line
+ *
+ * @return false on error
+ */
+static bool sendLine(int fd, const char *line)
+{
+    size_t len = strlen(line);
+    while (len) {
+        ssize_t r = ::send(fd, line, len, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return false;
+        }
+        line += r;
+        len -= r;
+    }
+    return true;
+}
+
+/**
+ * @brief Make a socket non-blocking
+ *
+ * @return false on error
+ */
+static bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+constexpr size_t WorkServer::maxPendingOutput;
+
+WorkServer::WorkServer(uint64_t hash, uint64_t begin, uint64_t end, uint64_t chunk) :
+    m_hash(hash), m_next(begin), m_end(end), m_chunk(std::max<uint64_t>(1, chunk)), m_todo(end - begin),
+    m_listen_fd(-1), m_clients(), m_lost()
+{
+}
+
+WorkServer::~WorkServer()
+{
+    for (auto &c : m_clients) {
+        if (c.m_fd >= 0) {
+            close(c.m_fd);
+        }
+    }
+    if (m_listen_fd >= 0) {
+        close(m_listen_fd);
+    }
+}
+
+bool WorkServer::listen(const char *address)
+{
+    std::vector<Endpoint> endpoints;
+    if (!resolveAddress(address, true, endpoints)) {
+        return false;
+    }
+    for (size_t i = 0; i < endpoints.size() && m_listen_fd < 0; i++) {
+        const Endpoint &e = endpoints[i];
+        int fd = socket(e.m_addr.ss_family, SOCK_STREAM, 0);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, reinterpret_cast<const struct sockaddr *>(&e.m_addr), e.m_len) == 0 && ::listen(fd, 64) == 0
+            && setNonBlocking(fd)) {
+            m_listen_fd = fd;
+        }
+        else {
+            close(fd);
+        }
+    }
+    if (m_listen_fd < 0) {
+        fprintf(stderr, "Error: can't listen on '%s': %m\n", address);
+        return false;
+    }
+    return true;
+}
+
+bool WorkServer::queueLine(Client &client, const char *line)
+{
+    client.m_out += line;
+    if (client.m_out.size() > maxPendingOutput) {
+        fprintf(stderr, "Warning: a worker doesn't read the replies of the server, disconnecting it\n");
+        return false;
+    }
+    return flushOutput(client);
+}
+
+bool WorkServer::flushOutput(Client &client)
+{
+    while (!client.m_out.empty()) {
+        ssize_t r = ::send(client.m_fd, client.m_out.data(), client.m_out.size(), MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // the rest is sent once the socket is writable
+            return true;
+        }
+        if (r <= 0) {
+            return false;
+        }
+        client.m_out.erase(0, r);
+    }
+    if (client.m_closing) {
+        close(client.m_fd);
+        client.m_fd = -1;
+    }
+    return true;
+}
+
+bool WorkServer::assign(Client &client)
+{
+    char line[64];
+    if (!m_lost.empty()) {
+        client.m_begin = m_lost.front().first;
+        client.m_end = m_lost.front().second;
+        m_lost.pop_front();
+    }
+    else if (m_next != m_end) {
+        client.m_begin = m_next;
+        client.m_end = m_next + std::min(m_chunk, m_end - m_next);
+        m_next = client.m_end;
+    }
+    else if (m_todo == 0) {
+        // nothing more to say to this worker
+        client.m_waiting = false;
+        client.m_closing = true;
+        return queueLine(client, "END\n");
+    }
+    else {
+        // the chunks of the busy workers may be lost
+        client.m_waiting = true;
+        return true;
+    }
+    client.m_waiting = false;
+    client.m_busy = true;
+    snprintf(line, sizeof(line), "RANGE %" PRIu64 " %" PRIu64 "\n", client.m_begin, client.m_end);
+    return queueLine(client, line);
+}
+
+void WorkServer::drop(Client &client)
+{
+    if (client.m_busy) {
+        fprintf(stderr, "Warning: a worker left without the words %" PRIu64 " to %" PRIu64 ", they will be handed out again\n",
+                client.m_begin, client.m_end - 1);
+        m_lost.emplace_back(client.m_begin, client.m_end);
+        client.m_busy = false;
+    }
+    if (client.m_fd >= 0) {
+        close(client.m_fd);
+        client.m_fd = -1;
+    }
+}
+
+bool WorkServer::handleLine(Client &client, const std::string &line)
+{
+    uint64_t hash, begin, end;
+    if (!client.m_hello) {
+        if (sscanf(line.c_str(), "HELLO %" SCNx64, &hash) != 1) {
+            return false;
+        }
+        if (hash != m_hash) {
+            // best effort, the worker is dropped
+            queueLine(client, "ERROR the masks or the options differ from the server\n");
+            return false;
+        }
+        client.m_hello = true;
+        return queueLine(client, "OK\n");
+    }
+    if (line == "NEXT") {
+        return !client.m_busy && !client.m_waiting && assign(client);
+    }
+    if (sscanf(line.c_str(), "DONE %" SCNu64 " %" SCNu64, &begin, &end) == 2) {
+        if (!client.m_busy || begin != client.m_begin || end != client.m_end) {
+            return false;
+        }
+        client.m_busy = false;
+        m_todo -= end - begin;
+        return true;
+    }
+    return false;
+}
+
+bool WorkServer::run()
+{
+    std::vector<struct pollfd> fds;
+    while (m_todo != 0) {
+        fds.clear();
+        fds.push_back({m_listen_fd, POLLIN, 0});
+        for (const auto &c : m_clients) {
+            fds.push_back({c.m_fd, (short) (c.m_out.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error: can't wait for the workers: %m\n");
+            return false;
+        }
+        for (size_t i = 0; i < m_clients.size(); i++) {
+            Client &c = m_clients[i];
+            const short revents = fds[i + 1].revents;
+            if ((revents & POLLOUT) && !flushOutput(c)) {
+                drop(c);
+                continue;
+            }
+            if (c.m_fd < 0 || !(revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            char buffer[1024];
+            ssize_t r = recv(c.m_fd, buffer, sizeof(buffer), 0);
+            if (r < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+                continue;
+            }
+            if (r <= 0) {
+                drop(c);
+                continue;
+            }
+            c.m_in.append(buffer, r);
+            size_t eol;
+            while (c.m_fd >= 0 && (eol = c.m_in.find('\n')) != std::string::npos) {
+                std::string line = c.m_in.substr(0, eol);
+                c.m_in.erase(0, eol + 1);
+                if (!handleLine(c, line)) {
+                    drop(c);
+                }
+            }
+            if (c.m_fd >= 0 && c.m_in.size() > sizeof(buffer)) {
+                drop(c);
+            }
+        }
+        m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(), [](const Client &c) { return c.m_fd < 0; }),
+                        m_clients.end());
+        // the waiting workers take the lost chunks, or learn that everything is done
+        for (auto &c : m_clients) {
+            if (c.m_fd >= 0 && c.m_waiting && (!m_lost.empty() || m_todo == 0) && !assign(c)) {
+                drop(c);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(m_listen_fd, NULL, NULL);
+            if (fd >= 0 && setNonBlocking(fd)) {
+                m_clients.push_back({fd, std::string(), std::string(), false, false, false, false, 0, 0});
+            }
+            else if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+    // the other workers get the end before asking for it, without waiting for the stalled ones
+    for (auto &c : m_clients) {
+        if (c.m_fd >= 0) {
+            c.m_closing = true;
+            queueLine(c, "END\n");
+        }
+    }
+    return true;
+}
+
+WorkClient::WorkClient(uint64_t hash) :
+    m_hash(hash), m_fd(-1), m_in(), m_busy(false), m_finished(false), m_begin(0), m_end(0)
+{
+}
+
+WorkClient::~WorkClient()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool WorkClient::send(const char *line)
+{
+    if (!sendLine(m_fd, line)) {
+        fprintf(stderr, "Error: lost the connection to the work server\n");
+        return false;
+    }
+    return true;
+}
+
+bool WorkClient::readLine(std::string &line)
+{
+    size_t eol;
+    while ((eol = m_in.find('\n')) == std::string::npos) {
+        char buffer[256];
+        ssize_t r = recv(m_fd, buffer, sizeof(buffer), 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            fprintf(stderr, "Error: lost the connection to the work server\n");
+            return false;
+        }
+        m_in.append(buffer, r);
+    }
+    line = m_in.substr(0, eol);
+    m_in.erase(0, eol + 1);
+    return true;
+}
+
+bool WorkClient::connect(const char *address)
+{
+    std::vector<Endpoint> endpoints;
+    if (!resolveAddress(address, false, endpoints)) {
+        return false;
+    }
+    for (size_t i = 0; i < endpoints.size() && m_fd < 0; i++) {
+        const Endpoint &e = endpoints[i];
+        int fd = socket(e.m_addr.ss_family, SOCK_STREAM, 0);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect(fd, reinterpret_cast<const struct sockaddr *>(&e.m_addr), e.m_len) == 0) {
+            m_fd = fd;
+        }
+        else {
+            close(fd);
+        }
+    }
+    if (m_fd < 0) {
+        fprintf(stderr, "Error: can't connect to the work server '%s': %m\n", address);
+        return false;
+    }
+    char line[64];
+    snprintf(line, sizeof(line), "HELLO %016" PRIx64 "\n", m_hash);
+    std::string reply;
+    if (!send(line) || !readLine(reply)) {
+        return false;
+    }
+    if (reply == "END") {
+        // the server was already done
+        m_finished = true;
+        return true;
+    }
+    if (reply != "OK") {
+        fprintf(stderr, "Error: the work server refused the worker (%s)\n", reply.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool WorkClient::next(uint64_t &begin, uint64_t &end, bool &more)
+{
+    more = false;
+    if (m_finished) {
+        return true;
+    }
+    char line[64];
+    if (m_busy) {
+        snprintf(line, sizeof(line), "DONE %" PRIu64 " %" PRIu64 "\n", m_begin, m_end);
+        if (!send(line)) {
+            return false;
+        }
+        m_busy = false;
+    }
+    std::string reply;
+    if (!send("NEXT\n") || !readLine(reply)) {
+        return false;
+    }
+    if (reply == "END") {
+        m_finished = true;
+        return true;
+    }
+    if (sscanf(reply.c_str(), "RANGE %" SCNu64 " %" SCNu64, &m_begin, &m_end) != 2 || m_begin >= m_end) {
+        fprintf(stderr, "Error: unexpected answer of the work server (%s)\n", reply.c_str());
+        return false;
+    }
+    m_busy = true;
+    begin = m_begin;
+    end = m_end;
+    more = true;
+    return true;
+}
+
+#else
+
+WorkServer::WorkServer(uint64_t hash, uint64_t begin, uint64_t end, uint64_t chunk) :
+    m_hash(hash), m_next(begin), m_end(end), m_chunk(chunk), m_todo(end - begin),
+    m_listen_fd(-1), m_clients(), m_lost()
+{
+}
+
+WorkServer::~WorkServer()
+{
+}
+
+bool WorkServer::listen(const char *)
+{
+    fprintf(stderr, "Error: the work server isn't supported on this platform\n");
+    return false;
+}
+
+bool WorkServer::run()
+{
+    return false;
+}
+
+WorkClient::WorkClient(uint64_t hash) :
+    m_hash(hash), m_fd(-1), m_in(), m_busy(false), m_finished(false), m_begin(0), m_end(0)
+{
+}
+
+WorkClient::~WorkClient()
+{
+}
+
+bool WorkClient::connect(const char *)
+{
+    fprintf(stderr, "Error: the workers aren't supported on this platform\n");
+    return false;
+}
+
+bool WorkClient::next(uint64_t &, uint64_t &, bool &more)
+{
+    more = false;
+    return false;
+}
+
+#endif
+
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2020 Florent Bondoux
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Maskuni {
+
+/**
+ * @brief Coordinator handing out ranges of words to the workers
+ *
+ * The range of the run is cut into chunks of words. Each worker asks for a chunk,
+ * generates it and reports it before asking for the next one, so the fast workers
+ * take more chunks than the slow ones. The chunk of a worker which disconnects before
+ * reporting it is handed out again. The server stops once every chunk is reported.
+ *
+ * The protocol is made of text lines over TCP:
+ * - worker: "HELLO <hash>", server: "OK" or "ERROR <message>"
+ * - worker: "NEXT", server: "RANGE <begin> <end>" or "END" when every chunk is reported
+ * - worker: "DONE <begin> <end>" once the words of its chunk are written
+ *
+ * The hash of the inputs of the worker must match the hash of the server.
+ * The sockets of the workers are non-blocking: the replies are queued and sent when the
+ * sockets are writable, so that a stalled worker doesn't hold up the others.
+ */
+class WorkServer
+{
+    /**
+     * @brief A connected worker
+     */
+    struct Client {
+        int m_fd;               /*!< socket */
+        std::string m_in;       /*!< pending input, without a full line */
+        std::string m_out;      /*!< pending output, sent when the socket is writable */
+        bool m_closing;         /*!< true to close the socket once m_out is sent */
+        bool m_hello;           /*!< true once the hash is checked */
+        bool m_waiting;         /*!< true if the worker asked for a chunk which isn't available yet */
+        bool m_busy;            /*!< true if the worker holds the chunk [m_begin, m_end) */
+        uint64_t m_begin;
+        uint64_t m_end;
+    };
+
+    uint64_t m_hash;            /*!< hash of the inputs */
+    uint64_t m_next;            /*!< first word never handed out */
+    uint64_t m_end;             /*!< after the last word of the run */
+    uint64_t m_chunk;           /*!< number of words of a chunk */
+    uint64_t m_todo;            /*!< number of words not reported yet */
+    int m_listen_fd;            /*!< listening socket */
+    std::vector<Client> m_clients;
+    std::deque<std::pair<uint64_t, uint64_t>> m_lost; /*!< chunks of the disconnected workers */
+
+    static constexpr size_t maxPendingOutput = 4096; /*!< limit of m_out, for the workers not reading the replies */
+
+    bool queueLine(Client &client, const char *line);
+    bool flushOutput(Client &client);
+    bool handleLine(Client &client, const std::string &line);
+    bool assign(Client &client);
+    void drop(Client &client);
+
+public:
+    /**
+     * @brief Create a server for a range of words
+     *
+     * @param hash hash of the inputs of the run
+     * @param begin first word
+     * @param end after the last word
+     * @param chunk number of words handed out at once
+     */
+    WorkServer(uint64_t hash, uint64_t begin, uint64_t end, uint64_t chunk);
+    ~WorkServer();
+
+    /**
+     * @brief Listen for the workers
+     *
+     * @param address "[HOST:]PORT", all the interfaces without HOST
+     * @return false on error
+     */
+    bool listen(const char *address);
+
+    /**
+     * @brief Serve the workers until every chunk is reported
+     *
+     * @return false on error
+     */
+    bool run();
+};
+
+/**
+ * @brief Worker side of a \a WorkServer
+ */
+class WorkClient
+{
+    uint64_t m_hash;            /*!< hash of the inputs */
+    int m_fd;                   /*!< socket */
+    std::string m_in;           /*!< pending input */
+    bool m_busy;                /*!< true if the chunk [m_begin, m_end) must be reported */
+    bool m_finished;            /*!< true once the server has no more chunk */
+    uint64_t m_begin;
+    uint64_t m_end;
+
+    bool send(const char *line);
+    bool readLine(std::string &line);
+
+public:
+    /**
+     * @brief Create a worker
+     *
+     * @param hash hash of the inputs of the run
+     */
+    explicit WorkClient(uint64_t hash);
+    ~WorkClient();
+
+    /**
+     * @brief Connect to the server and check the inputs
+     *
+     * @param address "HOST:PORT"
+     * @return false on error or if the server runs with other inputs
+     */
+    bool connect(const char *address);
+
+    /**
+     * @brief Report the current chunk and get the next one
+     *
+     * The words of the current chunk must be written before.
+     *
+     * @param begin set to the first word of the chunk
+     * @param end set to the position after the last word of the chunk
+     * @param more set to false if there is no more chunk
+     * @return false on error
+     */
+    bool next(uint64_t &begin, uint64_t &end, bool &more);
+};
+
+}
@@ -16,12 +16,20 @@
 
 #include "config.h"
 
+#include <cerrno>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <cinttypes>
+#include <climits>
+#include <cstdlib>
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <string>
 #include <map>
+#include <regex>
 #include <typeinfo>
 
 #include <getopt.h>
@@ -31,9 +39,30 @@
 #include <fcntl.h>
 #include <locale.h>
 
+#ifndef HAVE_GETLINE
+# include "getline.h"
+#endif
+
 #include "ReadMasks.h"
 #include "ReadBruteforce.h"
+#include "MaskIndex.h"
+#include "CompiledIndex.h"
+#include "OutputWriter.h"
+#include "Generate.h"
+#include "GenerateUtf8.h"
+#include "ThreadedGenerator.h"
+#include "WordLocator.h"
+#include "DedupMaskGenerator.h"
+#include "OrderedMaskGenerator.h"
+#include "WordFilter.h"
+#include "BloomFilter.h"
+#include "Permutation.h"
+#include "Stats.h"
+#include "Checkpoint.h"
+#include "WorkServer.h"
+#include "SimdKernels.h"
 #include "utf_conv.h"
+#include "portable_endian.h"
 
 using namespace Maskuni;
 
@@ -43,6 +72,8 @@ static void short_usage()
     "Usage:\n"
     "  maskuni [--mask] [OPTIONS] (mask|maskfile)\n"
     "  maskuni --bruteforce [OPTIONS] brutefile\n"
+    "  maskuni --index=FILE [OPTIONS]\n"
+    "  maskuni (--word-at|--index-of) [OPTIONS] (mask|maskfile|brutefile)\n"
     "Try 'maskuni --help' to get more information.\n";
     printf("%s", help_string);
 }
@@ -55,6 +86,10 @@ static void usage()
     "    maskuni [--mask] [OPTIONS] (mask|maskfile)\n"
     "  bruteforce:\n"
     "    maskuni --bruteforce [OPTIONS] brutefile\n"
+    "  compiled index:\n"
+    "    maskuni --index=FILE [OPTIONS]\n"
+    "  lookups:\n"
+    "    maskuni (--word-at|--index-of) [OPTIONS] (mask|maskfile|brutefile)\n"
     "Generate words based on templates (masks) describing each position's charset\n"
     "\n"
     " Behavior:\n"
@@ -68,8 +103,26 @@ static void usage()
     "  -u, --unicode                Allow UTF-8 characters in the charsets\n"
     "                               Without this option, the charsets can only\n"
     "                               contain 8-bit (ASCII compatible) values\n"
-    "                               This option slows down the generation and\n"
-    "                               disables the '?b' built-in charset\n"
+    "                               This option disables the '?b' built-in\n"
+    "                               charset\n"
+    "      --compile-index=FILE     Write the parsed masks into the binary index\n"
+    "                               FILE and exit\n"
+    "      --index=FILE             Generate the masks stored in the compiled\n"
+    "                               index FILE instead of reading a mask or a\n"
+    "                               bruteforce file (must be used with the same\n"
+    "                               --unicode option as when compiling)\n"
+    "      --order=ORDER            Order of the masks: 'file' (default), 'size'\n"
+    "                               (smallest masks first), 'priority' (highest\n"
+    "                               priorities first) or 'density' (highest\n"
+    "                               priorities per word first)\n"
+    "      --priorities=FILE        Priorities of the masks for --order=priority\n"
+    "                               and --order=density, one number per\n"
+    "                               non-empty line of the mask list\n"
+    "      --dedup                  Don't generate again the words of the previous\n"
+    "                               masks of the same width (the remaining words\n"
+    "                               of a mask may be generated in another order,\n"
+    "                               the cost grows with the number of overlapping\n"
+    "                               masks)\n"
     "\n"
     " Range:\n"
     "  -j, --job=J/N                Divide the generation in N equal parts and\n"
@@ -77,12 +130,95 @@ static void usage()
     "  -b, --begin=N                Start the generation at the Nth word\n"
     "                               counting from 0\n"
     "  -e, --end=N                  Stop after the Nth word counting from 0\n"
+    "      --permute=SEED           Generate the words of the range in a\n"
+    "                               pseudo-random order given by SEED (a\n"
+    "                               number), without --threads\n"
+    "\n"
+    " Filters:\n"
+    "      --max-repeat=N           Drop the words with more than N consecutive\n"
+    "                               identical characters (the words sharing\n"
+    "                               such a prefix are skipped at once)\n"
+    "      --min-classes=N          Drop the words with less than N classes of\n"
+    "                               characters among lowercase, uppercase,\n"
+    "                               digit and other\n"
+    "      --regex=RE               Drop the words not matching the POSIX\n"
+    "                               extended regular expression RE, searched\n"
+    "                               like grep -E\n"
+    "      --exclude=FILE           Drop the words of FILE (one per line),\n"
+    "                               through a Bloom filter with about 0.05% of\n"
+    "                               false positives\n"
+    "\n"
+    " Lookups:\n"
+    "      --word-at                Read word numbers (counting from 0) from the\n"
+    "                               standard input, one per line, and write the\n"
+    "                               matching words instead of generating\n"
+    "      --index-of               Read words from the standard input, one per\n"
+    "                               line, and write their number (first\n"
+    "                               occurrence) instead of generating\n"
+    "                               Both answer each line in order, an empty\n"
+    "                               line for an invalid or unknown input.\n"
+    "                               The range options are ignored\n"
+    "\n"
+    " Threads:\n"
+    "  -t, --threads=N              Generate the words with N worker threads\n"
+    "                               (0 to use all the available cores, at most\n"
+    "                               256)\n"
+    "      --unordered              With --threads, write the blocks of words\n"
+    "                               as soon as they are ready instead of\n"
+    "                               keeping the order of the generation\n"
+    "      --simd                   Use the vectorized generator for the 8-bit\n"
+    "                               masks if the CPU supports it (AVX2, SSSE3\n"
+    "                               or NEON)\n"
     "\n"
     " Output control:\n"
     "  -o, --output=FILE            Write the words into FILE\n"
     "  -z, --zero                   Use the null character as a word delimiter\n"
     "                               instead of the newline character\n"
     "  -n, --no-delim               Don't use a word delimiter\n"
+    "      --format=FMT             Layout of the words: 'text' (default, with\n"
+    "                               the delimiter), 'fixed' (records padded\n"
+    "                               with null characters to the width of the\n"
+    "                               widest mask) or 'blocks' (blocks of words\n"
+    "                               of a single width, each after a header of\n"
+    "                               two 32 bits little-endian integers: the\n"
+    "                               width and the number of words). The words\n"
+    "                               are written without delimiter, in UTF-32LE\n"
+    "                               with --unicode\n"
+    "      --buffer-size=KIB        Size of the output buffer in KiB (default:\n"
+    "                               8192 characters, 256 with --vmsplice)\n"
+    "      --vmsplice               When the output is a pipe, give the output\n"
+    "                               buffers to the pipe instead of copying them\n"
+    "                               (Linux only, the reader must not splice the\n"
+    "                               data further)\n"
+    "      --write-buffers=N        Write the output from a separate thread with\n"
+    "                               a ring of N buffers (default: 1, write from\n"
+    "                               the generating thread)\n"
+    "      --checkpoint=FILE        Save the position of the next word into FILE\n"
+    "                               periodically and at the end, after flushing\n"
+    "                               the output\n"
+    "      --checkpoint-interval=SECONDS\n"
+    "                               Seconds between two checkpoints (default:\n"
+    "                               60, 0 to only save the end)\n"
+    "      --resume=FILE            Continue the run saved into the checkpoint\n"
+    "                               FILE (with the same masks and options, but\n"
+    "                               without the range options). The output file\n"
+    "                               is cut after the saved words and appended.\n"
+    "                               A missing FILE starts from the beginning\n"
+    "      --serve=[HOST:]PORT      Hand out the range of words in chunks to the\n"
+    "                               workers connecting to PORT instead of\n"
+    "                               generating it\n"
+    "      --worker=HOST:PORT       Generate the chunks given by the server at\n"
+    "                               HOST:PORT until the whole range is done\n"
+    "                               (HOST is an IPv4 or IPv6 address, the host\n"
+    "                               names aren't resolved by the static build)\n"
+    "      --chunk=N                Number of words of a chunk (default:\n"
+    "                               100000000)\n"
+    "      --stats[=SECONDS]        Print the progress on stderr every SECONDS\n"
+    "                               (default: 10, 0 to disable) and a summary\n"
+    "                               of the timings at the end\n"
+    "      --stats-json=FILE        Write the timings and the counters of each\n"
+    "                               mask as JSON into FILE at the end (a file\n"
+    "                               descriptor N can be given as /dev/fd/N)\n"
     "  -s, --size                   Show the number of words that will be\n"
     "                               generated and exit\n"
     "  -h, --help                   Show this help message and exit\n"
@@ -135,6 +271,8 @@ static void usage()
     "\n"
     "  The mask argument is either a single mask definition or a file\n"
     "  containing a list of masks definitions.\n"
+    "  A pipe (like /dev/stdin) is read while generating, without --job,\n"
+    "  --end, --size, --permute, --threads or --format.\n"
     "\n"
     "  Mask files can also embed charset definitions. The general syntax for\n"
     "  a single line is:\n"
@@ -168,9 +306,26 @@ static void usage()
     printf("%s", help_string);
 }
 
+/**
+ * @brief Layout of the generated words
+ */
+enum OutputFormat {
+    FORMAT_TEXT,    /*!< words followed by a delimiter */
+    FORMAT_FIXED,   /*!< words padded with null characters to the width of the widest mask */
+    FORMAT_BLOCKS,  /*!< blocks of words of a single width, after a header giving the width and the count */
+};
+
 struct Options {
     bool m_unicode;
     bool m_bruteforce;
+    bool m_dedup;
+    MaskOrder m_order;
+    std::string m_priorities_file;
+    unsigned int m_max_repeat;
+    unsigned int m_min_classes;
+    std::string m_regex;
+    bool m_regex_set;
+    std::string m_exclude_file;
     uint64_t m_job_number;
     uint64_t m_job_total;
     bool m_job_set;
@@ -181,18 +336,51 @@ struct Options {
     std::string m_output_file;
     bool m_zero_delim;
     bool m_no_delim;
+    OutputFormat m_format;
     bool m_print_size;
+    unsigned int m_threads;
+    bool m_unordered;
+    bool m_simd;
+    size_t m_buffer_size;
+    bool m_vmsplice;
+    unsigned int m_write_buffers;
+    bool m_permute;
+    uint64_t m_permute_seed;
+    bool m_stats;
+    unsigned int m_stats_interval;
+    std::string m_stats_json;
+    std::string m_checkpoint_file;
+    unsigned int m_checkpoint_interval;
+    std::string m_resume_file;
+    std::string m_serve;
+    std::string m_worker;
+    uint64_t m_chunk;
+    bool m_word_at;
+    bool m_index_of;
+    std::string m_compile_index;
+    std::string m_index_file;
     std::vector<std::pair<int, std::string>> m_charsets_opts; // for -1, -2, ... -4 arguments (with the number in the first value)
                                                                // or -c k:def arguments (with 0 in the first value)
     
     Options() :
     m_unicode(false)
     , m_bruteforce(false)
+    , m_dedup(false), m_order(ORDER_FILE), m_priorities_file()
+    , m_max_repeat(0), m_min_classes(0), m_regex(), m_regex_set(false), m_exclude_file()
     , m_job_number(), m_job_total(), m_job_set(false)
     , m_start_word(), m_start_word_set(false), m_end_word(), m_end_word_set(false)
     , m_output_file()
-    , m_zero_delim(false), m_no_delim(false)
+    , m_zero_delim(false), m_no_delim(false), m_format(FORMAT_TEXT)
     , m_print_size(false)
+    , m_threads(1), m_unordered(false)
+    , m_simd(false)
+    , m_buffer_size(0), m_vmsplice(false), m_write_buffers(1)
+    , m_permute(false), m_permute_seed(0)
+    , m_stats(false), m_stats_interval(10), m_stats_json()
+    , m_checkpoint_file(), m_checkpoint_interval(60), m_resume_file()
+    , m_serve(), m_worker(), m_chunk(100000000)
+    , m_word_at(false), m_index_of(false)
+    , m_compile_index(), m_index_file()
     , m_charsets_opts()
     {}
 };
@@ -200,13 +388,13 @@ struct Options {
 struct Helper8bit {
     class Print8bit
     {
+        OutputWriter &m_writer;
+
     public:
-        inline void print(const char *buffer, size_t len, int fdout)
+        explicit Print8bit(OutputWriter &writer) : m_writer(writer) {}
+        inline void print(const char *buffer, size_t len)
         {
-            if (write(fdout, buffer, len) != (ssize_t) len) {
-                fprintf(stderr, "Error while writing the output data: %m");
-                exit(1);
-            }
+            m_writer.write(buffer, len);
         }
     };
     typedef char CharType;
@@ -239,6 +427,19 @@ struct Helper8bit {
     {
         return readBruteforceAscii(spec, default_charsets);
     }
+    static inline bool writeCompiledIndex(const char *filename, MaskGenerator<char> &gen)
+    {
+        return writeCompiledIndexAscii(filename, gen);
+    }
+    static inline MaskGenerator<char> *readCompiledIndex(const char *filename, MaskIndex &index, size_t &max_width)
+    {
+        return readCompiledIndexAscii(filename, index, max_width);
+    }
+    static inline bool decodeWord(const char *input, size_t input_len, std::vector<char> &word)
+    {
+        word.assign(input, input + input_len);
+        return true;
+    }
     static constexpr int maxCharReprLen = 2;
     static void charToString(char c, char *str)
     {
@@ -250,23 +451,21 @@ struct Helper8bit {
 struct HelperUnicode {
     class PrintUnicode
     {
+        OutputWriter &m_writer;
         char *conv_buffer;
         size_t conv_buffer_size;
 
     public:
-        PrintUnicode() : conv_buffer(NULL), conv_buffer_size(0) {}
+        explicit PrintUnicode(OutputWriter &writer) : m_writer(writer), conv_buffer(NULL), conv_buffer_size(0) {}
         ~PrintUnicode()
         {
             free(conv_buffer);
         };
-        inline void print(const uint32_t *buffer, size_t len, int fdout)
+        inline void print(const uint32_t *buffer, size_t len)
         {
             size_t consumed = 0, written = 0;
             if (UTF::encode_utf8(buffer, len, &conv_buffer, &conv_buffer_size, &consumed, &written) == UTF::RetCode::OK) {
-                if (write(fdout, conv_buffer, written) != (ssize_t) written) {
-                    fprintf(stderr, "Error while writing the output data: %m");
-                    exit(1);
-                }
+                m_writer.write(conv_buffer, written);
             } else {
                 fprintf(stderr, "Error: could not encode the generated words into UTF-8\n");
                 exit(1);
@@ -306,60 +505,1041 @@ struct HelperUnicode {
     }
     static inline bool expandCharset(CharsetMap<uint32_t> &charsets, uint32_t charset_name)
     {
-        return expandCharsetUnicode(charsets, charset_name);
+        return expandCharsetUnicode(charsets, charset_name);
+    }
+    static inline MaskGenerator<uint32_t> *readMaskList(const char *spec, const CharsetMap<uint32_t> &default_charsets)
+    {
+        return readMaskListUtf8(spec, default_charsets);
+    }
+    static inline MaskGenerator<uint32_t> *readBruteforceConstraints(const char *spec, const CharsetMap<uint32_t> &default_charsets)
+    {
+        return readBruteforceUtf8(spec, default_charsets);
+    }
+    static inline bool writeCompiledIndex(const char *filename, MaskGenerator<uint32_t> &gen)
+    {
+        return writeCompiledIndexUtf8(filename, gen);
+    }
+    static inline MaskGenerator<uint32_t> *readCompiledIndex(const char *filename, MaskIndex &index, size_t &max_width)
+    {
+        return readCompiledIndexUtf8(filename, index, max_width);
+    }
+    static inline bool decodeWord(const char *input, size_t input_len, std::vector<uint32_t> &word)
+    {
+        size_t consumed = 0, written = 0;
+        word.clear();
+        return UTF::decode_utf8(input, input_len, std::back_inserter(word), &consumed, &written) == UTF::RetCode::OK
+            && consumed == input_len;
+    }
+    static constexpr int maxCharReprLen = 5;
+    static void charToString(uint32_t c, char *str)
+    {
+        int l = UTF::impl::CpToUtf8::write(c, str);
+        str[l] = 0;
+    }
+};
+
+/**
+ * @brief Read the priorities of the masks, one non-negative number per line
+ *
+ * @param filename file
+ * @param priorities receives the priorities
+ * @return false if the file can't be read or if a line is not a valid priority
+ */
+static bool readPriorities(const char *filename, std::vector<double> &priorities)
+{
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: can't open the priorities file '%s': %m\n", filename);
+        return false;
+    }
+    char *line = NULL;
+    size_t line_size = 0;
+    unsigned int line_number = 0;
+    bool ok = true;
+    while (ok && getline(&line, &line_size, f) >= 0) {
+        line_number++;
+        char *end = NULL;
+        double p = strtod(line, &end);
+        while (end != line && (*end == '\n' || *end == '\r' || *end == ' ' || *end == '\t')) {
+            end++;
+        }
+        ok = end != line && *end == 0 && std::isfinite(p) && p >= 0;
+        if (ok) {
+            priorities.push_back(p);
+        }
+        else {
+            fprintf(stderr, "Error: wrong priority in '%s' at line %u\n", filename, line_number);
+        }
+    }
+    free(line);
+    fclose(f);
+    return ok;
+}
+
+/**
+ * @brief Parse a decimal word position
+ *
+ * @param s digits
+ * @param len number of digits
+ * @param value set to the parsed value
+ * @return false if the string is not a number or if it overflows a 64 bits integer
+ */
+static bool parsePosition(const char *s, size_t len, uint64_t &value)
+{
+    uint64_t v = 0;
+    if (len == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') {
+            return false;
+        }
+        if (umul64_overflow(v, 10, &v) || uadd64_overflow(v, s[i] - '0', &v)) {
+            return false;
+        }
+    }
+    value = v;
+    return true;
+}
+
+/**
+ * @brief Answer the lookups read from the standard input until its end
+ *
+ * Each input line is either a word position, answered with the word (\a index_of is false),
+ * or a word, answered with the position of its first occurrence (\a index_of is true).
+ * An invalid line, a position out of range or a word which is not generated is answered
+ * with an empty line.
+ *
+ * The lines are handled in batches of whatever is available on the input, the answers
+ * of a batch are written and flushed together. The positions are found with \a locator,
+ * the words with a single pass over the masks for each batch.
+ *
+ * @param gen generator of the masks
+ * @param locator locator over \a gen
+ * @param index_of true to read words, false to read positions
+ * @param delim delimiter written after each answer
+ * @param printer printer of the answers
+ * @param writer writer used by \a printer
+ * @return 0 or 1 on error
+ */
+template<typename T, typename Helper>
+int answerLookups(MaskGenerator<T> &gen, WordLocator<T> &locator, bool index_of, T delim,
+                  typename Helper::Printer &printer, OutputWriter &writer)
+{
+    std::vector<char> input(1 << 16);
+    size_t filled = 0;
+    bool eof = false;
+    std::vector<T> answers, word;
+    std::vector<std::vector<T>> words;  // words of the batch
+    std::vector<uint64_t> found;        // position of each word or UINT64_MAX
+    std::vector<bool> resolved;
+    while (!eof) {
+        if (filled == input.size()) {
+            input.resize(input.size() * 2);
+        }
+        ssize_t r = read(STDIN_FILENO, input.data() + filled, input.size() - filled);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0) {
+            fprintf(stderr, "Error while reading the lookups: %m\n");
+            return 1;
+        }
+        eof = r == 0;
+        filled += r;
+
+        // split the complete lines, the last line doesn't need a newline at the end of the input
+        std::vector<std::pair<size_t, size_t>> lines;
+        size_t begin = 0;
+        for (size_t i = 0; i < filled; i++) {
+            if (input[i] == '\n') {
+                lines.emplace_back(begin, i - begin);
+                begin = i + 1;
+            }
+        }
+        if (eof && begin < filled) {
+            lines.emplace_back(begin, filled - begin);
+            begin = filled;
+        }
+        for (auto &l : lines) {
+            if (l.second && input[l.first + l.second - 1] == '\r') {
+                l.second--;
+            }
+        }
+
+        answers.clear();
+        if (!index_of) {
+            for (const auto &l : lines) {
+                uint64_t word_idx, offset;
+                if (parsePosition(input.data() + l.first, l.second, word_idx) && locator.locate(word_idx, offset)) {
+                    const Mask<T> &mask = locator.getMask();
+                    size_t o = answers.size();
+                    answers.resize(o + mask.getWidth());
+                    mask.wordAt(offset, answers.data() + o);
+                }
+                answers.push_back(delim);
+            }
+        }
+        else {
+            words.resize(lines.size());
+            found.assign(lines.size(), UINT64_MAX);
+            resolved.assign(lines.size(), false);
+            size_t n_pending = 0;
+            for (size_t i = 0; i < lines.size(); i++) {
+                if (Helper::decodeWord(input.data() + lines[i].first, lines[i].second, words[i]) && !words[i].empty()) {
+                    n_pending++;
+                }
+                else {
+                    resolved[i] = true;
+                }
+            }
+            if (n_pending) {
+                gen.reset();
+                Mask<T> mask;
+                uint64_t mask_start = 0;
+                while (n_pending && gen(mask)) {
+                    for (size_t i = 0; i < words.size(); i++) {
+                        uint64_t o;
+                        if (!resolved[i] && words[i].size() == mask.getWidth() && mask.indexOf(words[i].data(), o)) {
+                            found[i] = mask_start + o;
+                            resolved[i] = true;
+                            n_pending--;
+                        }
+                    }
+                    mask_start += mask.getLen();
+                }
+                if (!gen.good()) {
+                    fprintf(stderr, "Error while reading the masks for the lookups\n");
+                    return 1;
+                }
+            }
+            for (size_t i = 0; i < found.size(); i++) {
+                if (found[i] != UINT64_MAX) {
+                    char n[24];
+                    int l = snprintf(n, sizeof(n), "%" PRIu64, found[i]);
+                    answers.insert(answers.end(), n, n + l);
+                }
+                answers.push_back(delim);
+            }
+        }
+        if (!answers.empty()) {
+            printer.print(answers.data(), answers.size());
+            writer.flush();
+        }
+
+        filled -= begin;
+        memmove(input.data(), input.data() + begin, filled);
+    }
+    return 0;
+}
+
+/**
+ * @brief Generate a range of words in a pseudo-random order
+ *
+ * The positions of [start_idx, start_idx + count) are permuted by an \a IndexPermutation
+ * and unranked in batches. When the range doesn't span too many masks, its masks are loaded
+ * once and each word is found by a binary search over them. Otherwise the words of a batch
+ * out of the current mask are sorted so that the locator only moves forward through the masks.
+ * The words are then written in the permuted order.
+ *
+ * @param locator locator over the masks
+ * @param start_idx first word
+ * @param count number of words
+ * @param seed seed of the permutation
+ * @param max_width width of the widest mask
+ * @param delim delimiter
+ * @param delim_width 0 or 1 (with or without delimiter)
+ * @param printer printer of the words
+ * @param written_words counter incremented after each batch, may be NULL
+ * @return false if a word could not be located
+ */
+template<typename T, typename Helper>
+bool generatePermuted(WordLocator<T> &locator, uint64_t start_idx, uint64_t count, uint64_t seed,
+                      size_t max_width, T delim, int delim_width, typename Helper::Printer &printer,
+                      std::atomic<uint64_t> *written_words)
+{
+    static constexpr size_t max_masks = 1 << 16;
+    // about 1M characters per batch
+    const size_t batch_size = std::max<size_t>(4096, (1 << 20) / std::max<size_t>(1, max_width));
+    const uint64_t end_idx = start_idx + count;
+
+    // the masks of the range and the number of words before each of them
+    std::vector<Mask<T>> masks;
+    std::vector<uint64_t> starts;
+    uint64_t offset;
+    uint64_t w = start_idx;
+    while (w < end_idx && masks.size() < max_masks && locator.locate(w, offset)) {
+        masks.push_back(locator.getMask());
+        starts.push_back(w - offset);
+        w = starts.back() + masks.back().getLen();
+    }
+    if (w < end_idx) {
+        // too many masks, they are located for each batch
+        masks.clear();
+        starts.clear();
+    }
+
+    IndexPermutation permutation(count, seed);
+    std::vector<std::pair<uint64_t, uint32_t>> misses;  // words out of the current mask and their rank in the batch
+    std::vector<T> words(batch_size * max_width);
+    std::vector<size_t> widths(batch_size);
+    std::vector<T> out;
+    auto unrank = [&](size_t j, const Mask<T> &mask, uint64_t o) {
+        mask.wordAt(o, words.data() + j * max_width);
+        widths[j] = mask.getWidth();
+    };
+    for (uint64_t i = 0; i < count; ) {
+        size_t n = (size_t) std::min<uint64_t>(batch_size, count - i);
+        misses.clear();
+        for (size_t j = 0; j < n; j++) {
+            uint64_t word_idx = start_idx + permutation(i + j);
+            if (!masks.empty()) {
+                size_t k = std::upper_bound(starts.begin(), starts.end(), word_idx) - starts.begin() - 1;
+                unrank(j, masks[k], word_idx - starts[k]);
+            }
+            else if (locator.locateLoaded(word_idx, offset)) {
+                unrank(j, locator.getMask(), offset);
+            }
+            else {
+                misses.emplace_back(word_idx, (uint32_t) j);
+            }
+        }
+        i += n;
+        std::sort(misses.begin(), misses.end());
+        for (const auto &m : misses) {
+            if (!locator.locate(m.first, offset)) {
+                fprintf(stderr, "Error: can't seek to the word %" PRIu64 " (that wasn't expected!)\n", m.first);
+                return false;
+            }
+            unrank(m.second, locator.getMask(), offset);
+        }
+        out.clear();
+        for (size_t j = 0; j < n; j++) {
+            const T *w = words.data() + j * max_width;
+            out.insert(out.end(), w, w + widths[j]);
+            if (delim_width) {
+                out.push_back(delim);
+            }
+        }
+        printer.print(out.data(), out.size());
+        if (written_words) {
+            written_words->fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Generate a range of words as fixed-stride records or as blocks
+ *
+ * The words are written without delimiter, as 8-bit characters or as UTF-32LE codepoints.
+ * With FORMAT_FIXED, each word is padded with null characters to \a max_width.
+ * With FORMAT_BLOCKS, the words of a mask are grouped in blocks of at most \a buffer_len characters,
+ * each one written after a header of two 32 bits little-endian integers: the width of the words
+ * and their number.
+ *
+ * @param gen generator of the masks, right after \a mask
+ * @param mask mask holding the first word
+ * @param start position of the first word in \a mask
+ * @param count number of words
+ * @param format FORMAT_FIXED or FORMAT_BLOCKS
+ * @param max_width width of the widest mask
+ * @param buffer_len maximum number of characters of a block, at least \a max_width
+ * @param writer output
+ * @param written_words counter incremented after each block, may be NULL
+ */
+template<typename T>
+void generateRecords(MaskGenerator<T> &gen, Mask<T> &mask, uint64_t start, uint64_t count, OutputFormat format,
+                     size_t max_width, size_t buffer_len, OutputWriter &writer, std::atomic<uint64_t> *written_words)
+{
+    std::vector<T> word(max_width + 1);
+    std::vector<T> words(buffer_len + 1);   // the generation loops may write a delimiter after the last word
+    std::vector<T> records;
+    // the buffer is never full
+    auto flush = [](OutputBuffer<T> &) {
+        abort();
+    };
+    while (count) {
+        const size_t width = mask.getWidth();
+        const size_t stride = format == FORMAT_FIXED ? max_width : width;
+        uint64_t n = std::min<uint64_t>(count, mask.getLen() - start);
+        n = std::min<uint64_t>(n, buffer_len / std::max<size_t>(stride, 1));
+        OutputBuffer<T> out = {words.data(), words.data(), words.data() + n * width + 1};
+        generateWords(mask, start, n, T(0), 0, word.data(), out, flush);
+
+        T *p = words.data();
+        if (format == FORMAT_BLOCKS) {
+            uint32_t header[2] = {htole32((uint32_t) width), htole32((uint32_t) n)};
+            writer.write(reinterpret_cast<const char *>(header), sizeof(header));
+        }
+        else if (stride != width) {
+            records.assign(n * stride, T(0));
+            for (uint64_t i = 0; i < n; i++) {
+                std::copy(p + i * width, p + (i + 1) * width, records.data() + i * stride);
+            }
+            p = records.data();
+        }
+        if (sizeof(T) == sizeof(uint32_t)) {
+            for (size_t i = 0; i < n * stride; i++) {
+                p[i] = htole32(p[i]);
+            }
+        }
+        writer.write(reinterpret_cast<const char *>(p), n * stride * sizeof(T));
+        if (written_words) {
+            written_words->fetch_add(n, std::memory_order_relaxed);
+        }
+
+        count -= n;
+        start += n;
+        if (count && start == mask.getLen()) {
+            gen(mask);
+            start = 0;
+        }
+    }
+}
+
+/**
+ * @brief Hash the masks and the options giving the words
+ *
+ * A checkpoint is only resumed, and a worker only served, with the same hash.
+ *
+ * @param options options
+ * @param mask_arg mask argument, NULL with a compiled index
+ * @return the hash
+ */
+static uint64_t hashInputs(const Options &options, const char *mask_arg)
+{
+    uint64_t hash = Checkpoint::hashInit;
+    const char flags[4] = {options.m_unicode ? 'u' : '-', options.m_bruteforce ? 'B' : '-', options.m_dedup ? 'D' : '-',
+                           (char) ('0' + options.m_order)};
+    Checkpoint::hashBytes(hash, flags, sizeof(flags));
+    if (!options.m_priorities_file.empty()) {
+        Checkpoint::hashFile(hash, options.m_priorities_file.c_str());
+    }
+    // the filters change the output, not the positions
+    const unsigned int rules[2] = {options.m_max_repeat, options.m_min_classes};
+    Checkpoint::hashBytes(hash, rules, sizeof(rules));
+    Checkpoint::hashBytes(hash, options.m_regex.c_str(), options.m_regex_set ? options.m_regex.size() + 1 : 0);
+    if (!options.m_exclude_file.empty()) {
+        Checkpoint::hashFile(hash, options.m_exclude_file.c_str());
+    }
+    for (const auto &p : options.m_charsets_opts) {
+        Checkpoint::hashBytes(hash, &p.first, sizeof(p.first));
+        Checkpoint::hashBytes(hash, p.second.c_str(), p.second.size() + 1);
+    }
+    const char *input = options.m_index_file.empty() ? mask_arg : options.m_index_file.c_str();
+    if (!Checkpoint::hashFile(hash, input)) {
+        Checkpoint::hashBytes(hash, input, strlen(input));
+    }
+    return hash;
+}
+
+/**
+ * @brief Report an invalid mask list or invalid bruteforce constraints
+ *
+ * @param options options
+ * @param mask_arg mask argument
+ */
+static void reportMasksError(const Options &options, const char *mask_arg)
+{
+    if (!options.m_bruteforce) {
+        fprintf(stderr, "Error while reading the mask definition '%s'\n", mask_arg);
+    }
+    else {
+        fprintf(stderr, "Error while reading the bruteforce constraints from '%s'\n", mask_arg);
+    }
+}
+
+/**
+ * @brief Create the filter of the words from --max-repeat, --min-classes, --regex and --exclude
+ *
+ * @param options options
+ * @param filter receives the filter, left empty without any filtering option
+ * @return false if the regular expression or the excluded words can't be read
+ */
+template<typename T>
+bool createFilter(const Options &options, std::unique_ptr<WordFilter<T>> &filter)
+{
+    if (!options.m_max_repeat && !options.m_min_classes && !options.m_regex_set && options.m_exclude_file.empty()) {
+        return true;
+    }
+    std::shared_ptr<const std::regex> regex;
+    std::shared_ptr<const BloomFilter> exclude;
+    if (options.m_regex_set) {
+        try {
+            regex = std::make_shared<const std::regex>(options.m_regex, std::regex::extended | std::regex::nosubs);
+        }
+        catch (const std::regex_error &e) {
+            fprintf(stderr, "Error: wrong regular expression '%s' (%s)\n", options.m_regex.c_str(), e.what());
+            return false;
+        }
+    }
+    if (!options.m_exclude_file.empty()) {
+        exclude.reset(BloomFilter::readWords(options.m_exclude_file.c_str()));
+        if (!exclude) {
+            return false;
+        }
+    }
+    filter.reset(new WordFilter<T>(options.m_max_repeat, options.m_min_classes, regex, exclude));
+    return true;
+}
+
+/**
+ * @brief Open the generator of the masks
+ *
+ * The masks are read from a compiled index, a mask list or bruteforce constraints.
+ * The masks of a list or of constraints are then reordered by --order and deduplicated by --dedup.
+ *
+ * @param options options
+ * @param mask_arg mask argument, NULL with a compiled index
+ * @param charsets charsets of the masks
+ * @param mask_index receives the index of a compiled index
+ * @param max_width receives the width of the widest mask of a compiled index
+ * @return the generator or NULL on error
+ */
+template<typename T, typename Helper>
+MaskGenerator<T> *openMasks(const Options &options, const char *mask_arg, const CharsetMap<T> &charsets,
+                            MaskIndex &mask_index, size_t &max_width)
+{
+    if (!options.m_index_file.empty()) {
+        // the masks are already validated and sized
+        return Helper::readCompiledIndex(options.m_index_file.c_str(), mask_index, max_width);
+    }
+
+    MaskGenerator<T> *gen = NULL;
+    if (!options.m_bruteforce) {
+        gen = Helper::readMaskList(mask_arg, charsets);
+    }
+    else {
+        gen = Helper::readBruteforceConstraints(mask_arg, charsets);
+    }
+    if (!gen) {
+        reportMasksError(options, mask_arg);
+        return NULL;
+    }
+
+    if (options.m_order != ORDER_FILE) {
+        // the masks are sized and sorted once, then read again in the new order
+        std::vector<double> priorities;
+        if (!options.m_priorities_file.empty() && !readPriorities(options.m_priorities_file.c_str(), priorities)) {
+            delete gen;
+            return NULL;
+        }
+        if (!gen->canReset()) {
+            fprintf(stderr, "Error: the masks read from a stream can't be reordered\n");
+            delete gen;
+            return NULL;
+        }
+        OrderedMaskGenerator<T> *ordered = new OrderedMaskGenerator<T>(gen);
+        gen = ordered;
+        if (!ordered->sort(options.m_order, priorities)) {
+            if (!gen->good()) {
+                reportMasksError(options, mask_arg);
+            }
+            delete gen;
+            return NULL;
+        }
+    }
+    if (options.m_dedup) {
+        // the words of the overlapping masks are only generated once
+        gen = new DedupMaskGenerator<T>(gen);
+    }
+    return gen;
+}
+
+/**
+ * @brief Size the masks before the generation
+ *
+ * Some generators count their words directly and seek to any word.
+ * Otherwise a first pass through the generator checks if every mask is valid and builds
+ * a sampled index of the masks' offsets for the seek to the start position.
+ * The caller checks the state of the generator afterwards.
+ *
+ * @param gen generator of the masks
+ * @param mask_index receives the sizes of the masks unless the words are counted
+ * @param len receives the number of words if they're counted
+ * @param max_width receives the width of the widest mask
+ * @return true if the words were counted without a sizing pass
+ */
+template<typename T>
+bool sizeMasks(MaskGenerator<T> &gen, MaskIndex &mask_index, uint64_t &len, size_t &max_width)
+{
+    if (gen.countWords(len, max_width)) {
+        return true;
+    }
+    uint64_t size;
+    size_t width;
+    while (gen.good() && gen(size, width)) {
+        if (!mask_index.push(size)) {
+            fprintf(stderr, "Error: the total number of words would overflow a 64 bits integer\n");
+            abort();
+        }
+        max_width = std::max<size_t>(max_width, width);
+    }
+    return false;
+}
+
+/**
+ * @brief Get the range of words to generate from --job, --begin and --end or from the resumed checkpoint
+ *
+ * @param options options
+ * @param len number of words of the masks, UINT64_MAX when the masks are sized while generating
+ * @param lazy true if the masks are sized while generating
+ * @param resume resumed checkpoint, NULL without checkpoint to resume
+ * @param start receives the first word
+ * @param end receives the position after the last word, 0 for a worker taking its ranges from the server
+ * @return false if the range is not valid
+ */
+static bool getRange(const Options &options, uint64_t len, bool lazy, const CheckpointState *resume,
+                     uint64_t &start, uint64_t &end)
+{
+    start = 0;
+    end = len; // after the last word
+
+    if (options.m_job_set) {
+        // create our staring position and the number of word to generate
+        // from a job spec
+        // the remainder is distributed on the first jobs
+        uint64_t q = len / options.m_job_total;
+        uint64_t r = len - q * options.m_job_total;
+
+        uint64_t todo = q;
+        start = q * (options.m_job_number - 1);
+        if (r != 0) {
+            start += std::min((uint64_t) options.m_job_number - 1, r);
+            todo += options.m_job_number <= r ? 1 : 0;
+        }
+        end = start + todo;
+    }
+    else if (!options.m_worker.empty()) {
+        // the ranges are given by the work server once generating
+        end = 0;
+    }
+    else if (resume) {
+        // continue the range of the checkpoint
+        start = resume->m_next;
+        if (resume->m_end != UINT64_MAX) {
+            end = resume->m_end;
+        }
+        if (start > end || end > len) {
+            fprintf(stderr, "Error: the checkpoint '%s' doesn't match the masks\n", options.m_resume_file.c_str());
+            return false;
+        }
+    }
+    else {
+        if (options.m_start_word_set) {
+            start = options.m_start_word;
+        }
+        if (options.m_end_word_set) {
+            end = options.m_end_word + 1;
+        }
+
+        if (!lazy && (end - 1 < start || end > len)) {
+            fprintf(stderr, "Error: the last word number is not valid\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Open the output file, or use the standard output without --output
+ *
+ * A resumed output file is cut after the words of the checkpoint.
+ *
+ * @param options options
+ * @param resume resumed checkpoint, NULL without checkpoint to resume
+ * @return the file descriptor or -1 on error
+ */
+static int openOutput(const Options &options, const CheckpointState *resume)
+{
+    if (options.m_output_file.empty()) {
+        return STDOUT_FILENO;
+    }
+    const int trunc = resume ? 0 : O_TRUNC;
+#if defined(__WINDOWS__)
+    int fdout = open(options.m_output_file.c_str(), O_WRONLY | trunc | O_CREAT | O_BINARY, S_IRUSR|S_IWUSR);
+#else
+    int fdout = open(options.m_output_file.c_str(), O_WRONLY | trunc | O_CREAT, S_IRUSR|S_IWUSR);
+#endif
+    if (fdout < 0) {
+        fprintf(stderr, "Error: can't open the output file: %m\n");
+        return -1;
+    }
+    struct stat st;
+    if (resume && (fstat(fdout, &st) != 0 || (uint64_t) st.st_size < resume->m_bytes
+                   || ftruncate(fdout, resume->m_bytes) != 0 || lseek(fdout, 0, SEEK_END) < 0)) {
+        fprintf(stderr, "Error: the output file is shorter than the checkpoint '%s'\n", options.m_resume_file.c_str());
+        close(fdout);
+        return -1;
+    }
+    return fdout;
+}
+
+/**
+ * @brief Position of the text generation in the range of words
+ *
+ * Shared by the text generation loops: it moves to the next mask (checking it when the masks
+ * are sized while generating), records the statistics of each chunk, saves the checkpoints
+ * and, for a worker, takes the next range from the work server.
+ */
+template<typename T>
+struct TextRun {
+    const Options &m_options;
+    const char *m_mask_arg;         /*!< mask argument, for the error messages */
+    MaskGenerator<T> &m_gen;
+    WordLocator<T> &m_locator;
+    Mask<T> &m_mask;                /*!< current mask, held by m_locator */
+    OutputWriter &m_writer;
+    bool m_lazy;                    /*!< the masks are sized while generating */
+    size_t m_width_limit;           /*!< widest mask allowed when sizing while generating */
+    uint64_t m_len;                 /*!< number of words of the masks, UINT64_MAX when sizing while generating */
+    Stats *m_stats;                 /*!< may be NULL */
+    Checkpoint *m_checkpoint;       /*!< may be NULL */
+    WorkClient *m_client;           /*!< may be NULL */
+    uint64_t m_inputs_hash;         /*!< hash of the inputs saved in the checkpoints */
+    uint64_t m_end;                 /*!< end of the range saved in the checkpoints, UINT64_MAX when unknown */
+    uint64_t m_bytes_before;        /*!< size of the output before this run */
+    std::vector<T> m_word;          /*!< scratch word, longer than the current mask */
+    uint64_t m_start;               /*!< position of the next word in m_mask */
+    uint64_t m_todo;                /*!< number of words left, UINT64_MAX when sizing while generating */
+    uint64_t m_mask_first;          /*!< global position of the first word of m_mask */
+    uint64_t m_mask_number;         /*!< index of m_mask, only known when sizing while generating */
+    bool m_error;                   /*!< the generation stopped on an error, m_todo is then 0 */
+    uint64_t m_chunk_time;
+    uint64_t m_chunk_bytes;
+
+    TextRun(const Options &options, const char *mask_arg, MaskGenerator<T> &gen, WordLocator<T> &locator,
+            OutputWriter &writer, bool lazy, size_t width_limit, uint64_t len, size_t max_width) :
+    m_options(options), m_mask_arg(mask_arg), m_gen(gen), m_locator(locator), m_mask(locator.getMask())
+    , m_writer(writer), m_lazy(lazy), m_width_limit(width_limit), m_len(len)
+    , m_stats(NULL), m_checkpoint(NULL), m_client(NULL), m_inputs_hash(0), m_end(UINT64_MAX), m_bytes_before(0)
+    , m_word(max_width + 1), m_start(0), m_todo(0), m_mask_first(0), m_mask_number(UINT64_MAX), m_error(false)
+    , m_chunk_time(0), m_chunk_bytes(0)
+    {}
+
+    /**
+     * @brief Check the current mask when sizing while generating
+     *
+     * @return false if the mask is wider than the buffers allow
+     */
+    bool checkMask()
+    {
+        if (m_mask.getWidth() > m_width_limit) {
+            fprintf(stderr, "Error: do you reallly intend to generate words of length over %zu ?\n", m_width_limit);
+            m_error = true;
+            return false;
+        }
+        if (m_word.size() <= m_mask.getWidth()) {
+            m_word.resize(m_mask.getWidth() + 1);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Skip the masks before the start position when sizing while generating
+     *
+     * @param start first word
+     * @param resume resumed checkpoint, NULL without checkpoint to resume
+     * @return false on error
+     */
+    bool skipMasks(uint64_t start, const CheckpointState *resume)
+    {
+        uint64_t skipped = 0;
+        bool found = false;
+        uint64_t counted_len = 0, offset = 0;
+        size_t counted_width = 0;
+        if (start != 0 && m_gen.countWords(counted_len, counted_width)) {
+            // the generators counting their words seek to the start position
+            found = start < counted_len && m_gen.seekWord(start, offset) && m_gen(m_mask);
+            skipped = found ? start - offset : 0;
+        }
+        else if (start != 0 && resume && resume->m_mask != UINT64_MAX) {
+            // the checkpoint knows the mask of the start position
+            m_mask_number = resume->m_mask;
+            found = resume->m_offset <= start && m_gen.seek(m_mask_number) && m_gen(m_mask)
+                && resume->m_offset < m_mask.getLen();
+            skipped = start - resume->m_offset;
+            if (!found && m_gen.good()) {
+                fprintf(stderr, "Error: the checkpoint '%s' doesn't match the masks\n", m_options.m_resume_file.c_str());
+                return false;
+            }
+        }
+        else {
+            m_mask_number = 0;
+            while (m_gen(m_mask)) {
+                if (m_mask.getLen() > start - skipped) {
+                    found = true;
+                    break;
+                }
+                skipped += m_mask.getLen();
+                m_mask_number++;
+            }
+        }
+        if (!m_gen.good()) {
+            reportMasksError(m_options, m_mask_arg);
+            return false;
+        }
+        if (!found && start != 0) {
+            fprintf(stderr, "Error: the first word number is not valid\n");
+            return false;
+        }
+        if (found && !checkMask()) {
+            return false;
+        }
+        m_start = start - skipped;
+        m_mask_first = skipped;
+        m_todo = found ? UINT64_MAX : 0;
+        return true;
+    }
+
+    /**
+     * @brief Jump to the mask holding the start position of a range of known size
+     *
+     * @param start first word
+     * @param count number of words
+     * @return false if the start position can't be located
+     */
+    bool seek(uint64_t start, uint64_t count)
+    {
+        m_start = start;
+        m_mask_first = start;
+        if (count && !m_locator.locate(start, m_start)) {
+            fprintf(stderr, "Error: can't seek to the word %" PRIu64 " (that wasn't expected!)\n", start);
+            return false;
+        }
+        m_mask_first -= m_start;
+        m_todo = count;
+        return true;
+    }
+
+    /**
+     * @brief Load the next mask
+     */
+    void nextMask()
+    {
+        m_mask_first += m_mask.getLen();
+        m_start = 0;
+        const bool more = m_gen(m_mask);
+        if (more && m_mask_number != UINT64_MAX) {
+            m_mask_number++;
+        }
+        if (m_lazy && !more) {
+            // the total was unknown, stop after the last mask
+            m_todo = 0;
+            if (!m_gen.good()) {
+                reportMasksError(m_options, m_mask_arg);
+                m_error = true;
+            }
+        }
+        else if (m_lazy && !checkMask()) {
+            m_todo = 0;
+        }
+    }
+
+    /**
+     * @brief Save the position of the next word, the output must be flushed
+     *
+     * @param done true at the end of the range
+     */
+    void saveCheckpoint(bool done)
+    {
+        const uint64_t next = m_mask_first + m_start;
+        CheckpointState state = {m_inputs_hash, next, done ? next : m_end, done ? UINT64_MAX : m_mask_number,
+                                 done ? 0 : m_start, m_bytes_before + m_writer.getBytes()};
+        if (!m_checkpoint->save(state)) {
+            exit(1);
+        }
+    }
+
+    /**
+     * @brief Report the flushed range of a worker and take the next one from the server
+     */
+    void nextRange()
+    {
+        uint64_t begin, end;
+        bool more;
+        if (!m_client->next(begin, end, more)) {
+            exit(1);
+        }
+        if (!more) {
+            return;
+        }
+        m_locator.reset();
+        if (end > m_len || !m_locator.locate(begin, m_start)) {
+            fprintf(stderr, "Error: the range given by the work server doesn't match the masks\n");
+            exit(1);
+        }
+        m_mask_first = begin - m_start;
+        m_todo = end - begin;
+    }
+
+    /**
+     * @brief Maximum number of words of a chunk
+     *
+     * With the statistics or the checkpoints, the masks are generated in chunks to update
+     * the counters and save the position regularly.
+     */
+    uint64_t maxChunk() const
+    {
+        return m_stats || m_checkpoint ? (1 << 20) : UINT64_MAX;
     }
-    static inline MaskGenerator<uint32_t> *readMaskList(const char *spec, const CharsetMap<uint32_t> &default_charsets)
+
+    /**
+     * @brief Start the statistics of a chunk
+     *
+     * @param pending bytes generated but not yet committed to the writer
+     */
+    void startChunk(uint64_t pending)
     {
-        return readMaskListUtf8(spec, default_charsets);
+        if (m_stats) {
+            m_chunk_time = Stats::now();
+            m_chunk_bytes = m_writer.getBytes() + pending;
+        }
     }
-    static inline MaskGenerator<uint32_t> *readBruteforceConstraints(const char *spec, const CharsetMap<uint32_t> &default_charsets)
+
+    /**
+     * @brief Record the statistics of a chunk
+     *
+     * @param words number of words of the chunk
+     * @param pending bytes generated but not yet committed to the writer
+     */
+    void recordChunk(uint64_t words, uint64_t pending)
     {
-        return readBruteforceUtf8(spec, default_charsets);
+        if (m_stats) {
+            m_stats->addMask(m_mask_first, m_mask.getWidth(), words, m_writer.getBytes() + pending - m_chunk_bytes,
+                             Stats::now() - m_chunk_time);
+            m_stats->getWordsCounter().fetch_add(words, std::memory_order_relaxed);
+        }
     }
-    static constexpr int maxCharReprLen = 5;
-    static void charToString(uint32_t c, char *str)
+
+    /**
+     * @brief Move past a generated chunk
+     *
+     * Loads the next mask, saves a due checkpoint and takes the next range of a worker.
+     * The output is flushed before saving the position of the next word or reporting a range.
+     *
+     * @param words number of words of the chunk
+     * @param flush commits the generated words to the writer
+     */
+    template<typename Flush>
+    void endChunk(uint64_t words, Flush flush)
     {
-        int l = UTF::impl::CpToUtf8::write(c, str);
-        str[l] = 0;
+        m_todo -= words;
+        m_start += words;
+        if (m_todo && m_start == m_mask.getLen()) {
+            nextMask();
+        }
+        if (m_todo && m_checkpoint && m_checkpoint->isDue()) {
+            flush();
+            m_writer.flush();
+            saveCheckpoint(false);
+        }
+        if (!m_todo && m_client) {
+            flush();
+            m_writer.flush();
+            nextRange();
+        }
     }
 };
 
-#if defined(__WINDOWS__) || defined(__CYGWIN__)
-/*
- * For msys2/mingw64 or cygwin, gcc doesn't seem to use a fast builtin memcpy
- * Instead we have a slow one from the MS runtime, and an extra potato one from cygwin1.dll
- * This simple memcpy is faster...
+/**
+ * @brief Generate the words of a run encoded in UTF-8, straight into the buffers of the writer
+ *
+ * @param run position of the generation
+ * @param delim delimiter
+ * @param delim_width 0 or 1 (with or without delimiter)
  */
-static void *my_memcpy(void * __restrict dest, const void * __restrict src, size_t n) {
-    union P {
-        uint64_t *p64;
-        uint32_t *p32;
-        uint8_t *p8;
-        P(void *p) : p64(reinterpret_cast<uint64_t *>(p)) {}
-    };
-    union CP {
-        const uint64_t *p64;
-        const uint32_t *p32;
-        const uint8_t *p8;
-        CP(const void *p) : p64(reinterpret_cast<const uint64_t *>(p)) {}
+template<typename T>
+void generateTextUtf8(TextRun<T> &run, T delim, int delim_width)
+{
+    OutputWriter &writer = run.m_writer;
+    Utf8Encoder encoder;
+    char *b = writer.getBuffer();
+    OutputBuffer<char> bytes = {b, b, b + writer.getBufferSize()};
+    auto flush_bytes = [&writer](OutputBuffer<char> &o) {
+        writer.commit(o.m_p - o.m_begin);
+        char *nb = writer.getBuffer();
+        o = {nb, nb, nb + writer.getBufferSize()};
     };
-    P d(dest);
-    CP s(src);
-    while (n >= sizeof(uint64_t)) {
-        *d.p64++ = *s.p64++;
-        n -= sizeof(uint64_t);
+    const uint64_t max_chunk = run.maxChunk();
+    while (run.m_todo) {
+        uint64_t mask_rem = run.m_mask.getLen() - run.m_start;
+        uint64_t chunk = std::min(std::min(run.m_todo, mask_rem), max_chunk);
+        run.startChunk(bytes.m_p - bytes.m_begin);
+        generateWordsUtf8(run.m_mask, run.m_start, chunk, delim, delim_width, run.m_word.data(), bytes, flush_bytes, encoder);
+        run.recordChunk(chunk, bytes.m_p - bytes.m_begin);
+        run.endChunk(chunk, [&]() { flush_bytes(bytes); });
+    }
+    writer.commit(bytes.m_p - bytes.m_begin);
+}
+
+/**
+ * @brief Generate the words of a run as text, through the filter if any
+ *
+ * The 8-bit words are generated in the buffers of the writer, unless a spliced buffer could
+ * be committed less than half full. The other words go through a buffer given to the printer.
+ *
+ * @param run position of the generation
+ * @param filter filter of the words, may be NULL
+ * @param delim delimiter
+ * @param delim_width 0 or 1 (with or without delimiter)
+ * @param buffer_len number of characters of the intermediate buffer
+ * @param printer printer of the words
+ */
+template<typename T, typename Helper>
+void generateText(TextRun<T> &run, WordFilter<T> *filter, T delim, int delim_width, size_t buffer_len,
+                  typename Helper::Printer &printer)
+{
+    OutputWriter &writer = run.m_writer;
+    // a spliced buffer must be at least half full when it's committed
+    const bool direct_output = std::is_same<T, char>::value
+        && (!writer.isSplicing() || 2 * (run.m_width_limit + 1) <= writer.getBufferSize());
+    std::vector<T> buffer;
+    OutputBuffer<T> out;
+    if (direct_output) {
+        T *b = reinterpret_cast<T *>(writer.getBuffer());
+        out = {b, b, b + writer.getBufferSize() / sizeof(T)};
     }
-    while (n >= sizeof(uint32_t)) {
-        *d.p32++ = *s.p32++;
-        n -= sizeof(uint32_t);
+    else {
+        buffer.resize(buffer_len);
+        out = {buffer.data(), buffer.data(), buffer.data() + buffer.size()};
     }
-    while (n > 0) {
-        *d.p8++ = *s.p8++;
-        n --;
+    auto flush = [&printer, &writer, direct_output](OutputBuffer<T> &o) {
+        if (direct_output) {
+            writer.commit((o.m_p - o.m_begin) * sizeof(T));
+            T *b = reinterpret_cast<T *>(writer.getBuffer());
+            o = {b, b, b + writer.getBufferSize() / sizeof(T)};
+        }
+        else {
+            printer.print(o.m_begin, o.m_p - o.m_begin);
+            o.m_p = o.m_begin;
+        }
+    };
+    // bytes of the buffer of the writer not committed yet
+    auto pending = [&out, direct_output]() -> uint64_t {
+        return direct_output ? (out.m_p - out.m_begin) * sizeof(T) : 0;
+    };
+    const uint64_t max_chunk = run.maxChunk();
+    while (run.m_todo) {
+        uint64_t mask_rem = run.m_mask.getLen() - run.m_start;
+        uint64_t chunk = std::min(std::min(run.m_todo, mask_rem), max_chunk);
+        run.startChunk(pending());
+        if (filter) {
+            filter->generate(run.m_mask, run.m_start, chunk, delim, delim_width, run.m_word.data(), out, flush);
+        }
+        else {
+            generateWords(run.m_mask, run.m_start, chunk, delim, delim_width, run.m_word.data(), out, flush);
+        }
+        // the words of the intermediate buffer are only counted once printed
+        if (run.m_stats && !direct_output) {
+            flush(out);
+        }
+        run.recordChunk(chunk, pending());
+        run.endChunk(chunk, [&]() { flush(out); });
     }
-    return dest;
+    flush(out);
 }
-#endif /* __WINDOWS__ || __CYGWIN__ */
 
 template<typename T>
 int work(const struct Options &options, const char *mask_arg) {
@@ -410,79 +1590,92 @@ int work(const struct Options &options, const char *mask_arg) {
         }
     }
 
-    // now get a generator for our masks
-    MaskGenerator<T> *gen = NULL;
-    if (!options.m_bruteforce) {
-        gen = Helper::readMaskList(mask_arg, charsets);
-        if (!gen) {
-            fprintf(stderr, "Error while reading the mask definition '%s'\n", mask_arg);
+    std::unique_ptr<Stats> stats;
+    if (options.m_stats || !options.m_stats_json.empty()) {
+        stats.reset(new Stats(options.m_stats, options.m_stats_interval, options.m_stats_json));
+    }
+    
+    // a checkpoint is only resumed, and a worker only served, with the same inputs
+    const bool distributed = !options.m_serve.empty() || !options.m_worker.empty();
+    uint64_t inputs_hash = Checkpoint::hashInit;
+    if (!options.m_checkpoint_file.empty() || !options.m_resume_file.empty() || distributed) {
+        inputs_hash = hashInputs(options, mask_arg);
+    }
+    CheckpointState resume_state = {0, 0, UINT64_MAX, UINT64_MAX, 0, 0};
+    bool resumed = false;
+    if (!options.m_resume_file.empty()) {
+        if (!Checkpoint::load(options.m_resume_file.c_str(), resume_state, resumed)) {
             return 1;
         }
-    }
-    else {
-        gen = Helper::readBruteforceConstraints(mask_arg, charsets);
-        if (!gen) {
-            fprintf(stderr, "Error while reading the bruteforce constraints from '%s'\n", mask_arg);
+        if (resumed && resume_state.m_hash != inputs_hash) {
+            fprintf(stderr, "Error: the checkpoint '%s' was saved with other masks or options\n", options.m_resume_file.c_str());
             return 1;
         }
     }
+    const CheckpointState *resume = resumed ? &resume_state : NULL;
     
-    // first pass through the generator to check if everything is valid
-    // and get the total length and max width
-    uint64_t ml_len = 0;
-    size_t ml_max_width = 0;
-    {
-        uint64_t size;
-        size_t width;
-        while (gen->good() && (*gen)(size, width)) {
-            if (uadd64_overflow(ml_len, size, &ml_len)) {
-                fprintf(stderr, "Error: the total number of words would overflow a 64 bits integer\n");
-                abort();
-            }
-            ml_max_width = std::max<size_t>(ml_max_width, width);
-        }
-    }
-    if (!gen->good()) {
-        if (!options.m_bruteforce) {
-            fprintf(stderr, "Error while reading the mask definition '%s'\n", mask_arg);
-        }
-        else {
-            fprintf(stderr, "Error while reading the bruteforce constraints from '%s'\n", mask_arg);
-        }
+    // the filters of the words
+    std::unique_ptr<WordFilter<T>> filter;
+    if (!createFilter(options, filter)) {
         return 1;
     }
     
-    uint64_t start_idx = 0;
-    uint64_t end_idx = ml_len; // after the last word
+    uint64_t phase_start = stats ? Stats::now() : 0;
     
-    if (options.m_job_set) {
-        // create our staring position and the number of word to generate
-        // from a job spec
-        // the remainder is distributed on the first jobs
-        uint64_t q = ml_len / options.m_job_total;
-        uint64_t r = ml_len - q * options.m_job_total;
-        
-        uint64_t todo = q;
-        start_idx = q * (options.m_job_number - 1);
-        if (r != 0) {
-            start_idx += std::min((uint64_t) options.m_job_number - 1, r);
-            todo += options.m_job_number <= r ? 1 : 0;
-        }
-        end_idx = start_idx + todo;
+    // now get a generator for our masks
+    // and get the total length and max width
+    MaskIndex mask_index;
+    size_t ml_max_width = 0;
+    uint64_t ml_len = 0;
+    bool counted = false; // the words were counted without a sizing pass
+    bool lazy = false; // the masks are sized while generating, the total is unknown
+    MaskGenerator<T> *gen = openMasks<T, Helper>(options, mask_arg, charsets, mask_index, ml_max_width);
+    if (!gen) {
+        return 1;
     }
-    else {
-        if (options.m_start_word_set) {
-            start_idx = options.m_start_word;
+    if (options.m_index_file.empty()) {
+        // without a range to split or a size to print, the masks are sized and validated while generating
+        lazy = !options.m_job_set && !options.m_end_word_set && !options.m_print_size
+            && !options.m_permute && !options.m_word_at && !options.m_index_of && options.m_compile_index.empty()
+            && options.m_threads <= 1 && options.m_format == FORMAT_TEXT && !distributed
+            && (!resumed || resume_state.m_end == UINT64_MAX);
+        if (!lazy && !gen->canReset()) {
+            fprintf(stderr, "Error: the masks read from a stream can only be generated from the start or from --begin,"
+                            " without --job, --end, --size, --permute, --threads, --format, --compile-index, --serve, --worker"
+                            " or the lookups\n");
+            delete gen;
+            return 1;
         }
-        if (options.m_end_word_set) {
-            end_idx = options.m_end_word + 1;
+        if (!lazy) {
+            counted = sizeMasks(*gen, mask_index, ml_len, ml_max_width);
         }
-        
-        if (end_idx - 1 < start_idx || end_idx > ml_len) {
-            fprintf(stderr, "Error: the last word number is not valid\n");
+        if (!gen->good()) {
+            reportMasksError(options, mask_arg);
+            delete gen;
             return 1;
         }
     }
+    if (lazy) {
+        ml_len = UINT64_MAX;
+    }
+    else if (!counted) {
+        ml_len = mask_index.getLen();
+    }
+    if (stats) {
+        stats->addPhase(Stats::PHASE_SIZING, Stats::now() - phase_start);
+    }
+    
+    if (!options.m_compile_index.empty()) {
+        bool ok = Helper::writeCompiledIndex(options.m_compile_index.c_str(), *gen);
+        delete gen;
+        return ok ? 0 : 1;
+    }
+    
+    uint64_t start_idx, end_idx;
+    if (!getRange(options, ml_len, lazy, resume, start_idx, end_idx)) {
+        delete gen;
+        return 1;
+    }
     
     if (options.m_print_size) {
         printf("%" PRId64 "\n", end_idx - start_idx);
@@ -490,101 +1683,341 @@ int work(const struct Options &options, const char *mask_arg) {
         return 0;
     }
     
-    typename Helper::Printer printer;
-    std::vector<T> buffer(8192);
-    T * buffer_p = buffer.data();
-    const T * buffer_end = buffer.data() + buffer.size();
-    std::vector<T> word(ml_max_width + 1);
-    if (word.size() > buffer.size()) {
-        fprintf(stderr, "Error: do you reallly intend to generate words of length over %zu ?\n", buffer.size());
+    std::unique_ptr<WorkClient> client;
+    if (!options.m_serve.empty()) {
+        // the server only hands out the range, the workers generate it
+        WorkServer server(inputs_hash, start_idx, end_idx, options.m_chunk);
+        delete gen;
+        return server.listen(options.m_serve.c_str()) && server.run() ? 0 : 1;
+    }
+    else if (!options.m_worker.empty()) {
+        client.reset(new WorkClient(inputs_hash));
+        if (!client->connect(options.m_worker.c_str())) {
+            delete gen;
+            return 1;
+        }
+    }
+    
+    // 8192 characters by default, larger buffers for the splicing
+    size_t buffer_size = options.m_buffer_size;
+    if (buffer_size == 0) {
+        buffer_size = options.m_vmsplice ? (256 << 10) : 8192 * sizeof(T);
+    }
+    const size_t buffer_len = std::max<size_t>(1, buffer_size / sizeof(T));
+    if (ml_max_width + 1 > buffer_len) {
+        fprintf(stderr, "Error: do you reallly intend to generate words of length over %zu ?\n", buffer_len);
+        delete gen;
         return 1;
     }
     
     // at last create the output file if needed now that we're not supposed to fail anymore
-    int fdout = STDOUT_FILENO;
-    if (!options.m_output_file.empty()) {
-#if defined(__WINDOWS__)
-        fdout = open(options.m_output_file.c_str(), O_WRONLY | O_TRUNC | O_CREAT | O_BINARY, S_IRUSR|S_IWUSR);
-#else
-        fdout = open(options.m_output_file.c_str(), O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR|S_IWUSR);
-#endif
-        if (fdout < 0) {
-            fprintf(stderr, "Error: can't open the output file: %m\n");
-            return 1;
-        }
+    int fdout = openOutput(options, resume);
+    if (fdout < 0) {
+        delete gen;
+        return 1;
+    }
+    
+    OutputWriter writer(fdout, buffer_size, options.m_vmsplice, options.m_write_buffers);
+    typename Helper::Printer printer(writer);
+    if (stats) {
+        writer.setTimed();
+    }
+    std::unique_ptr<Checkpoint> checkpoint;
+    if (!options.m_checkpoint_file.empty()) {
+        checkpoint.reset(new Checkpoint(options.m_checkpoint_file, options.m_checkpoint_interval));
     }
     
+    // width of the widest mask, or when sizing while generating, the widest mask allowed by the buffers
+    size_t width_limit = ml_max_width;
+    if (lazy) {
+        const size_t half = writer.getBufferSize() / 2;
+        width_limit = buffer_len - 1;
+        if (writer.isSplicing() && std::is_same<T, char>::value) {
+            width_limit = std::min<size_t>(width_limit, half - 1);
+        }
+        else if (writer.isSplicing()) {
+            width_limit = half > 1 + utf8_copy_width ? std::min<size_t>(width_limit, (half - 1 - utf8_copy_width) / 4) : 0;
+        }
+    }
     
     T delim = options.m_zero_delim ? '\0' : '\n';
     int delim_width = options.m_no_delim ? 0 : 1;
-    uint64_t todo = end_idx - start_idx;
-    Mask<T> current_mask;
+    WordLocator<T> locator(*gen, mask_index, counted, ml_len);
     
-    // skip to the start position
-    gen->reset();
-    while (start_idx) {
-        (*gen)(current_mask);
-        uint64_t mask_len = current_mask.getLen();
-        if (start_idx >= mask_len) {
-            start_idx -= mask_len;
+    if (options.m_word_at || options.m_index_of) {
+        if (stats) {
+            stats->start(writer);
         }
-        else {
-            break;
-        }
-    }
-    // if we are right at the end of a mask, load the next one
-    if (start_idx == 0) {
-        (*gen)(current_mask);
-    }
-    while (todo) {
-        current_mask.setPosition(start_idx);
-        uint64_t mask_rem = current_mask.getLen() - start_idx;
-        uint64_t chunk = std::min(todo, mask_rem);
-        size_t w = current_mask.getWidth();
-        // the first word needs to use Mask<T>::getCurrent to fully initialize the word
-        if (chunk >= 1) {
-            current_mask.getCurrent(word.data());
-            word[w] = delim;
-            if (w + delim_width > size_t(buffer_end - buffer_p)) {
-                printer.print(buffer.data(), buffer_p - buffer.data(), fdout);
-                buffer_p = buffer.data();
-            }
-#if defined(__WINDOWS__) || defined(__CYGWIN__)
-            my_memcpy(buffer_p, word.data(), sizeof(T) * (w + delim_width));
-#else
-            memcpy(buffer_p, word.data(), sizeof(T) * (w + delim_width));
-#endif
-            buffer_p += w + delim_width;
-        }
-        // following words use Mask<T>::getNext to update the word
-        for (uint64_t i = 1; i < chunk; i++) {
-            current_mask.getNext(word.data());
-            word[w] = delim;
-            if (w + delim_width > size_t(buffer_end - buffer_p)) {
-                printer.print(buffer.data(), buffer_p - buffer.data(), fdout);
-                buffer_p = buffer.data();
-            }
-#if defined(__WINDOWS__) || defined(__CYGWIN__)
-            my_memcpy(buffer_p, word.data(), sizeof(T) * (w + delim_width));
-#else
-            memcpy(buffer_p, word.data(), sizeof(T) * (w + delim_width));
-#endif
-            buffer_p += w + delim_width;
+        int r = answerLookups<T, Helper>(*gen, locator, options.m_index_of, options.m_zero_delim ? '\0' : '\n', printer, writer);
+        writer.flush();
+        if (stats && !stats->finish()) {
+            r = 1;
         }
-
-        todo -= chunk;
-        if (todo) {
-            (*gen)(current_mask);
-            start_idx = 0;
+        if (fdout != STDOUT_FILENO) {
+            close(fdout);
+        }
+        delete gen;
+        return r;
+    }
+    
+    TextRun<T> run(options, mask_arg, *gen, locator, writer, lazy, width_limit, ml_len, ml_max_width);
+    run.m_stats = stats.get();
+    run.m_checkpoint = checkpoint.get();
+    run.m_client = client.get();
+    run.m_inputs_hash = inputs_hash;
+    run.m_end = lazy ? UINT64_MAX : end_idx;
+    run.m_bytes_before = resumed ? resume_state.m_bytes : 0;
+    std::atomic<uint64_t> *written_words = stats ? &stats->getWordsCounter() : NULL;
+    if (lazy) {
+        // skip the masks before the start position
+        phase_start = stats ? Stats::now() : 0;
+        run.m_error = !run.skipMasks(start_idx, resume);
+        if (stats) {
+            stats->addPhase(Stats::PHASE_SEEK, Stats::now() - phase_start);
+            stats->start(writer);
+        }
+    }
+    else if (options.m_permute) {
+        // every word is located on its own
+        if (stats) {
+            stats->start(writer);
+        }
+        run.m_error = !generatePermuted<T, Helper>(locator, start_idx, end_idx - start_idx, options.m_permute_seed,
+                                                   ml_max_width, delim, delim_width, printer, written_words);
+    }
+    else {
+        // jump to the mask holding the start position
+        phase_start = stats ? Stats::now() : 0;
+        run.m_error = !run.seek(start_idx, end_idx - start_idx);
+        if (stats) {
+            stats->addPhase(Stats::PHASE_SEEK, Stats::now() - phase_start);
+            stats->start(writer);
         }
     }
+    if (client && !run.m_error) {
+        run.nextRange();
+    }
+    if (run.m_todo && options.m_threads > 1) {
+        ThreadedGenerator<T, typename Helper::Printer> tgen(options.m_threads, !options.m_unordered, ml_max_width, delim, delim_width, printer, written_words);
+        tgen.run(*gen, run.m_mask, run.m_start, run.m_todo);
+        run.m_todo = 0;
+    }
+    if (run.m_todo && options.m_format != FORMAT_TEXT) {
+        generateRecords(*gen, run.m_mask, run.m_start, run.m_todo, options.m_format, ml_max_width, buffer_len, writer, written_words);
+        run.m_todo = 0;
+    }
+    // the unicode words are encoded in UTF-8 while generating, straight into the buffers of the writer
+    if (run.m_todo && std::is_same<T, uint32_t>::value && !filter
+        && (!writer.isSplicing() || 2 * (4 * width_limit + 1 + utf8_copy_width) <= writer.getBufferSize())) {
+        generateTextUtf8(run, delim, delim_width);
+    }
+    generateText<T, Helper>(run, filter.get(), delim, delim_width, buffer_len, printer);
 
-    printer.print(buffer.data(), buffer_p - buffer.data(), fdout);
+    writer.flush();
+    if (checkpoint && !run.m_error) {
+        run.saveCheckpoint(true);
+    }
+    int ret = run.m_error ? 1 : 0;
+    if (stats && !stats->finish()) {
+        ret = 1;
+    }
     if (fdout != STDOUT_FILENO) {
         close(fdout);
     }
     delete gen;
-    return 0;
+    return ret;
+}
+
+/**
+ * @brief Parse a decimal option value
+ *
+ * @param s option argument
+ * @param max largest accepted value
+ * @param value set to the parsed value
+ * @return false if \a s is not a number, is negative or is above \a max
+ */
+static bool parseUnsigned(const char *s, unsigned int max, unsigned int &value)
+{
+    // strtoul would accept a sign and wrap the negative values around
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+    errno = 0;
+    char *end = NULL;
+    unsigned long v = strtoul(s, &end, 10);
+    if (errno != 0 || *end != 0 || v > max) {
+        return false;
+    }
+    value = (unsigned int) v;
+    return true;
+}
+
+// largest number of threads, each one gets 4 output blocks of at least 128 KiB
+static constexpr unsigned int max_threads = 256;
+
+// codes of the long options without a short option
+enum {
+    OPT_UNORDERED = 256,
+    OPT_SIMD,
+    OPT_COMPILE_INDEX,
+    OPT_INDEX,
+    OPT_BUFFER_SIZE,
+    OPT_VMSPLICE,
+    OPT_WRITE_BUFFERS,
+    OPT_WORD_AT,
+    OPT_INDEX_OF,
+    OPT_PERMUTE,
+    OPT_STATS,
+    OPT_STATS_JSON,
+    OPT_FORMAT,
+    OPT_CHECKPOINT,
+    OPT_CHECKPOINT_INTERVAL,
+    OPT_RESUME,
+    OPT_SERVE,
+    OPT_WORKER,
+    OPT_CHUNK,
+    OPT_DEDUP,
+    OPT_ORDER,
+    OPT_PRIORITIES,
+    OPT_MAX_REPEAT,
+    OPT_MIN_CLASSES,
+    OPT_REGEX,
+    OPT_EXCLUDE,
+};
+
+/**
+ * @brief Options taking part in the conflicts between the modes
+ */
+enum ModeOption {
+    MODE_WORD_AT,
+    MODE_INDEX_OF,
+    MODE_THREADS,
+    MODE_PERMUTE,
+    MODE_FORMAT,
+    MODE_VMSPLICE,
+    MODE_COMPILE_INDEX,
+    MODE_CHECKPOINT,
+    MODE_RESUME,
+    MODE_JOB,
+    MODE_BEGIN,
+    MODE_END,
+    MODE_SIZE,
+    MODE_SERVE,
+    MODE_WORKER,
+    MODE_INDEX,
+    MODE_BRUTEFORCE,
+    MODE_DEDUP,
+    MODE_ORDER,
+    MODE_MAX_REPEAT,
+    MODE_MIN_CLASSES,
+    MODE_REGEX,
+    MODE_EXCLUDE,
+    MODE_COUNT
+};
+
+static const char *const mode_option_names[MODE_COUNT] = {
+    "--word-at", "--index-of", "--threads", "--permute", "--format", "--vmsplice", "--compile-index", "--checkpoint",
+    "--resume", "--job", "--begin", "--end", "--size", "--serve", "--worker", "--index", "--bruteforce",
+    "--dedup", "--order", "--max-repeat", "--min-classes", "--regex", "--exclude"
+};
+
+static bool isModeOptionSet(const Options &options, ModeOption option)
+{
+    switch (option) {
+        case MODE_WORD_AT:          return options.m_word_at;
+        case MODE_INDEX_OF:         return options.m_index_of;
+        case MODE_THREADS:          return options.m_threads > 1;
+        case MODE_PERMUTE:          return options.m_permute;
+        case MODE_FORMAT:           return options.m_format != FORMAT_TEXT;
+        case MODE_VMSPLICE:         return options.m_vmsplice;
+        case MODE_COMPILE_INDEX:    return !options.m_compile_index.empty();
+        case MODE_CHECKPOINT:       return !options.m_checkpoint_file.empty();
+        case MODE_RESUME:           return !options.m_resume_file.empty();
+        case MODE_JOB:              return options.m_job_set;
+        case MODE_BEGIN:            return options.m_start_word_set;
+        case MODE_END:              return options.m_end_word_set;
+        case MODE_SIZE:             return options.m_print_size;
+        case MODE_SERVE:            return !options.m_serve.empty();
+        case MODE_WORKER:           return !options.m_worker.empty();
+        case MODE_INDEX:            return !options.m_index_file.empty();
+        case MODE_BRUTEFORCE:       return options.m_bruteforce;
+        case MODE_DEDUP:            return options.m_dedup;
+        case MODE_ORDER:            return options.m_order != ORDER_FILE;
+        case MODE_MAX_REPEAT:       return options.m_max_repeat != 0;
+        case MODE_MIN_CLASSES:      return options.m_min_classes != 0;
+        case MODE_REGEX:            return options.m_regex_set;
+        case MODE_EXCLUDE:          return !options.m_exclude_file.empty();
+        default:                    return false;
+    }
+}
+
+static constexpr uint32_t modeBit(ModeOption option)
+{
+    return 1u << option;
+}
+
+// the modes generating the words with their own loops
+static constexpr uint32_t own_loops = modeBit(MODE_THREADS) | modeBit(MODE_PERMUTE) | modeBit(MODE_FORMAT);
+// the modes which can't be stopped and continued at a word
+static constexpr uint32_t not_resumable = own_loops | modeBit(MODE_WORD_AT) | modeBit(MODE_INDEX_OF)
+                                          | modeBit(MODE_VMSPLICE) | modeBit(MODE_COMPILE_INDEX);
+// the options giving the range of words
+static constexpr uint32_t range_options = modeBit(MODE_JOB) | modeBit(MODE_BEGIN) | modeBit(MODE_END);
+
+/**
+ * @brief The options which can't be used together
+ *
+ * Each entry excludes a set of options when its option is set, with an optional explanation.
+ */
+static const struct OptionConflict {
+    ModeOption m_option;
+    uint32_t m_excluded;    /*!< bits of the excluded options */
+    const char *m_reason;   /*!< explanation printed with the error, may be NULL */
+} option_conflicts[] = {
+    {MODE_ORDER, modeBit(MODE_INDEX), "compile the index with --order"},
+    {MODE_DEDUP, modeBit(MODE_BRUTEFORCE), "--dedup only applies to the masks"},
+    {MODE_DEDUP, modeBit(MODE_INDEX), "compile the index with --dedup"},
+    {MODE_MAX_REPEAT, own_loops, NULL},
+    {MODE_MIN_CLASSES, own_loops, NULL},
+    {MODE_REGEX, own_loops, NULL},
+    {MODE_EXCLUDE, own_loops, NULL},
+    {MODE_WORD_AT, modeBit(MODE_INDEX_OF), NULL},
+    {MODE_FORMAT, modeBit(MODE_THREADS) | modeBit(MODE_PERMUTE) | modeBit(MODE_WORD_AT) | modeBit(MODE_INDEX_OF), NULL},
+    {MODE_CHECKPOINT, not_resumable, NULL},
+    {MODE_RESUME, not_resumable, NULL},
+    {MODE_RESUME, range_options, "--resume continues the range of the checkpoint"},
+    {MODE_SERVE, not_resumable | modeBit(MODE_SIZE) | modeBit(MODE_CHECKPOINT) | modeBit(MODE_RESUME) | modeBit(MODE_WORKER), NULL},
+    {MODE_WORKER, not_resumable | modeBit(MODE_SIZE) | modeBit(MODE_CHECKPOINT) | modeBit(MODE_RESUME), NULL},
+    {MODE_WORKER, range_options, "a worker generates the ranges of the server"},
+};
+
+/**
+ * @brief Check the options against the table of conflicts
+ *
+ * @param options options
+ * @return false after printing the first conflict found
+ */
+static bool checkConflicts(const Options &options)
+{
+    for (const OptionConflict &c : option_conflicts) {
+        if (!isModeOptionSet(options, c.m_option)) {
+            continue;
+        }
+        for (int i = 0; i < MODE_COUNT; i++) {
+            const ModeOption other = (ModeOption) i;
+            if ((c.m_excluded & modeBit(other)) && isModeOptionSet(options, other)) {
+                if (c.m_reason) {
+                    fprintf(stderr, "Error: %s can't be used with %s (%s)\n", mode_option_names[c.m_option],
+                            mode_option_names[other], c.m_reason);
+                }
+                else {
+                    fprintf(stderr, "Error: %s can't be used with %s\n", mode_option_names[c.m_option], mode_option_names[other]);
+                }
+                return false;
+            }
+        }
+    }
+    return true;
 }
 
 int real_main(int argc, char **argv)
@@ -610,9 +2043,36 @@ int real_main(int argc, char **argv)
         {"custom-charset3", required_argument, NULL, '3'},
         {"custom-charset4", required_argument, NULL, '4'},
         {"charset", required_argument, NULL, 'c'},
+        {"threads", required_argument, NULL, 't'},
+        {"unordered", no_argument, NULL, OPT_UNORDERED},
+        {"simd", no_argument, NULL, OPT_SIMD},
+        {"compile-index", required_argument, NULL, OPT_COMPILE_INDEX},
+        {"index", required_argument, NULL, OPT_INDEX},
+        {"buffer-size", required_argument, NULL, OPT_BUFFER_SIZE},
+        {"vmsplice", no_argument, NULL, OPT_VMSPLICE},
+        {"write-buffers", required_argument, NULL, OPT_WRITE_BUFFERS},
+        {"word-at", no_argument, NULL, OPT_WORD_AT},
+        {"index-of", no_argument, NULL, OPT_INDEX_OF},
+        {"permute", required_argument, NULL, OPT_PERMUTE},
+        {"stats", optional_argument, NULL, OPT_STATS},
+        {"stats-json", required_argument, NULL, OPT_STATS_JSON},
+        {"format", required_argument, NULL, OPT_FORMAT},
+        {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+        {"checkpoint-interval", required_argument, NULL, OPT_CHECKPOINT_INTERVAL},
+        {"resume", required_argument, NULL, OPT_RESUME},
+        {"serve", required_argument, NULL, OPT_SERVE},
+        {"worker", required_argument, NULL, OPT_WORKER},
+        {"chunk", required_argument, NULL, OPT_CHUNK},
+        {"dedup", no_argument, NULL, OPT_DEDUP},
+        {"order", required_argument, NULL, OPT_ORDER},
+        {"priorities", required_argument, NULL, OPT_PRIORITIES},
+        {"max-repeat", required_argument, NULL, OPT_MAX_REPEAT},
+        {"min-classes", required_argument, NULL, OPT_MIN_CLASSES},
+        {"regex", required_argument, NULL, OPT_REGEX},
+        {"exclude", required_argument, NULL, OPT_EXCLUDE},
         {NULL, 0, NULL, 0}
     };
-    const char *shortopt = "uBmj:b:e:o:znsh1:2:3:4:c:";
+    const char *shortopt = "uBmj:b:e:o:znsh1:2:3:4:c:t:";
     
     int opt;
     while ((opt = getopt_long(argc, argv, shortopt, longopts, 0)) >= 0) {
@@ -684,6 +2144,167 @@ int real_main(int argc, char **argv)
             case 'c':
                 options.m_charsets_opts.emplace_back(0, optarg);
                 break;
+            case 't':
+            {
+                if (!parseUnsigned(optarg, max_threads, options.m_threads)) {
+                    fprintf(stderr, "Error: wrong number of threads (%s), at most %u\n", optarg, max_threads);
+                    return 1;
+                }
+                if (options.m_threads == 0) {
+                    options.m_threads = std::min(max_threads, std::max(1u, std::thread::hardware_concurrency()));
+                }
+            }
+                break;
+            case OPT_UNORDERED:
+                options.m_unordered = true;
+                break;
+            case OPT_SIMD:
+                options.m_simd = true;
+                break;
+            case OPT_COMPILE_INDEX:
+                options.m_compile_index = std::string(optarg);
+                break;
+            case OPT_INDEX:
+                options.m_index_file = std::string(optarg);
+                break;
+            case OPT_BUFFER_SIZE:
+            {
+                unsigned int kib = 0;
+                int r = sscanf(optarg, "%u", &kib);
+                if (r != 1 || kib == 0 || kib > (1u << 20)) {
+                    fprintf(stderr, "Error: wrong output buffer size (%s)\n", optarg);
+                    return 1;
+                }
+                options.m_buffer_size = (size_t) kib << 10;
+            }
+                break;
+            case OPT_VMSPLICE:
+                options.m_vmsplice = true;
+                break;
+            case OPT_WRITE_BUFFERS:
+                if (!parseUnsigned(optarg, 256, options.m_write_buffers) || options.m_write_buffers == 0) {
+                    fprintf(stderr, "Error: wrong number of output buffers (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_WORD_AT:
+                options.m_word_at = true;
+                break;
+            case OPT_INDEX_OF:
+                options.m_index_of = true;
+                break;
+            case OPT_PERMUTE:
+            {
+                int r = sscanf(optarg, "%" PRIu64, &options.m_permute_seed);
+                if (r != 1) {
+                    fprintf(stderr, "Error: wrong permutation seed (%s)\n", optarg);
+                    return 1;
+                }
+                options.m_permute = true;
+            }
+                break;
+            case OPT_STATS:
+                if (optarg) {
+                    int r = sscanf(optarg, "%u", &options.m_stats_interval);
+                    if (r != 1) {
+                        fprintf(stderr, "Error: wrong statistics interval (%s)\n", optarg);
+                        return 1;
+                    }
+                }
+                options.m_stats = true;
+                break;
+            case OPT_STATS_JSON:
+                options.m_stats_json = std::string(optarg);
+                break;
+            case OPT_FORMAT:
+                if (strcmp(optarg, "text") == 0) {
+                    options.m_format = FORMAT_TEXT;
+                }
+                else if (strcmp(optarg, "fixed") == 0) {
+                    options.m_format = FORMAT_FIXED;
+                }
+                else if (strcmp(optarg, "blocks") == 0) {
+                    options.m_format = FORMAT_BLOCKS;
+                }
+                else {
+                    fprintf(stderr, "Error: wrong output format (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_CHECKPOINT:
+                options.m_checkpoint_file = std::string(optarg);
+                break;
+            case OPT_CHECKPOINT_INTERVAL:
+                if (!parseUnsigned(optarg, UINT_MAX, options.m_checkpoint_interval)) {
+                    fprintf(stderr, "Error: wrong checkpoint interval (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_RESUME:
+                options.m_resume_file = std::string(optarg);
+                break;
+            case OPT_DEDUP:
+                options.m_dedup = true;
+                break;
+            case OPT_ORDER:
+                if (strcmp(optarg, "file") == 0) {
+                    options.m_order = ORDER_FILE;
+                }
+                else if (strcmp(optarg, "size") == 0) {
+                    options.m_order = ORDER_SIZE;
+                }
+                else if (strcmp(optarg, "priority") == 0) {
+                    options.m_order = ORDER_PRIORITY;
+                }
+                else if (strcmp(optarg, "density") == 0) {
+                    options.m_order = ORDER_DENSITY;
+                }
+                else {
+                    fprintf(stderr, "Error: wrong order of the masks (%s)\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_PRIORITIES:
+                options.m_priorities_file = std::string(optarg);
+                break;
+            case OPT_MAX_REPEAT:
+            {
+                if (!parseUnsigned(optarg, UINT_MAX, options.m_max_repeat) || options.m_max_repeat == 0) {
+                    fprintf(stderr, "Error: wrong maximum number of repeated characters (%s)\n", optarg);
+                    return 1;
+                }
+            }
+                break;
+            case OPT_MIN_CLASSES:
+            {
+                if (!parseUnsigned(optarg, 4, options.m_min_classes)) {
+                    fprintf(stderr, "Error: wrong minimum number of classes of characters (%s)\n", optarg);
+                    return 1;
+                }
+            }
+                break;
+            case OPT_REGEX:
+                options.m_regex = std::string(optarg);
+                options.m_regex_set = true;
+                break;
+            case OPT_EXCLUDE:
+                options.m_exclude_file = std::string(optarg);
+                break;
+            case OPT_SERVE:
+                options.m_serve = std::string(optarg);
+                break;
+            case OPT_WORKER:
+                options.m_worker = std::string(optarg);
+                break;
+            case OPT_CHUNK:
+            {
+                int r = sscanf(optarg, "%" PRIu64, &options.m_chunk);
+                if (r != 1 || options.m_chunk == 0) {
+                    fprintf(stderr, "Error: wrong chunk size (%s)\n", optarg);
+                    return 1;
+                }
+            }
+                break;
             default:
                 short_usage();
                 return 1;
@@ -693,12 +2314,32 @@ int real_main(int argc, char **argv)
     argc -= optind;
     argv += optind;
     
-    if (argc != 1) {
+    // a compiled index replaces the mask argument
+    if (argc != (options.m_index_file.empty() ? 1 : 0)) {
         short_usage();
         return 1;
     }
     
-    const char *mask_arg = argv[0];
+    const char *mask_arg = argc ? argv[0] : NULL;
+    
+    if ((options.m_order == ORDER_PRIORITY || options.m_order == ORDER_DENSITY) != !options.m_priorities_file.empty()) {
+        fprintf(stderr, "Error: --priorities is required by --order=priority and --order=density, and only by them\n");
+        return 1;
+    }
+    
+    if (!checkConflicts(options)) {
+        return 1;
+    }
+    
+    if (options.m_simd && options.m_unicode) {
+        fprintf(stderr, "Warning: --simd only applies to the 8-bit masks, using the scalar generator\n");
+    }
+    else if (options.m_simd) {
+        // pick the kernel once for all the threads
+        if (Simd::enableBackend() == NULL) {
+            fprintf(stderr, "Warning: no vectorized generator for this CPU, using the scalar generator\n");
+        }
+    }
     
     if (!options.m_unicode) {
         int r = work<char>(options, mask_arg);
@@ -712,6 +2353,9 @@ int real_main(int argc, char **argv)
     return 0;
 }
 
+// the benchmarks call real_main from their own entry point
+#if !defined(MASKUNI_NO_MAIN)
+
 #if defined(__WINDOWS__)
 #include <windows.h>
 #include <io.h>
@@ -814,3 +2458,5 @@ int main(int argc, char **argv) {
 }
 
 #endif /* WINDOWS */
+
+#endif /* !MASKUNI_NO_MAIN */